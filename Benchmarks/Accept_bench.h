@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "ShardedAcceptor.hpp"
+
+/*! \file Accept_bench.h
+\brief Benchmark of a connection storm over loopback, in connections accepted per second.
+Several threads connect and disconnect as fast as they can, as clients reconnecting after a restart, against one acceptor
+and against one acceptor per IO thread sharing the port with SO_REUSEPORT. The gain grows with the number of cores.
+*/
+
+namespace Accept_bench
+{
+	using boost::asio::ip::tcp;
+	typedef std::chrono::high_resolution_clock Clock;
+
+	/*!
+	Accept nb_connections connections made by nb_connectors threads, with nb_shards acceptors run by nb_threads IO threads
+	*/
+	static double connections_per_second(unsigned int nb_shards, unsigned int nb_threads, unsigned int nb_connectors, int nb_connections)
+	{
+		boost::asio::io_service io_service;
+		std::atomic<int> accepted(0);
+		ShardedAcceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), nb_shards,
+			[&](tcp::socket& socket)
+			{
+				tcp::socket connection(std::move(socket));
+				accepted++;
+			});
+		unsigned short port = acceptor.port();
+		std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(io_service));
+		std::vector<std::thread> threads;
+		for (unsigned int i = 0; i < nb_threads; ++i)
+			threads.push_back(std::thread([&]() { io_service.run(); }));
+
+		auto start = Clock::now();
+		std::vector<std::thread> connectors;
+		for (unsigned int i = 0; i < nb_connectors; ++i)
+		{
+			connectors.push_back(std::thread([=]()
+			{
+				boost::asio::io_service client_service;
+				for (int n = i; n < nb_connections; n += nb_connectors)
+				{
+					tcp::socket socket(client_service);
+					socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+				}
+			}));
+		}
+		for (auto& connector : connectors)
+			connector.join();
+		while (accepted < nb_connections)
+			std::this_thread::yield();
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+
+		io_service.post([&]() { acceptor.close(); });
+		work.reset();
+		for (auto& thread : threads)
+			thread.join();
+		return nb_connections / elapsed.count();
+	}
+
+	static void print_line(const std::string& name, double rate, double reference)
+	{
+		std::cout << std::left << std::setw(22) << name
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(0) << rate << " conn/s"
+			<< std::setw(8) << std::setprecision(1) << rate / reference << "x" << std::endl;
+	}
+
+	static void run_bench()
+	{
+		std::cout << "Benchmark of a connection storm over loopback" << std::endl << std::endl;
+		unsigned int nb_threads = std::max(2u, std::thread::hardware_concurrency());
+		const int nb_connections = 4000;
+		double single = connections_per_second(1, nb_threads, nb_threads * 2, nb_connections);
+		double sharded = connections_per_second(nb_threads, nb_threads, nb_threads * 2, nb_connections);
+		std::cout << nb_connections << " connections, " << nb_threads << " IO threads" << (ShardedAcceptor::supported() ? "" : ", no SO_REUSEPORT") << std::endl;
+		print_line("one acceptor", single, single);
+		print_line(std::to_string(nb_threads) + " acceptors", sharded, single);
+		std::cout << std::endl;
+	}
+}
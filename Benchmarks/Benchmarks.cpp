@@ -0,0 +1,30 @@
+#if _WIN32
+#include <stdio.h>
+#include <tchar.h>
+#endif
+#include "Accept_bench.h"
+#include "Codec_bench.h"
+#include "Network_bench.h"
+#include "Sync_bench.h"
+#include "Transport_bench.h"
+#include "Uring_bench.h"
+
+/*! \file Benchmarks.cpp
+\brief Entry point running every benchmark. Build it with "make bench", optimizations matter here.
+
+*/
+
+#if _WIN32
+int _tmain(int argc, _TCHAR* argv[])
+#else
+int main()
+#endif
+{
+	Codec_bench::run_bench();
+	Network_bench::run_bench();
+	Accept_bench::run_bench();
+	Uring_bench::run_bench();
+	Sync_bench::run_bench();
+	Transport_bench::run_bench();
+	return 0;
+}
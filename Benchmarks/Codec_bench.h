@@ -0,0 +1,82 @@
+#pragma once
+#include <chrono>
+#include <iomanip>
+#include <string>
+
+#include "Shape.h"
+#include "Drawings.h"
+
+/*! \file Codec_bench.h
+\brief Benchmark of the Image serialization formats : size of the text format, of the binary format with raw floats,
+of the binary format with the polygon geometry codec and of the indexed format, then decoding throughput of each.
+The last line only reads the index of the indexed format, as the lazy images of the server do for the stats.
+*/
+
+namespace Codec_bench
+{
+	using namespace Patchwork;
+	typedef std::chrono::high_resolution_clock Clock;
+
+	/*!
+	Decode serial into an image `rounds` times and return the average time in seconds.
+	If lazy is true, only the summaries of the components are read, as the server stats do.
+	*/
+	static double time_decode(const std::string& serial, int rounds, bool lazy = false)
+	{
+		auto start = Clock::now();
+		for (int i = 0; i < rounds; ++i)
+		{
+			Image im;
+			im.lazy(lazy);
+			im.deserialize(serial);
+			if (lazy)
+			{
+				im.component_infos();
+				continue;
+			}
+			for (auto component : im.components())
+				delete component;
+		}
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		return elapsed.count() / rounds;
+	}
+
+	static void print_line(const std::string& name, std::size_t bytes, std::size_t reference, double seconds, std::size_t vertices)
+	{
+		std::cout << std::left << std::setw(22) << name
+			<< std::right << std::setw(12) << bytes << " bytes"
+			<< std::setw(8) << std::fixed << std::setprecision(2) << (double)reference / bytes << "x"
+			<< std::setw(10) << std::setprecision(1) << (bytes / seconds) / (1024 * 1024) << " MB/s"
+			<< std::setw(10) << std::setprecision(1) << (vertices / seconds) / 1e6 << " Mvertices/s" << std::endl;
+	}
+
+	static void run_bench()
+	{
+		std::cout << "Benchmark of the Image formats" << std::endl << std::endl;
+		for (int nb_shapes : { 100, 400 })
+		{
+			Image img;
+			Drawings::make_drawing(img, nb_shapes);
+			std::size_t vertices = Drawings::count_vertices(img);
+
+			std::string text, raw, packed, indexed;
+			img.serialize(text);
+			img.serialize_binary(raw);
+			GeometryCodec codec;
+			img.serialize_binary(packed, &codec);
+			img.serialize_binary(indexed, &codec, true);
+
+			int rounds = 10;
+			std::cout << nb_shapes << " shapes, " << vertices << " vertices" << std::endl;
+			print_line("text", text.size(), text.size(), time_decode(text, rounds), vertices);
+			print_line("binary", raw.size(), text.size(), time_decode(raw, rounds), vertices);
+			print_line("binary + codec", packed.size(), text.size(), time_decode(packed, rounds), vertices);
+			print_line("indexed", indexed.size(), text.size(), time_decode(indexed, rounds), vertices);
+			print_line("indexed, index only", indexed.size(), text.size(), time_decode(indexed, rounds, true), vertices);
+			std::cout << std::endl;
+
+			for (auto component : img.components())
+				delete component;
+		}
+	}
+}
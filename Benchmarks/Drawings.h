@@ -0,0 +1,100 @@
+#pragma once
+#include <random>
+#include <vector>
+
+#include "Shape.h"
+
+/*! \file Drawings.h
+\brief Generators of realistic drawings used by the benchmarks.
+
+A drawing mixes freehand strokes (long polygons whose consecutive vertices are a few pixels apart),
+regular polygons approximating round shapes, rectangles, and a few circles, ellipses and lines.
+*/
+
+namespace Drawings
+{
+	using namespace Patchwork;
+	/*!
+	Fill img with nb_shapes shapes. The generator is seeded so every run produces the same drawing.
+	*/
+	static void make_drawing(Image& img, int nb_shapes, unsigned int seed = 42)
+	{
+		std::mt19937 gen(seed);
+		std::uniform_real_distribution<float> pos(-400.f, 400.f);
+		std::uniform_real_distribution<float> step(-4.f, 4.f);
+		std::uniform_real_distribution<float> size(5.f, 80.f);
+		std::uniform_int_distribution<int> channel(0, 255);
+		std::uniform_int_distribution<int> kind(0, 9);
+		std::uniform_int_distribution<int> stroke_length(50, 500);
+		for (int i = 0; i < nb_shapes; ++i)
+		{
+			Color color(channel(gen), channel(gen), channel(gen));
+			Vec2 origin(pos(gen), pos(gen));
+			switch (kind(gen))
+			{
+				case 0: case 1: case 2: case 3:
+				{
+					//Freehand stroke : a random walk with small steps
+					std::vector<Vec2> points;
+					Vec2 p = origin;
+					int n = stroke_length(gen);
+					for (int j = 0; j < n; ++j)
+					{
+						points.push_back(p);
+						p = p + Vec2(step(gen), step(gen));
+					}
+					img.add_component(new Polygon(points, color));
+				}break;
+
+				case 4: case 5:
+				{
+					//Round shape approximated by a regular polygon
+					std::vector<Vec2> points;
+					float radius = size(gen);
+					for (int j = 0; j < 64; ++j)
+					{
+						float angle = (float)(2 * PI * j / 64);
+						points.push_back(origin + Vec2(radius * (float)fast_cos(angle), radius * (float)fast_sin(angle)));
+					}
+					img.add_component(new Polygon(points, color));
+				}break;
+
+				case 6:
+				{
+					float w = size(gen);
+					float h = size(gen);
+					img.add_component(new Polygon({ origin, origin + Vec2(w, 0), origin + Vec2(w, h), origin + Vec2(0, h) }, color));
+				}break;
+
+				case 7:
+				{
+					img.add_component(new Circle(origin, size(gen), color));
+				}break;
+
+				case 8:
+				{
+					img.add_component(new Ellipse(origin, Vec2(size(gen), size(gen)), color));
+				}break;
+
+				default:
+				{
+					img.add_component(new Line(origin, Vec2(size(gen), size(gen)), color));
+				}break;
+			}
+		}
+		img.annotate("Benchmark drawing");
+	}
+	/*!
+	Count the vertices of the polygons of img, used to report throughputs in vertices per second
+	*/
+	static std::size_t count_vertices(Image& img)
+	{
+		std::size_t n = 0;
+		for (auto component : img.components())
+		{
+			if (component->type() == Shape::POLYGON)
+				n += static_cast<Polygon*>(component)->points().size();
+		}
+		return n;
+	}
+}
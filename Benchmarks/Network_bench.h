@@ -0,0 +1,293 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteQueue.hpp"
+
+/*! \file Network_bench.h
+\brief Benchmarks of the connections over loopback, in messages per second.
+Receive path : one async_read for the header and one for the body of each frame, as the server used to, against the FrameReader
+handing out every frame of a read. A thread floods the connection with small frames written in big batches, so the receiver is the bottleneck.
+Send path : a burst of messages queued at once, written one async_write per message, as the server used to, against the WriteQueue batches.
+A thread drains the connection.
+Broadcast : one message queued on thousands of sessions, copied into each queue, as the server used to, against shared.
+*/
+
+namespace Network_bench
+{
+	using boost::asio::ip::tcp;
+	typedef std::chrono::high_resolution_clock Clock;
+
+	/*!
+	Connect to port and write nb_frames frames of body_size bytes
+	*/
+	static void send_frames(unsigned short port, int nb_frames, std::size_t body_size)
+	{
+		boost::asio::io_service io_service;
+		tcp::socket socket(io_service);
+		socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+		Message msg(Message::IMAGE, std::string(body_size, 'x'));
+		const int batch_frames = 256;
+		std::string batch;
+		for (int i = 0; i < batch_frames; ++i)
+			batch.append(msg.data(), msg.length());
+		for (int sent = 0; sent < nb_frames; sent += batch_frames)
+		{
+			int n = std::min(batch_frames, nb_frames - sent);
+			boost::asio::write(socket, boost::asio::buffer(batch.data(), n * msg.length()));
+		}
+	}
+
+	/*!
+	Receiver reading the header, then the body, of every frame
+	*/
+	class TwoReads
+	{
+	public:
+		TwoReads(tcp::socket& socket, int nb_frames) : socket_(socket), left_(nb_frames) {}
+		void start()
+		{
+			boost::asio::async_read(socket_, boost::asio::buffer(msg_.data(), Message::header_length),
+				[this](boost::system::error_code ec, std::size_t)
+				{
+					if (ec || !msg_.decode_header())
+						return;
+					boost::asio::async_read(socket_, boost::asio::buffer(msg_.body(), msg_.body_length()),
+						[this](boost::system::error_code ec, std::size_t)
+						{
+							if (!ec && --left_ > 0)
+								start();
+						});
+				});
+		}
+
+	private:
+		tcp::socket& socket_;
+		Message msg_;
+		int left_;
+	};
+
+	/*!
+	Receiver reading into a FrameReader, as the server and the client do
+	*/
+	class Buffered
+	{
+	public:
+		Buffered(tcp::socket& socket, int nb_frames) : socket_(socket), left_(nb_frames) {}
+		void start()
+		{
+			std::size_t space;
+			char* data = reader_.prepare(space);
+			socket_.async_read_some(boost::asio::buffer(data, space),
+				[this](boost::system::error_code ec, std::size_t length)
+				{
+					if (ec)
+						return;
+					reader_.commit(length);
+					Message::Type type;
+					const char* body;
+					std::size_t body_length;
+					while (reader_.next(type, body, body_length) == FrameReader::FRAME)
+						--left_;
+					if (left_ > 0)
+						start();
+				});
+		}
+
+	private:
+		tcp::socket& socket_;
+		FrameReader reader_;
+		int left_;
+	};
+
+	/*!
+	Receive nb_frames frames of body_size bytes with a Receiver and return the number of messages per second
+	*/
+	template <class Receiver>
+	static double messages_per_second(int nb_frames, std::size_t body_size)
+	{
+		boost::asio::io_service io_service;
+		tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		//Timed from the connection, as the sender fills the socket buffers before the receiver starts
+		auto start = Clock::now();
+		std::thread sender(send_frames, acceptor.local_endpoint().port(), nb_frames, body_size);
+		tcp::socket socket(io_service);
+		acceptor.accept(socket);
+		Receiver receiver(socket, nb_frames);
+		receiver.start();
+		io_service.run();
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		sender.join();
+		return nb_frames / elapsed.count();
+	}
+
+	/*!
+	Connect to port and read total bytes
+	*/
+	static void drain(unsigned short port, std::size_t total)
+	{
+		boost::asio::io_service io_service;
+		tcp::socket socket(io_service);
+		socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+		std::vector<char> buffer(64 * 1024);
+		for (std::size_t read = 0; read < total;)
+			read += socket.read_some(boost::asio::buffer(buffer));
+	}
+
+	/*!
+	Sender writing the front message, then the next one from the completion handler
+	*/
+	class OneByOne
+	{
+	public:
+		OneByOne(tcp::socket& socket) : socket_(socket) {}
+		void deliver(const Message& msg)
+		{
+			bool write_in_progress = !queue_.empty();
+			queue_.push_back(msg);
+			if (!write_in_progress)
+				do_write();
+		}
+
+	private:
+		void do_write()
+		{
+			boost::asio::async_write(socket_, boost::asio::buffer(queue_.front().data(), queue_.front().length()),
+				[this](boost::system::error_code ec, std::size_t)
+				{
+					queue_.pop_front();
+					if (!ec && !queue_.empty())
+						do_write();
+				});
+		}
+
+		tcp::socket& socket_;
+		std::deque<Message> queue_;
+	};
+
+	/*!
+	Sender writing through a WriteQueue, as the server and the client do.
+	Each message is copied as OneByOne does, so that only the batching is measured.
+	*/
+	class Batched
+	{
+	public:
+		Batched(tcp::socket& socket) : socket_(socket) {}
+		void deliver(const Message& msg)
+		{
+			if (queue_.push(Message(msg)))
+				do_write();
+		}
+
+	private:
+		void do_write()
+		{
+			boost::asio::async_write(socket_, queue_.next_batch(),
+				[this](boost::system::error_code ec, std::size_t)
+				{
+					queue_.pop_batch();
+					if (!ec && !queue_.empty())
+						do_write();
+				});
+		}
+
+		tcp::socket& socket_;
+		WriteQueue queue_;
+	};
+
+	/*!
+	Send a burst of nb_frames frames of body_size bytes with a Sender and return the number of messages per second
+	*/
+	template <class Sender>
+	static double sent_per_second(int nb_frames, std::size_t body_size)
+	{
+		boost::asio::io_service io_service;
+		tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		Message msg(Message::IMAGE, std::string(body_size, 'x'));
+		std::thread reader(drain, acceptor.local_endpoint().port(), nb_frames * msg.length());
+		tcp::socket socket(io_service);
+		acceptor.accept(socket);
+		auto start = Clock::now();
+		Sender sender(socket);
+		for (int i = 0; i < nb_frames; ++i)
+			sender.deliver(msg);
+		io_service.run();
+		reader.join();
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		return nb_frames / elapsed.count();
+	}
+
+	/*!
+	Queue one message of body_size bytes on nb_sessions write queues, copying it into each queue as the server used to,
+	or sharing it. Return the number of deliveries per second.
+	*/
+	static double deliveries_per_second(int nb_sessions, std::size_t body_size, bool shared)
+	{
+		std::vector<std::deque<Message>> copies(nb_sessions);
+		std::vector<WriteQueue> queues(nb_sessions);
+		auto start = Clock::now();
+		Message_ptr msg = std::make_shared<const Message>(Message::IMAGE, std::string(body_size, 'x'));
+		for (int i = 0; i < nb_sessions; ++i)
+		{
+			if (shared)
+				queues[i].push(msg);
+			else
+				copies[i].push_back(*msg);
+		}
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		return nb_sessions / elapsed.count();
+	}
+
+	static void print_line(const std::string& name, double rate, double reference)
+	{
+		std::cout << std::left << std::setw(22) << name
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(0) << rate << " msgs/s"
+			<< std::setw(8) << std::setprecision(1) << rate / reference << "x" << std::endl;
+	}
+
+	static void run_bench()
+	{
+		std::cout << "Benchmark of the receive path over loopback" << std::endl << std::endl;
+		const int nb_frames = 200000;
+		for (std::size_t body_size : { 16, 256 })
+		{
+			double two_reads = messages_per_second<TwoReads>(nb_frames, body_size);
+			double buffered = messages_per_second<Buffered>(nb_frames, body_size);
+			std::cout << nb_frames << " frames of " << body_size << " bytes" << std::endl;
+			print_line("header + body reads", two_reads, two_reads);
+			print_line("FrameReader", buffered, two_reads);
+			std::cout << std::endl;
+		}
+
+		std::cout << "Benchmark of the send path over loopback" << std::endl << std::endl;
+		for (std::size_t body_size : { 16, 256 })
+		{
+			double one_by_one = sent_per_second<OneByOne>(nb_frames, body_size);
+			double batched = sent_per_second<Batched>(nb_frames, body_size);
+			std::cout << nb_frames << " frames of " << body_size << " bytes" << std::endl;
+			print_line("one write per message", one_by_one, one_by_one);
+			print_line("WriteQueue", batched, one_by_one);
+			std::cout << std::endl;
+		}
+
+		std::cout << "Benchmark of a broadcast to the write queues" << std::endl << std::endl;
+		const int nb_sessions = 5000;
+		for (std::size_t body_size : { 512, 64 * 1024 })
+		{
+			double copied = deliveries_per_second(nb_sessions, body_size, false);
+			double shared = deliveries_per_second(nb_sessions, body_size, true);
+			std::cout << nb_sessions << " sessions, " << body_size << " bytes" << std::endl;
+			print_line("copy per session", copied, copied);
+			print_line("shared Message_ptr", shared, copied);
+			std::cout << std::endl;
+		}
+	}
+}
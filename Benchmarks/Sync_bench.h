@@ -0,0 +1,76 @@
+#pragma once
+#include <chrono>
+#include <iomanip>
+#include <string>
+
+#include "Shape.h"
+#include "Sync.h"
+#include "Drawings.h"
+
+/*! \file Sync_bench.h
+\brief Benchmark of the delta synchronization : bytes sent and time spent by the server to apply an edit of one shape
+of a large image, when the whole image is uploaded again against when only the delta is, and when the edit is sent as an operation.
+*/
+
+namespace Sync_bench
+{
+	using namespace Patchwork;
+	typedef std::chrono::high_resolution_clock Clock;
+
+	static void print_line(const std::string& name, std::size_t bytes, double seconds)
+	{
+		std::cout << std::left << std::setw(22) << name
+			<< std::right << std::setw(12) << bytes << " bytes"
+			<< std::setw(12) << std::fixed << std::setprecision(3) << seconds * 1e3 << " ms" << std::endl;
+	}
+
+	static void run_bench()
+	{
+		std::cout << "Benchmark of the delta synchronization" << std::endl << std::endl;
+		for (int nb_shapes : { 400, 4000 })
+		{
+			Image client;
+			Drawings::make_drawing(client, nb_shapes);
+			GeometryCodec codec;
+			SyncSender sender(&codec);
+			SyncReceiver receiver;
+			Image server;
+			std::string first;
+			uint64_t version;
+			sender.make_delta(client, first);
+			receiver.apply(server, first, version);
+
+			//One shape moved
+			client.components().at(nb_shapes / 2)->translate(Vec2(10, 10));
+
+			std::string whole;
+			client.serialize_binary(whole, &codec, true);
+			auto start = Clock::now();
+			Image uploaded;
+			uploaded.deserialize(whole);
+			std::chrono::duration<double> whole_time = Clock::now() - start;
+
+			auto delta_start = Clock::now();
+			std::string delta;
+			sender.make_delta(client, delta);
+			std::chrono::duration<double> make_time = Clock::now() - delta_start;
+			start = Clock::now();
+			receiver.apply(server, delta, version);
+			std::chrono::duration<double> apply_time = Clock::now() - start;
+
+			//The same edit as an operation
+			std::string operation;
+			sender.make_operation(client, Operation(client.components().at(nb_shapes / 2)->id(), Shape::TRANSLATE, 10.f, 10.f), operation);
+			start = Clock::now();
+			receiver.apply_operation(server, operation, version);
+			std::chrono::duration<double> operation_time = Clock::now() - start;
+
+			std::cout << nb_shapes << " shapes, one moved" << std::endl;
+			print_line("whole image, parse", whole.size(), whole_time.count());
+			print_line("delta, apply", delta.size(), apply_time.count());
+			print_line("delta, make (client)", delta.size(), make_time.count());
+			print_line("operation, apply", operation.size(), operation_time.count());
+			std::cout << std::endl;
+		}
+	}
+}
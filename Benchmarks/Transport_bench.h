@@ -0,0 +1,138 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "Transport.hpp"
+
+/*! \file Transport_bench.h
+\brief Benchmark of the transports of a client on the machine of the server, in megabytes per second.
+A thread sends big image frames as fast as it can, the receiver reads them with a FrameReader and copies every body, as the server does :
+over TCP loopback, over a Unix-domain socket, and over a Unix-domain socket with the bodies in the shared memory ring (see Transport.hpp).
+*/
+
+namespace Transport_bench
+{
+	using boost::asio::ip::tcp;
+	typedef std::chrono::high_resolution_clock Clock;
+
+	/*!
+	Connect to endpoint and send nb_frames bodies of body_size bytes, through ring if not null
+	*/
+	template <class Protocol>
+	static void send_frames(typename Protocol::endpoint endpoint, int nb_frames, std::size_t body_size, SharedRing* ring)
+	{
+		boost::asio::io_service io_service;
+		typename Protocol::socket socket(io_service);
+		socket.connect(endpoint);
+		std::string body(body_size, 'x');
+		Message msg(Message::IMAGE, body);
+		for (int i = 0; i < nb_frames; ++i)
+		{
+			if (!ring)
+			{
+				boost::asio::write(socket, boost::asio::buffer(msg.data(), msg.length()));
+				continue;
+			}
+			uint64_t position;
+			//The receiver releases the bodies as it handles them
+			while (!ring->write(body.data(), body.size(), position))
+				std::this_thread::yield();
+			Message reference(Message::RING, SharedRing::reference(Message::IMAGE, position, body.size()));
+			boost::asio::write(socket, boost::asio::buffer(reference.data(), reference.length()));
+		}
+	}
+
+	/*!
+	Receive nb_frames bodies of body_size bytes at endpoint and return the megabytes per second.
+	If writer is not null the bodies go through its ring, mapped by reader as the server does.
+	*/
+	template <class Protocol>
+	static double megabytes_per_second(typename Protocol::endpoint endpoint, int nb_frames, std::size_t body_size,
+		SharedRing* writer = nullptr, SharedRing* reader = nullptr)
+	{
+		boost::asio::io_service io_service;
+		typename Protocol::acceptor acceptor(io_service, endpoint);
+		auto start = Clock::now();
+		std::thread sender(send_frames<Protocol>, acceptor.local_endpoint(), nb_frames, body_size, writer);
+		typename Protocol::socket socket(io_service);
+		acceptor.accept(socket);
+		FrameReader frames;
+		std::string copy;
+		int left = nb_frames;
+		while (left > 0)
+		{
+			std::size_t space;
+			char* data = frames.prepare(space);
+			frames.commit(socket.read_some(boost::asio::buffer(data, space)));
+			Message::Type type;
+			const char* body;
+			std::size_t body_length;
+			while (frames.next(type, body, body_length) == FrameReader::FRAME)
+			{
+				uint64_t position, size;
+				if (type == Message::RING && SharedRing::dereference(body, body_length, type, position, size))
+				{
+					copy.assign(reader->read(position, size), (std::size_t)size);
+					reader->release(position + size);
+				}
+				else
+				{
+					copy.assign(body, body_length);
+				}
+				--left;
+			}
+		}
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		sender.join();
+		return (double)nb_frames * body_size / (1024 * 1024) / elapsed.count();
+	}
+
+	static void print_line(const std::string& name, double rate, double reference)
+	{
+		std::cout << std::left << std::setw(22) << name
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(0) << rate << " MB/s"
+			<< std::setw(8) << std::setprecision(1) << rate / reference << "x" << std::endl;
+	}
+
+	static void run_bench()
+	{
+		std::cout << "Benchmark of the transports of a co-located client" << std::endl << std::endl;
+		const std::size_t total = 1024 * 1024 * 1024;
+		for (std::size_t body_size : { 64 * 1024, 1024 * 1024 })
+		{
+			int nb_frames = (int)(total / body_size);
+			double loopback = megabytes_per_second<tcp>(tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), nb_frames, body_size);
+			std::cout << nb_frames << " frames of " << body_size / 1024 << " KB" << std::endl;
+			print_line("TCP loopback", loopback, loopback);
+#ifdef PATCHWORK_HAS_LOCAL_TRANSPORT
+			typedef boost::asio::local::stream_protocol local;
+			const std::string path = "transport_bench.sock";
+			std::remove(path.c_str());
+			double unix_socket = megabytes_per_second<local>(local::endpoint(path), nb_frames, body_size);
+			print_line("Unix-domain socket", unix_socket, loopback);
+			std::remove(path.c_str());
+			std::unique_ptr<SharedRing> writer = SharedRing::create("/patchwork-transport-bench");
+			std::unique_ptr<SharedRing> reader = writer ? SharedRing::attach(writer->name()) : nullptr;
+			if (reader)
+			{
+				double ring = megabytes_per_second<local>(local::endpoint(path), nb_frames, body_size, writer.get(), reader.get());
+				print_line("shared memory ring", ring, loopback);
+				std::remove(path.c_str());
+			}
+			else
+			{
+				std::cout << "Shared memory is not available" << std::endl;
+			}
+#endif
+			std::cout << std::endl;
+		}
+	}
+}
@@ -0,0 +1,255 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteQueue.hpp"
+#include "Uring.hpp"
+
+/*! \file Uring_bench.h
+\brief Benchmark of the server transports over loopback, in round trips per second.
+Thousands of connections each send a small frame and wait for it to come back, so the server always has many sockets ready at once :
+the boost::asio sessions (epoll, one read and one write system call per socket) against the UringServer (one io_uring_enter per loop).
+Both servers run on one thread and echo with the same FrameReader and WriteQueue, the clients are the same asio loop.
+*/
+
+namespace Uring_bench
+{
+	using boost::asio::ip::tcp;
+	typedef std::chrono::high_resolution_clock Clock;
+
+	/*!
+	Echo session served by boost::asio, as the server sessions
+	*/
+	class AsioEcho : public std::enable_shared_from_this<AsioEcho>
+	{
+	public:
+		AsioEcho(tcp::socket socket) : socket_(std::move(socket)) {}
+		void start()
+		{
+			std::size_t space;
+			char* data = reader_.prepare(space);
+			auto self(shared_from_this());
+			socket_.async_read_some(boost::asio::buffer(data, space),
+				[this, self](boost::system::error_code ec, std::size_t length)
+				{
+					if (ec)
+						return;
+					reader_.commit(length);
+					Message::Type type;
+					const char* body;
+					std::size_t body_length;
+					while (reader_.next(type, body, body_length) == FrameReader::FRAME)
+					{
+						if (writes_.push(std::make_shared<const Message>(type, std::string(body, body_length))))
+							write();
+					}
+					start();
+				});
+		}
+
+	private:
+		void write()
+		{
+			auto self(shared_from_this());
+			boost::asio::async_write(socket_, writes_.next_batch(),
+				[this, self](boost::system::error_code ec, std::size_t)
+				{
+					if (ec)
+						return;
+					writes_.pop_batch();
+					if (!writes_.empty())
+						write();
+				});
+		}
+
+		tcp::socket socket_;
+		FrameReader reader_;
+		WriteQueue writes_;
+	};
+
+	/*!
+	Echo server served by boost::asio on the calling thread
+	*/
+	class AsioServer
+	{
+	public:
+		AsioServer() : acceptor_(io_service_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), socket_(io_service_)
+		{
+			accept();
+		}
+		unsigned short port() const
+		{
+			return acceptor_.local_endpoint().port();
+		}
+		void run()
+		{
+			io_service_.run();
+		}
+		void stop()
+		{
+			io_service_.stop();
+		}
+
+	private:
+		void accept()
+		{
+			acceptor_.async_accept(socket_,
+				[this](boost::system::error_code ec)
+				{
+					if (!ec)
+						std::make_shared<AsioEcho>(std::move(socket_))->start();
+					accept();
+				});
+		}
+
+		boost::asio::io_service io_service_;
+		tcp::acceptor acceptor_;
+		tcp::socket socket_;
+	};
+
+	/*!
+	Client sending a frame and waiting for it nb_round_trips times
+	*/
+	class Pinger
+	{
+	public:
+		Pinger(boost::asio::io_service& io_service, const Message_ptr& ping, int nb_round_trips, std::atomic<int>& done)
+			: socket_(io_service), ping_(ping), left_(nb_round_trips), done_(done), reply_(ping->length())
+		{
+		}
+		tcp::socket& socket()
+		{
+			return socket_;
+		}
+		void start()
+		{
+			boost::asio::async_write(socket_, boost::asio::buffer(ping_->data(), ping_->length()),
+				[this](boost::system::error_code ec, std::size_t)
+				{
+					if (ec)
+						return;
+					boost::asio::async_read(socket_, boost::asio::buffer(reply_),
+						[this](boost::system::error_code ec, std::size_t)
+						{
+							if (ec)
+								return;
+							if (--left_ == 0)
+								done_++;
+							else
+								start();
+						});
+				});
+		}
+
+	private:
+		tcp::socket socket_;
+		Message_ptr ping_;
+		int left_;
+		std::atomic<int>& done_;
+		std::vector<char> reply_;
+	};
+
+	/*!
+	Round trips per second of nb_connections connections to port, nb_round_trips each
+	*/
+	static double round_trips_per_second(unsigned short port, int nb_connections, int nb_round_trips)
+	{
+		boost::asio::io_service io_service;
+		Message_ptr ping = std::make_shared<const Message>(Message::SYNC, std::string(32, 'p'));
+		std::atomic<int> done(0);
+		std::vector< std::unique_ptr<Pinger> > pingers;
+		for (int i = 0; i < nb_connections; ++i)
+		{
+			pingers.push_back(std::unique_ptr<Pinger>(new Pinger(io_service, ping, nb_round_trips, done)));
+			pingers.back()->socket().connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+		}
+		auto start = Clock::now();
+		for (auto& pinger : pingers)
+			pinger->start();
+		io_service.run();
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		return done == nb_connections ? (double)nb_connections * nb_round_trips / elapsed.count() : 0;
+	}
+
+#ifdef PATCHWORK_HAS_IO_URING
+	/*!
+	Echo of the UringServer frames
+	*/
+	class UringEcho : public UringServer::Handler
+	{
+	public:
+		void server(UringServer* server)
+		{
+			server_ = server;
+		}
+		QueueStats* on_connect(uint64_t)
+		{
+			return nullptr;
+		}
+		void on_frame(uint64_t connection, Message::Type type, const char* body, std::size_t length)
+		{
+			server_->deliver(connection, std::make_shared<const Message>(type, std::string(body, length)));
+		}
+		void on_close(uint64_t)
+		{
+		}
+
+	private:
+		UringServer* server_;
+	};
+#endif
+
+	static void print_line(const std::string& name, double rate, double reference)
+	{
+		std::cout << std::left << std::setw(22) << name
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(0) << rate << " round trips/s"
+			<< std::setw(8) << std::setprecision(1) << rate / reference << "x" << std::endl;
+	}
+
+	static void run_bench()
+	{
+		std::cout << "Benchmark of the server transports over loopback" << std::endl << std::endl;
+		for (int nb_connections : { 100, 2000 })
+		{
+			const int nb_round_trips = 200000 / nb_connections;
+
+			AsioServer asio_server;
+			std::thread asio_thread([&]() { asio_server.run(); });
+			double asio = round_trips_per_second(asio_server.port(), nb_connections, nb_round_trips);
+			asio_server.stop();
+			asio_thread.join();
+
+			std::cout << nb_connections << " connections, " << nb_round_trips << " round trips each" << std::endl;
+			print_line("boost::asio (epoll)", asio, asio);
+#ifdef PATCHWORK_HAS_IO_URING
+			UringEcho echo;
+			UringServer uring_server(0, echo, Message::default_max_body_length, 2 * nb_connections + 64);
+			echo.server(&uring_server);
+			if (uring_server.ok())
+			{
+				std::thread uring_thread([&]() { uring_server.run(); });
+				double uring = round_trips_per_second(uring_server.port(), nb_connections, nb_round_trips);
+				uring_server.stop();
+				uring_thread.join();
+				print_line("io_uring", uring, asio);
+			}
+			else
+			{
+				std::cout << "io_uring is not available" << std::endl;
+			}
+#else
+			std::cout << "io_uring is not available" << std::endl;
+#endif
+			std::cout << std::endl;
+		}
+	}
+}
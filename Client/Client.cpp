@@ -8,23 +8,34 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <atomic>
 #include <cstdlib>
 #include <deque>
+#include <functional>
 #include <iostream>
+#include <random>
 #include <thread>
+#include <vector>
 #include <boost/asio.hpp>
 #include <stdio.h>
 #if _WIN32
 #include <tchar.h>
 #endif
 #include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteQueue.hpp"
+#include "HandlerMemory.hpp"
+#include "Compression.hpp"
+#include "Handshake.hpp"
+#include "Coalescer.hpp"
+#include "Requests.hpp"
+#include "Transport.hpp"
 #include "Shape.h"
+#include "Sync.h"
 
 using boost::asio::ip::tcp;
 using namespace Patchwork;
 
-typedef std::deque<Message> Message_queue;
-
 /*! \file Client.cpp
 \brief File containing the client part of the application
 
@@ -36,131 +47,361 @@ Class that handle the input and output of the client (basically reading and writ
 class ClientIO
 {
 public:
+  enum { default_push_window = 200 }; /*!< Milliseconds during which the changes are coalesced before being pushed */
+  enum { reconnect_delay = 500 }; /*!< Milliseconds before connecting again once the connection is lost */
+
 	/*!
 	Class that handle the input and output of the client (basically reading and writing to the socket).
 	This class is based an asynchronous IO pattern (c.f boost::asio).
 	\param io_service The boost::asio io_service providing event polling on the socket
-	\param endpoint_iterator The boost::asio TCP iterator
+	\param endpoint The server, reached through TCP or a Unix-domain socket (see Transport.hpp)
 	\param img Reference to the image currently owned by the Client (so we can send it)
+	\param max_frame Biggest frame body accepted from the server
+	\param push_window Longest delay between a change and its push to the server, zero to only send when asked
+	\param room Room to join on the server, empty for the default room
+	The connection is made again when lost, to the same server then to the failover ones in turn.
 	*/
   ClientIO(boost::asio::io_service& io_service,
-      tcp::resolver::iterator endpoint_iterator,
-	  Image& img)
+      const Endpoint& endpoint,
+	  Image& img,
+	  std::size_t max_frame = Message::default_max_body_length,
+	  std::chrono::milliseconds push_window = std::chrono::milliseconds(default_push_window),
+	  const std::string& room = std::string())
     : io_service_(io_service),
       socket_(io_service),
-	  img(img)
+	  reader_(max_frame),
+	  img(img),
+	  compression_(&compression_stats_),
+	  sync_(&codec_),
+	  subscribed_(push_window.count() > 0),
+	  push_(io_service, push_window, [this]() { sync(); }),
+	  room_(room),
+	  reconnect_(io_service),
+	  server_(0),
+	  ring_enabled_(false)
   {
+	  //The identity lets a server give back the image uploaded before, when the client reconnects to it or to its standby
+	  std::random_device random;
+	  identity_ = std::to_string((uint64_t)random() << 32 | random());
+	  closing_ = false;
+	  failover(endpoint);
 	  //Check for connection
-    do_connect(endpoint_iterator);
+    do_connect();
+  }
+  /*!
+  Add a server to connect to when the others are lost, before the IO thread runs
+  */
+  void failover(const Endpoint& endpoint)
+  {
+	  Target target;
+	  target.shm = endpoint.scheme == Endpoint::SHM;
+	  if (!endpoint.local())
+	  {
+		  tcp::resolver resolver(io_service_);
+		  for (auto it = resolver.resolve(tcp::resolver::query(endpoint.host, endpoint.port)); it != tcp::resolver::iterator(); ++it)
+			  target.endpoints.push_back(it->endpoint());
+	  }
+	  else
+	  {
+#ifdef PATCHWORK_HAS_LOCAL_TRANSPORT
+		  target.endpoints.push_back(boost::asio::local::stream_protocol::endpoint(endpoint.path));
+#else
+		  std::cout << "Unix-domain sockets are not available, " << endpoint.path << " cannot be reached" << std::endl;
+#endif
+	  }
+	  servers_.push_back(target);
   }
   /*!
   Tells the socket that we want to write a message
-  \param msg the message to send
+  \param msg the message to send, shared and not copied
   */
-  void write(const Message& msg)
+  void write(const Message_ptr& msg)
   {
     io_service_.post(
         [this, msg]()
         {
-          bool write_in_progress = !write_msgs_.empty();
-          write_msgs_.push_back(msg);
-          if (!write_in_progress)
+          if (write_msgs_.push(msg))
           {
             do_write();
           }
         });
   }
   /*!
+  Compress the payload if the server agreed to, then write it.
+  A big payload goes through the shared memory ring when the server maps it, the frame only tells where it is.
+  \param type the type of the message
+  \param payload the message body to send
+  */
+  void send(Message::Type type, std::string payload)
+  {
+	  compression_.pack(payload);
+	  if (payload.size() < SharedRing::min_payload)
+	  {
+		  write(std::make_shared<const Message>(type, payload));
+		  return;
+	  }
+	  //The ring is only used from the IO thread, which writes the bodies there in the order of their frames
+	  auto body = std::make_shared<std::string>(std::move(payload));
+	  io_service_.post(
+		  [this, type, body]()
+		  {
+			  uint64_t position;
+			  Message_ptr msg;
+			  if (ring_enabled_ && ring_->write(body->data(), body->size(), position))
+				  msg = std::make_shared<const Message>(Message::RING, SharedRing::reference(type, position, body->size()));
+			  else
+				  msg = std::make_shared<const Message>(type, *body);
+			  if (write_msgs_.push(msg))
+			  {
+				  do_write();
+			  }
+		  });
+  }
+  /*!
+  Send the changes of the image since the last sync, if any.
+  Called from the console and from the IO thread, the lock keeps the deltas in order.
+  */
+  void sync()
+  {
+	  std::lock_guard<std::mutex> guard(sync_mutex_);
+	  std::string delta;
+	  if (sync_.make_delta(img, delta))
+		  send(Message::SYNC, delta);
+  }
+  /*!
+  Apply a change of the console to the image.
+  The lock keeps it from interleaving with a delta being made on the IO thread, the caller then tells it was changed.
+  */
+  void edit(const std::function<void(Image&)>& change)
+  {
+	  std::lock_guard<std::mutex> guard(sync_mutex_);
+	  change(img);
+  }
+  /*!
+  Tell that the image was changed.
+  If subscribed, the changes are pushed at most push_window later, and every change made meanwhile goes in the same delta.
+  */
+  void changed()
+  {
+	  if (subscribed_)
+		  push_.notify();
+  }
+  /*!
+  Apply a transformation to a shape of the image and send it as an operation.
+  If the shape has changes not sent yet, the transformation goes with the next sync instead.
+  */
+  void transform(const Operation& op)
+  {
+	  bool sent;
+	  {
+		  std::lock_guard<std::mutex> guard(sync_mutex_);
+		  std::string message;
+		  sent = sync_.make_operation(img, op, message);
+		  if (sent)
+			  send(Message::OPERATION, message);
+	  }
+	  if (!sent)
+		  changed();
+  }
+  /*!
+  Getter for the compression counters
+  */
+  const CompressionStats& compression_stats() const
+  {
+	  return compression_stats_;
+  }
+  /*!
   Tells the socket that we want to close the connection
   */
   void close()
   {
-    io_service_.post([this]() { socket_.close(); });
+    closing_ = true;
+    push_.cancel();
+    io_service_.post([this]() { reconnect_.cancel(); socket_.close(); });
   }
 
 private:
 	/*!
 	Resolve the external connection to the socket
-	When a connection is find, the handler will start reading the message
+	When a connection is find, the handler will offer the compression to the server and start reading the message.
+	What was queued or received for the previous connection is dropped, the handshake tells what the server still has.
+	Through shm://, the handshake also offers the shared memory ring, emptied.
 	*/
-  void do_connect(tcp::resolver::iterator endpoint_iterator)
+  void do_connect()
   {
-    boost::asio::async_connect(socket_, endpoint_iterator,
-        [this](boost::system::error_code ec, tcp::resolver::iterator)
+    const std::vector<Target::Address>& endpoints = servers_[server_].endpoints;
+    boost::asio::async_connect(socket_, endpoints.begin(), endpoints.end(),
+        [this](boost::system::error_code ec, std::vector<Target::Address>::const_iterator)
         {
           if (!ec)
           {
-            do_read_header();
+            reader_.clear();
+            write_msgs_.clear();
+            compression_.negotiate(std::string(), false);
+            Handshake offer;
+            offer.push = subscribed_;
+            offer.room = room_;
+            offer.identity = identity_;
+            std::string hello = offer.encode() + PayloadCompression::handshake(true);
+            compression_.flag(hello);
+            ring_enabled_ = false;
+            if (servers_[server_].shm && !ring_)
+              ring_ = SharedRing::create("/patchwork-" + identity_);
+            if (servers_[server_].shm && ring_)
+            {
+              ring_->reset();
+              hello += SharedRing::handshake(ring_->name());
+            }
+            write(std::make_shared<const Message>(Message::HELLO, hello));
+            do_read();
+          }
+          else
+          {
+            reconnect(true);
           }
         });
+  }
+	/*!
+	Connect again after reconnect_delay, to the next server if next is true
+	*/
+  void reconnect(bool next)
+  {
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    if (closing_)
+      return;
+    if (next)
+      server_ = (server_ + 1) % servers_.size();
+    reconnect_.expires_from_now(std::chrono::milliseconds(reconnect_delay));
+    reconnect_.async_wait([this](boost::system::error_code ec)
+        {
+          if (!ec && !closing_)
+            do_connect();
+        });
   }
   /*!
-  Read from the socket into a buffer and analyze our message header, then ask to read the message's body
+  Read whatever the socket has into the receive buffer, handle every complete frame it holds, then read again (due to asynchronous design)
   */
-  void do_read_header()
+  void do_read()
   {
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.data(), Message::header_length),
-        [this](boost::system::error_code ec, std::size_t /*length*/)
+    std::size_t space;
+    char* data = reader_.prepare(space);
+    socket_.async_read_some(boost::asio::buffer(data, space),
+        make_memory_handler(read_memory_, [this](boost::system::error_code ec, std::size_t length)
         {
-          if (!ec && read_msg_.decode_header())
+          if (!ec)
           {
-            do_read_body();
+            reader_.commit(length);
+            Message::Type type;
+            const char* body;
+            std::size_t body_length;
+            FrameReader::Status status;
+            while ((status = reader_.next(type, body, body_length)) == FrameReader::FRAME)
+            {
+              handle_frame(type, body, body_length);
+            }
+            if (status == FrameReader::BAD_FRAME)
+            {
+              reconnect(false);
+              return;
+            }
+            do_read();
           }
           else
           {
-            socket_.close();
+            reconnect(false);
           }
-        });
+        }));
   }
   /*!
-  Read from the socket into a buffer and analyze our message body, then start again to read from the socket is some reads are needed to be done (due to asynchronous design)
+  Analyze a message body : handshake, request of our image, or image sent back by the server.
+  A request of our image with an ID is answered with the version of the image sent, see Requests.hpp.
+  The body is copied in a buffer kept from one frame to the next.
   */
-  void do_read_body()
+  void handle_frame(Message::Type type, const char* data, std::size_t length)
   {
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.body(), read_msg_.body_length()),
-        [this](boost::system::error_code ec, std::size_t /*length*/)
-        {
-          if (!ec)
-          {
-			  if (std::string(read_msg_.body()) == "GET")
+	  std::string& body = frame_;
+	  body.assign(data, length);
+	  if (type == Message::HELLO)
+	  {
+		  compression_.negotiate(body, true);
+		  ring_enabled_ = ring_ && servers_[server_].shm && SharedRing::name_in(body) == ring_->name();
+		  //A server without our image at the version sent last gets it whole, one which resumed it only gets the next changes
+		  bool resend;
+		  {
+			  std::lock_guard<std::mutex> guard(sync_mutex_);
+			  resend = Handshake::parse(body).version != sync_.version();
+			  if (resend)
+				  sync_.reset();
+		  }
+		  if (resend)
+			  sync();
+	  }
+	  else if (type == Message::GET)
+	  {
+		  //Send the changes of the image, then tell which version they bring the server to
+		  sync();
+		  uint64_t id;
+		  std::string arguments;
+		  if (Requests::parse_request(body, id, arguments))
+		  {
+			  std::string version;
 			  {
-				  //Send image
-				  Message msg;
-				  std::string s;
-				  img.serialize(s);
-				  msg.body_length(s.length());
-				  std::memcpy(msg.body(), s.c_str(), msg.body_length());
-				  msg.encode_header();
-				  write(msg);
+				  std::lock_guard<std::mutex> guard(sync_mutex_);
+				  put_varint(version, sync_.version());
 			  }
-			  else
-			  {
-				  //Get image
-				  img.deserialize(std::string(read_msg_.body()));
-			  }
-            do_read_header();
-          }
-          else
-          {
-            socket_.close();
-          }
-        });
+			  write(std::make_shared<const Message>(Message::REPLY, Requests::reply(id, Requests::DONE, version)));
+		  }
+	  }
+	  else if (type == Message::SYNC_ACK)
+	  {
+		  ByteReader in(body);
+		  uint64_t version;
+		  uint8_t applied;
+		  if (!in.get_varint(version) || !in.get_u8(applied))
+		  {
+			  std::cout << "Bad format : sync acknowledgment" << std::endl;
+			  return;
+		  }
+		  bool resend;
+		  {
+			  std::lock_guard<std::mutex> guard(sync_mutex_);
+			  if (applied)
+				  sync_.acknowledge(version);
+			  resend = !applied && sync_.rejected(version);
+		  }
+		  //The server lost track of the image, send it whole
+		  if (resend)
+			  sync();
+	  }
+	  else if (type != Message::IMAGE)
+	  {
+		  std::cout << "Bad format : unexpected message" << std::endl;
+	  }
+	  else if (!compression_.unpack(body))
+	  {
+		  std::cout << "Bad format : compressed message" << std::endl;
+	  }
+	  else
+	  {
+		  //Get image, its components got new ids so the next sync sends it whole
+		  std::lock_guard<std::mutex> guard(sync_mutex_);
+		  img.deserialize(body);
+		  sync_.reset();
+	  }
   }
   /*!
-  Write to the socket, then ask to write again if some writes are needed to be done (due to asychronous design)
+  Write the queued messages to the socket in one batch, then ask to write again if some writes are needed to be done (due to asychronous design)
   */
   void do_write()
   {
     boost::asio::async_write(socket_,
-        boost::asio::buffer(write_msgs_.front().data(),
-          write_msgs_.front().length()),
-        [this](boost::system::error_code ec, std::size_t /*length*/)
+        write_msgs_.next_batch(),
+        make_memory_handler(write_memory_, [this](boost::system::error_code ec, std::size_t /*length*/)
         {
           if (!ec)
           {
-            write_msgs_.pop_front();
+            write_msgs_.pop_batch();
             if (!write_msgs_.empty())
             {
               do_write();
@@ -170,15 +411,43 @@ private:
           {
             socket_.close();
           }
-        });
+        }));
   }
 
 private:
+  /*!
+  Server to connect to
+  */
+  struct Target
+  {
+	  typedef boost::asio::generic::stream_protocol::endpoint Address;
+	  std::vector<Address> endpoints; /*!< Addresses of the server, tried in turn */
+	  bool shm; /*!< True if the big payloads go through the shared memory ring */
+  };
+
   boost::asio::io_service& io_service_; /*!< boost::asio IO service */
-  tcp::socket socket_; /*!< boost::asio TCP Socket */
-  Message read_msg_; /*!< Message read from the socket */
-  Message_queue write_msgs_; /*!< Queue of messages to be sent */
+  boost::asio::generic::stream_protocol::socket socket_; /*!< boost::asio socket, TCP or Unix-domain */
+  FrameReader reader_; /*!< Receive buffer, holding the frames being read */
+  WriteQueue write_msgs_; /*!< Queue of messages to be sent */
+  HandlerMemory read_memory_; /*!< Recycled for every read of the socket */
+  HandlerMemory write_memory_; /*!< Recycled for every write to the socket */
+  std::string frame_; /*!< Body of the frame being handled */
   Image& img; /*!< REference to the image currently owned by the Client */
+  CompressionStats compression_stats_; /*!< Compression counters of the connection */
+  PayloadCompression compression_; /*!< Compression negotiated with the server */
+  GeometryCodec codec_; /*!< Codec of the polygons sent */
+  std::mutex sync_mutex_; /*!< Protects sync_ */
+  SyncSender sync_; /*!< State of the image as sent to the server */
+  bool subscribed_; /*!< True if the changes are pushed without waiting for the server to ask */
+  Coalescer push_; /*!< Coalesces the changes into one push per window */
+  std::string room_; /*!< Room joined on the server, empty for the default room */
+  std::string identity_; /*!< Identity of the client, the same for all its connections */
+  std::vector<Target> servers_; /*!< Servers to connect to, the first one then the failover ones */
+  boost::asio::steady_timer reconnect_; /*!< Delays the connection made again */
+  std::size_t server_; /*!< Server of servers_ connected to, or being connected to */
+  std::atomic<bool> closing_; /*!< True once closed, the connection is then not made again */
+  std::unique_ptr<SharedRing> ring_; /*!< Ring the big payloads are written in, created on the first connection through shm:// */
+  bool ring_enabled_; /*!< True once the server connected maps ring_, only used from the IO thread */
 };
 
 /*!
@@ -214,17 +483,21 @@ public :
 	}	
 	/*!
 	Class that creates the ClientIO and poll user input to execute commands
-	\param ip TCP Socket IP
-	\param port TCP Socket port
+	\param endpoint Server to connect to
 	\param service boost::asio io_service
+	\param room Room to join on the server, empty for the default room
+	\param failover Servers to connect to when the connection is lost, such as a standby
+	\param push_window Longest delay between a change and its push to the server, zero to only send when asked
 	*/
-	Client(std::string ip, std::string port, boost::asio::io_service& service) : io_service(service)
+	Client(const Endpoint& endpoint, boost::asio::io_service& service, const std::string& room = std::string(),
+		const std::vector<Endpoint>& failover = std::vector<Endpoint>(),
+		std::chrono::milliseconds push_window = std::chrono::milliseconds(ClientIO::default_push_window)) : io_service(service)
 	{
 		img = new Image();
 		//Initiliaze connection
-		resolver = new tcp::resolver(io_service);
-		auto endpoint_iterator = resolver->resolve({ "127.0.0.1", "8080" });
-		c = new ClientIO(io_service, endpoint_iterator, *img);
+		c = new ClientIO(io_service, endpoint, *img, Message::default_max_body_length, push_window, room);
+		for (auto& other : failover)
+			c->failover(other);
 		t = new std::thread([&](){ io_service.run(); });
 		SDL_Init(SDL_INIT_VIDEO);
 		start_polling();
@@ -233,7 +506,6 @@ public :
 	~Client()
 	{
 		delete img;
-		delete resolver;
 		delete c;
 		if (t->joinable())
 		    t->join();
@@ -325,7 +597,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Circle(Vec2(x, y), radius, Color(r, g, b)));
+								c->edit([&](Image& image) { image.add_component(new Circle(Vec2(x, y), radius, Color(r, g, b))); });
 								std::cout << "Circle created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -360,7 +632,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Patchwork::Ellipse(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b)));
+								c->edit([&](Image& image) { image.add_component(new Patchwork::Ellipse(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b))); });
 								std::cout << "Ellipse created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -395,7 +667,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Patchwork::Line(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b)));
+								c->edit([&](Image& image) { image.add_component(new Patchwork::Line(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b))); });
 								std::cout << "Line created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -435,7 +707,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Patchwork::Polygon(points, Color(r, g, b)));
+								c->edit([&](Image& image) { image.add_component(new Patchwork::Polygon(points, Color(r, g, b))); });
 								std::cout << "Polygon created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -450,18 +722,13 @@ private:
 							std::cout << "Unknown shape" << std::endl;
 						}break;
 					}
+					c->changed();
 				}break;
 
 				case Commands::SEND:
 				{
-					// Send the image to the server
-					Message msg;
-					std::string serial;
-					img->serialize(serial);
-					msg.body_length(serial.size());
-					std::memcpy(msg.body(), serial.c_str(), msg.body_length());
-					msg.encode_header();
-					c->write(msg);
+					// Send the changes of the image to the server
+					c->sync();
 				}break;
 
 				case Commands::TRANSFORM:
@@ -505,7 +772,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->components().at(id)->homothety(ratio);
+								c->transform(Operation(img->components().at(id)->id(), Shape::HOMOTHETY, ratio));
 							}
 							catch (std::exception& e)
 							{
@@ -531,7 +798,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->components().at(id)->axialSym(Vec2(x, y), Vec2(dir_x, dir_y));
+								c->transform(Operation(img->components().at(id)->id(), Shape::AXIAL_SYMETRY, x, y, dir_x, dir_y));
 							}
 							catch (std::exception& e)
 							{
@@ -553,7 +820,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->components().at(id)->centralSym(Vec2(x, y));
+								c->transform(Operation(img->components().at(id)->id(), Shape::CENTRAL_SYMETRY, x, y));
 							}
 							catch (std::exception& e)
 							{
@@ -573,7 +840,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->components().at(id)->rotate(DEGTORAD*angle);
+								c->transform(Operation(img->components().at(id)->id(), Shape::ROTATION, DEGTORAD*angle));
 							}
 							catch (std::exception& e)
 							{
@@ -595,7 +862,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->components().at(id)->translate(Vec2(x, y));
+								c->transform(Operation(img->components().at(id)->id(), Shape::TRANSLATE, x, y));
 							}
 							catch (std::exception& e)
 							{
@@ -631,9 +898,13 @@ private:
 							std::cin.clear();
 							throw std::domain_error("Bad input");
 						}
-						auto tmp = img->components().at( id ); // test to throw exception
-						auto it = img->components().begin() + id;
-						img->components().erase(it);
+						c->edit([&](Image& image)
+						{
+							auto tmp = image.components().at( id ); // test to throw exception
+							auto it = image.components().begin() + id;
+							image.components().erase(it);
+						});
+						c->changed();
 					}
 					catch (std::exception& e)
 					{
@@ -682,7 +953,6 @@ private:
 	SDL_Window *window; /*!< SDL window to display to */
 	SDL_Renderer *renderer; /*!< SDL renderer to draw components to */
 	boost::asio::io_service& io_service; /*!< boost::asio io_service */
-	tcp::resolver* resolver; /*!< boost::asio TCP resolver */
 	std::thread* t; /*!< Thread polling Input/Output event from io_service */
 	Image* img; /*!< Image being created by the client */
 };
@@ -691,12 +961,54 @@ const std::vector<std::string> Client::cmds = { "display", "make", "transform",
 #if _WIN32
 int _tmain(int argc, _TCHAR* argv[])
 #else
-int main()
+int main(int argc, char* argv[])
 #endif
 {
+  //The first argument names the room to join on the server, the second the server, any of a federation,
+  //the next ones the servers to fail over to. A server is a port on 127.0.0.1 or a URI : tcp://host:port,
+  //unix:///path for a server on this machine, shm:///path to also share a memory ring with it
+  //"--push-window MS", anywhere, coalesces the changes during MS milliseconds before pushing them, 0 to only send them when asked
+  std::string room;
+  Endpoint endpoint;
+  std::vector<Endpoint> failover;
+  std::chrono::milliseconds push_window(ClientIO::default_push_window);
+#if !_WIN32
+  int position = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if (arg == "--push-window" && i + 1 < argc)
+    {
+      char* end;
+      long value = std::strtol(argv[++i], &end, 10);
+      if (*end || end == argv[i] || value < 0)
+      {
+        std::cout << "Push window " << argv[i] << " : expected milliseconds" << std::endl;
+        return 1;
+      }
+      push_window = std::chrono::milliseconds(value);
+      continue;
+    }
+    if (position++ == 0)
+    {
+      room = arg;
+      continue;
+    }
+    Endpoint server;
+    if (!Endpoint::parse(argv[i], server))
+    {
+      std::cout << "Server " << argv[i] << " : expected a port, tcp://host:port, unix:///path or shm:///path" << std::endl;
+      return 1;
+    }
+    if (position == 2)
+      endpoint = server;
+    else
+      failover.push_back(server);
+  }
+#endif
   //Create io_service and start Client
   boost::asio::io_service io_service;
   //Client will be cleaned by app
-  Client c("127.0.0.1", "8080", io_service);
+  Client c(endpoint, io_service, room, failover, push_window);
   return 0;
 }
@@ -0,0 +1,95 @@
+//
+// Coalescer.hpp
+// ~~~~~~~~~~~~~
+//
+// Coalescing of bursts of notifications into one action.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+/*! \file Coalescer.hpp
+\brief Runs an action once per window of time, however many times it was requested during the window.
+
+The first notification arms a timer for the window, the following ones are folded into it, and the action runs when the timer fires.
+A burst of changes thus costs one action at most window after the first change, and the action never runs more than once per window.
+*/
+
+class Coalescer
+{
+public:
+  /*!
+  Create a coalescer running flush on io_service's threads, at most once per window
+  */
+  Coalescer(boost::asio::io_service& io_service, std::chrono::milliseconds window, std::function<void()> flush)
+    : io_service_(io_service),
+      timer_(io_service),
+      window_(window),
+      flush_(flush),
+      armed_(false),
+      notifications_(0),
+      flushes_(0)
+  {
+  }
+
+  /*!
+  Request the action, from any thread
+  */
+  void notify()
+  {
+    notifications_++;
+    io_service_.post([this]()
+        {
+          if (armed_)
+            return;
+          armed_ = true;
+          timer_.expires_from_now(window_);
+          timer_.async_wait([this](const boost::system::error_code& ec)
+              {
+                armed_ = false;
+                if (ec)
+                  return;
+                flushes_++;
+                flush_();
+              });
+        });
+  }
+
+  /*!
+  Stop the pending action, if any
+  */
+  void cancel()
+  {
+    io_service_.post([this]() { timer_.cancel(); });
+  }
+
+  /*!
+  Number of times the action was requested
+  */
+  uint64_t notifications() const
+  {
+    return notifications_;
+  }
+
+  /*!
+  Number of times the action ran
+  */
+  uint64_t flushes() const
+  {
+    return flushes_;
+  }
+
+private:
+  boost::asio::io_service& io_service_; /*!< IO service running the timer and the action */
+  boost::asio::steady_timer timer_; /*!< Timer of the window being coalesced */
+  std::chrono::milliseconds window_; /*!< Longest time between a request and the action */
+  std::function<void()> flush_; /*!< The action */
+  bool armed_; /*!< True while a window is open, only used from the IO threads */
+  std::atomic<uint64_t> notifications_; /*!< Number of requests */
+  std::atomic<uint64_t> flushes_; /*!< Number of actions */
+};
@@ -0,0 +1,315 @@
+//
+// Compression.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Payload compression negotiated per connection.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "Codec.h"
+
+/*! \file Compression.hpp
+\brief Fast LZ77 block codec and the per connection payload compression built on it.
+
+Both sides announce the codecs they support in a HELLO message right after the connection.
+Compression is only used once the peer has answered that it supports it too, and only for payloads above a size threshold.
+When the handshake of the client offers it, every payload starts with a flag byte, both ways and from the first one :
+0 for a raw payload, 1 for a compressed one, followed by the original size as a varint and the compressed block.
+The flag depends on the offer of the client only, so each side knows it before the first payload, whatever the answer of the server.
+A payload never needs to be guessed from its first byte, which a delta or an image may start with.
+*/
+
+namespace lz
+{
+	enum { min_match = 4, hash_log = 12, max_offset = 0xFFFF };
+
+	inline uint32_t read32(const uint8_t* p)
+	{
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	/*!
+	Write a length that did not fit in its 4 bits nibble : a run of 255 then the remainder
+	*/
+	inline void put_length(std::string& out, std::size_t len)
+	{
+		while (len >= 255)
+		{
+			out.push_back((char)255);
+			len -= 255;
+		}
+		out.push_back((char)len);
+	}
+	/*!
+	Append one sequence : a token (literal length, match length), the literals, then the match offset.
+	A match length of 0 means the sequence only holds the trailing literals.
+	*/
+	inline void put_sequence(std::string& out, const uint8_t* literals, std::size_t nb_literals, std::size_t offset, std::size_t match_length)
+	{
+		std::size_t lit_nibble = nb_literals < 15 ? nb_literals : 15;
+		std::size_t match_code = match_length ? match_length - min_match : 0;
+		std::size_t match_nibble = match_code < 15 ? match_code : 15;
+		out.push_back((char)((lit_nibble << 4) | match_nibble));
+		if (lit_nibble == 15)
+			put_length(out, nb_literals - 15);
+		out.append((const char*)literals, nb_literals);
+		if (!match_length)
+			return;
+		out.push_back((char)(offset & 0xFF));
+		out.push_back((char)((offset >> 8) & 0xFF));
+		if (match_nibble == 15)
+			put_length(out, match_code - 15);
+	}
+	/*!
+	Compress size bytes of src and append the block to out.
+	Greedy matching on a hash table of 4 bytes sequences, in the spirit of LZ4 : fast rather than tight.
+	*/
+	inline void compress(const char* src, std::size_t size, std::string& out)
+	{
+		const uint8_t* in = (const uint8_t*)src;
+		uint32_t table[1 << hash_log] = {}; //Positions + 1, 0 meaning empty
+		std::size_t anchor = 0;
+		std::size_t i = 0;
+		while (i + min_match <= size)
+		{
+			uint32_t seq = read32(in + i);
+			uint32_t h = (seq * 2654435761u) >> (32 - hash_log);
+			std::size_t candidate = table[h];
+			table[h] = (uint32_t)(i + 1);
+			if (candidate && i - (candidate - 1) <= max_offset && read32(in + candidate - 1) == seq)
+			{
+				std::size_t match = candidate - 1;
+				std::size_t len = min_match;
+				while (i + len < size && in[match + len] == in[i + len])
+					++len;
+				put_sequence(out, in + anchor, i - anchor, i - match, len);
+				i += len;
+				anchor = i;
+			}
+			else
+			{
+				//Skip faster through incompressible data
+				i += 1 + ((i - anchor) >> 6);
+			}
+		}
+		put_sequence(out, in + anchor, size - anchor, 0, 0);
+	}
+	/*!
+	Read a length extension written by put_length
+	*/
+	inline bool get_length(const uint8_t*& p, const uint8_t* end, std::size_t& len)
+	{
+		for (;;)
+		{
+			if (p == end)
+				return false;
+			uint8_t b = *p++;
+			len += b;
+			if (b != 255)
+				return true;
+		}
+	}
+	/*!
+	Decompress a block of size bytes into out, which must end up exactly expected_size bytes long.
+	Return false if the block is malformed : every length and offset is checked against the buffers.
+	*/
+	inline bool decompress(const char* src, std::size_t size, std::string& out, std::size_t expected_size)
+	{
+		const uint8_t* p = (const uint8_t*)src;
+		const uint8_t* end = p + size;
+		out.clear();
+		out.reserve(expected_size);
+		while (p < end)
+		{
+			uint8_t token = *p++;
+			std::size_t nb_literals = token >> 4;
+			if (nb_literals == 15 && !get_length(p, end, nb_literals))
+				return false;
+			if ((std::size_t)(end - p) < nb_literals || out.size() + nb_literals > expected_size)
+				return false;
+			out.append((const char*)p, nb_literals);
+			p += nb_literals;
+			if (p == end)
+				break;
+			if (end - p < 2)
+				return false;
+			std::size_t offset = p[0] | (p[1] << 8);
+			p += 2;
+			std::size_t len = (token & 0x0F);
+			if (len == 15 && !get_length(p, end, len))
+				return false;
+			len += min_match;
+			if (offset == 0 || offset > out.size() || out.size() + len > expected_size)
+				return false;
+			//Byte per byte as the match may overlap the bytes it produces
+			std::size_t from = out.size() - offset;
+			for (std::size_t k = 0; k < len; ++k)
+				out.push_back(out[from + k]);
+		}
+		return out.size() == expected_size;
+	}
+}
+
+/*!
+Counters of the compression, shared by every connection of a process and readable from any thread
+*/
+struct CompressionStats
+{
+	std::atomic<uint64_t> messages{ 0 }; /*!< Number of payloads sent compressed */
+	std::atomic<uint64_t> skipped{ 0 }; /*!< Number of payloads sent as is (below the threshold, or not worth it) */
+	std::atomic<uint64_t> raw_bytes{ 0 }; /*!< Size of the compressed payloads before compression */
+	std::atomic<uint64_t> compressed_bytes{ 0 }; /*!< Size of the compressed payloads on the wire */
+	std::atomic<uint64_t> compress_ns{ 0 }; /*!< CPU time spent compressing */
+	std::atomic<uint64_t> decompress_ns{ 0 }; /*!< CPU time spent decompressing */
+
+	void print(std::ostream& out) const
+	{
+		uint64_t raw = raw_bytes;
+		uint64_t packed = compressed_bytes;
+		out << "Compression : " << messages << " payloads compressed, " << skipped << " sent as is" << std::endl;
+		if (packed)
+			out << "Compression ratio : " << (double)raw / packed << " (" << raw << " -> " << packed << " bytes)" << std::endl;
+		out << "Compression CPU : " << compress_ns / 1e6 << " ms compressing, " << decompress_ns / 1e6 << " ms decompressing" << std::endl;
+	}
+};
+
+/*!
+Compression state of one connection.
+It is disabled until the handshake tells that the peer supports it, then compresses the payloads bigger than the threshold.
+The enabled flag may be read from the console thread while the IO thread sets it, hence the atomic.
+*/
+class PayloadCompression
+{
+public:
+	enum { raw = 0x00, marker = 0x01 }; /*!< Flag byte of a raw and of a compressed payload */
+	enum { default_threshold = 128 };
+	enum { default_max_size = 64 * 1024 * 1024 }; /*!< Biggest payload decompressed, as Message::default_max_body_length */
+
+	PayloadCompression(CompressionStats* stats = nullptr, std::size_t threshold = default_threshold)
+		: enabled_(false), flagged_(false), threshold_(threshold), max_size_(default_max_size), stats_(stats)
+	{
+	}
+	/*!
+	Part of the handshake offering the compression, empty if we do not offer it, see Handshake.hpp
+	*/
+	static std::string handshake(bool offer_lz)
+	{
+		return offer_lz ? " lz" : std::string();
+	}
+	/*!
+	Enable the compression if the handshake received from the peer offers it and we offer it too
+	*/
+	void negotiate(const std::string& handshake, bool offer_lz)
+	{
+		enabled_ = offer_lz && handshake.find(" lz") != std::string::npos;
+	}
+	/*!
+	Put the flag byte in front of the payloads, both ways, if the handshake of the client offers the compression.
+	The server calls it with the handshake received, the client with the one it sends.
+	*/
+	void flag(const std::string& client_handshake)
+	{
+		flagged_ = client_handshake.find(" lz") != std::string::npos;
+	}
+	bool enabled() const
+	{
+		return enabled_;
+	}
+	bool flagged() const
+	{
+		return flagged_;
+	}
+	void stats(CompressionStats* stats)
+	{
+		stats_ = stats;
+	}
+	/*!
+	Refuse the compressed payloads bigger than max_size once decompressed, the biggest frame accepted
+	*/
+	void limit(std::size_t max_size)
+	{
+		max_size_ = max_size;
+	}
+	/*!
+	Compress the payload in place if the compression is enabled, the payload is big enough, and the result is smaller.
+	The payload gets its flag byte if the payloads are flagged, compressed or not.
+	*/
+	void pack(std::string& payload)
+	{
+		if (!flagged_)
+			return;
+		if (!enabled_ || payload.size() < threshold_)
+		{
+			if (enabled_ && stats_)
+				stats_->skipped++;
+			payload.insert(payload.begin(), (char)raw);
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		std::string packed;
+		packed.push_back((char)marker);
+		Patchwork::put_varint(packed, payload.size());
+		lz::compress(payload.data(), payload.size(), packed);
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		if (stats_)
+			stats_->compress_ns += elapsed;
+		if (packed.size() > payload.size())
+		{
+			if (stats_)
+				stats_->skipped++;
+			payload.insert(payload.begin(), (char)raw);
+			return;
+		}
+		if (stats_)
+		{
+			stats_->messages++;
+			stats_->raw_bytes += payload.size();
+			stats_->compressed_bytes += packed.size();
+		}
+		payload.swap(packed);
+	}
+	/*!
+	Remove the flag byte of the body and decompress it in place if the payloads are flagged, leave it untouched otherwise.
+	Return false if the flag is missing or unknown, or the body is compressed but malformed or bigger than the limit once decompressed.
+	*/
+	bool unpack(std::string& body)
+	{
+		if (!flagged_)
+			return true;
+		if (body.empty() || ((uint8_t)body[0] != raw && (uint8_t)body[0] != marker))
+			return false;
+		if ((uint8_t)body[0] == raw)
+		{
+			body.erase(body.begin());
+			return true;
+		}
+		auto start = std::chrono::steady_clock::now();
+		Patchwork::ByteReader in(body.data() + 1, body.size() - 1);
+		uint64_t size;
+		std::string unpacked;
+		//A match adds at most 255 bytes per input byte, anything above is a lie about the size
+		if (!in.get_varint(size) || size > max_size_ || size > (uint64_t)in.remaining() * 255 + 15)
+			return false;
+		if (!lz::decompress(in.position(), in.remaining(), unpacked, (std::size_t)size))
+			return false;
+		body.swap(unpacked);
+		if (stats_)
+			stats_->decompress_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+
+private:
+	std::atomic<bool> enabled_; /*!< True once the handshake agreed on compression */
+	std::atomic<bool> flagged_; /*!< True if the handshake of the client offers compression, the payloads then start with the flag byte */
+	std::size_t threshold_; /*!< Payloads smaller than this are sent as is */
+	std::size_t max_size_; /*!< Biggest payload once decompressed */
+	CompressionStats* stats_; /*!< Where to account the compression, may be null */
+};
@@ -0,0 +1,121 @@
+//
+// FrameReader.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Receive buffer extracting every complete frame of a read.
+//
+
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include "Message.hpp"
+
+/*! \file FrameReader.hpp
+\brief Receive buffer of a connection, so that one read of the socket delivers as many frames as it holds.
+
+The socket reads as much as available into the free space of the buffer, then every complete frame is handed out in place.
+Consumed bytes are reclaimed by moving the partial frame left at the end back to the front, so the buffer behaves as a ring
+whose frames are always contiguous. It only grows for a frame bigger than itself, up to the maximum frame size.
+*/
+
+class FrameReader
+{
+public:
+  enum { default_capacity = 64 * 1024 };
+  enum Status { FRAME, NEED_MORE, BAD_FRAME };
+
+  FrameReader(std::size_t max_body_length = Message::default_max_body_length,
+      std::size_t capacity = default_capacity)
+    : buffer_(capacity),
+      capacity_(capacity),
+      head_(0),
+      tail_(0),
+      max_body_length_(max_body_length)
+  {
+  }
+
+  /*!
+  Free space to read into, big enough for the rest of the frame being received. Frames handed out before are no longer valid.
+  */
+  char* prepare(std::size_t& space)
+  {
+    std::size_t min_space = missing();
+    if (head_ == tail_)
+    {
+      head_ = 0;
+      tail_ = 0;
+      //Give back the memory taken by a big frame
+      if (buffer_.size() > capacity_ && min_space <= capacity_)
+        std::vector<char>(capacity_).swap(buffer_);
+    }
+    else if (buffer_.size() - tail_ < min_space || head_ > buffer_.size() / 2)
+    {
+      //Move the partial frame to the front
+      std::memmove(buffer_.data(), buffer_.data() + head_, tail_ - head_);
+      tail_ -= head_;
+      head_ = 0;
+    }
+    if (buffer_.size() - tail_ < min_space)
+      buffer_.resize(tail_ + min_space);
+    space = buffer_.size() - tail_;
+    return buffer_.data() + tail_;
+  }
+  /*!
+  Account n bytes read into the space given by prepare
+  */
+  void commit(std::size_t n)
+  {
+    tail_ += n;
+  }
+  /*!
+  Hand out the next complete frame : its type, and its body which stays valid until the next prepare.
+  Return NEED_MORE if the frame is not complete yet, or BAD_FRAME if the header is invalid, the connection should then be dropped.
+  */
+  Status next(Message::Type& type, const char*& body, std::size_t& length)
+  {
+    if (tail_ - head_ < Message::header_length)
+      return NEED_MORE;
+    if (!Message::decode_header(buffer_.data() + head_, max_body_length_, type, length))
+      return BAD_FRAME;
+    if (tail_ - head_ < Message::header_length + length)
+      return NEED_MORE;
+    body = buffer_.data() + head_ + Message::header_length;
+    head_ += Message::header_length + length;
+    return FRAME;
+  }
+  /*!
+  Drop the bytes received, when the connection is replaced by a new one
+  */
+  void clear()
+  {
+    head_ = 0;
+    tail_ = 0;
+  }
+  /*!
+  Number of bytes received but not handed out yet
+  */
+  std::size_t pending() const
+  {
+    return tail_ - head_;
+  }
+
+private:
+  /*!
+  Bytes missing to complete the frame being received, so that a big frame is read in one go
+  */
+  std::size_t missing() const
+  {
+    Message::Type type;
+    std::size_t length;
+    if (tail_ - head_ < Message::header_length
+      || !Message::decode_header(buffer_.data() + head_, max_body_length_, type, length))
+      return 1;
+    return Message::header_length + length - (tail_ - head_);
+  }
+  std::vector<char> buffer_; /*!< Received bytes, frames are in [head_, tail_) */
+  std::size_t capacity_; /*!< Size of the buffer when no big frame is being received */
+  std::size_t head_; /*!< Start of the first frame not handed out */
+  std::size_t tail_; /*!< End of the received bytes */
+  std::size_t max_body_length_; /*!< Biggest frame body accepted */
+};
@@ -0,0 +1,109 @@
+//
+// HandlerMemory.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Memory recycled across the asynchronous operations of a connection.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <boost/asio.hpp>
+
+/*! \file HandlerMemory.hpp
+\brief Per connection memory for the handlers of boost::asio, after the allocation example of asio.
+
+Every asynchronous operation stores its handler in memory asio asks the handler for, by default from the heap.
+A connection has at most one read and one write in flight, so each of them gets a HandlerMemory block
+and the operations take turns in it : once warmed up, the reads and writes themselves never allocate.
+The server sessions go further : the messages delivered from other threads wait in an inbox drained by a handler in its own block,
+and the acknowledgments are recycled, so a client moving its shapes is served without allocating.
+Asio frees the memory of an operation before calling its handler, so the handler can start the next operation in the same block.
+The custom allocation hooks go through the strand wrappers and the composed operations, such as async_write, to the wrapped handler.
+*/
+
+/*!
+Block of memory for one asynchronous operation at a time.
+A request too big, or made while the block is in use, falls back to the heap.
+Only used from the thread running the operations of the connection (or its strand).
+*/
+class HandlerMemory
+{
+public:
+  enum { capacity = 512 };
+
+  HandlerMemory()
+    : in_use_(false)
+  {
+  }
+
+  void* allocate(std::size_t size)
+  {
+    if (!in_use_ && size <= capacity)
+    {
+      in_use_ = true;
+      return &storage_;
+    }
+    return ::operator new(size);
+  }
+
+  void deallocate(void* pointer)
+  {
+    if (pointer == &storage_)
+      in_use_ = false;
+    else
+      ::operator delete(pointer);
+  }
+
+private:
+  HandlerMemory(const HandlerMemory&) = delete;
+  HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+  std::aligned_storage<capacity>::type storage_; /*!< The recycled block */
+  bool in_use_; /*!< True while an operation holds the block */
+};
+
+/*!
+Handler allocating its operation in a HandlerMemory, through the allocation hooks of asio
+*/
+template <typename Handler>
+class MemoryHandler
+{
+public:
+  MemoryHandler(HandlerMemory& memory, Handler handler)
+    : memory_(memory), handler_(std::move(handler))
+  {
+  }
+
+  template <typename... Args>
+  void operator()(Args&&... args)
+  {
+    handler_(std::forward<Args>(args)...);
+  }
+
+  friend void* asio_handler_allocate(std::size_t size, MemoryHandler<Handler>* handler)
+  {
+    return handler->memory_.allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/, MemoryHandler<Handler>* handler)
+  {
+    handler->memory_.deallocate(pointer);
+  }
+
+private:
+  HandlerMemory& memory_; /*!< Where the operation is allocated */
+  Handler handler_; /*!< The wrapped handler */
+};
+
+/*!
+Wrap handler so that its operation is allocated in memory
+*/
+template <typename Handler>
+inline MemoryHandler<Handler> make_memory_handler(HandlerMemory& memory, Handler handler)
+{
+  return MemoryHandler<Handler>(memory, std::move(handler));
+}
@@ -0,0 +1,193 @@
+//
+// Handoff.hpp
+// ~~~~~~~~~~~
+//
+// Warm restart : the listening sockets and the images of the clients handed over to a new server process.
+//
+
+#pragma once
+
+#include <boost/asio.hpp>
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#define PATCHWORK_HAS_HANDOFF
+#endif
+
+#ifdef PATCHWORK_HAS_HANDOFF
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "Relay.hpp"
+
+/*! \file Handoff.hpp
+\brief Warm restart : a new server process takes over the listening sockets and the images of the clients of the running one.
+
+The running server, started with --handoff PATH, waits for its successor on the Unix-domain socket PATH.
+The successor, started with --takeover PATH, connects there and receives the listening sockets as file descriptors (SCM_RIGHTS) :
+it accepts on the very sockets the old process listened on, whose kernel queue holds the connections not accepted yet,
+so that no connection is refused during the restart. The old process then stops accepting and streams its state over the same socket,
+framed as in the journal : first the images it stored for the clients not connected, then an empty frame ending them,
+then the snapshot of every client it drains. The successor gives no image back before that end, so that a client reconnecting early
+does not miss its own, and it drops the snapshots of the clients already reconnected to it : theirs are newer.
+Draining disconnects the clients a few at a time : each one reconnects with its identity, the successor accepts it and gives it back
+its image, so that it resumes without sending it again. When no client is left, the old process closes the socket and exits.
+PATCHWORK_HAS_HANDOFF is defined where boost::asio has Unix-domain sockets.
+*/
+
+/*!
+Connection between a server and its successor. The records may be sent from any thread, the rest is used by one thread.
+*/
+class Handoff
+{
+public:
+  typedef boost::asio::local::stream_protocol protocol;
+  enum { max_descriptors = 64 };
+  enum Received { RECORD, END_OF_DUMP, CLOSED }; /*!< What receive() got : a record, the end of the images stored, or the end of the stream */
+
+  explicit Handoff(protocol::socket socket)
+    : socket_(std::move(socket))
+  {
+  }
+
+  /*!
+  Connect to the server waiting for its successor at path, return null if there is none
+  */
+  static std::unique_ptr<Handoff> connect(boost::asio::io_service& io_service, const std::string& path)
+  {
+    protocol::socket socket(io_service);
+    boost::system::error_code ec;
+    socket.connect(protocol::endpoint(path), ec);
+    if (ec)
+      return nullptr;
+    return std::unique_ptr<Handoff>(new Handoff(std::move(socket)));
+  }
+
+  /*!
+  Send the listening sockets. They stay open here, the successor gets duplicates of them.
+  */
+  bool send_descriptors(const std::vector<int>& descriptors)
+  {
+    if (descriptors.empty() || descriptors.size() > max_descriptors)
+      return false;
+    char magic[4] = { 'P', 'W', 'H', '1' };
+    iovec data = { magic, sizeof(magic) };
+    std::vector<char> control(CMSG_SPACE(descriptors.size() * sizeof(int)));
+    msghdr header;
+    std::memset(&header, 0, sizeof(header));
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+    cmsghdr* rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(descriptors.size() * sizeof(int));
+    std::memcpy(CMSG_DATA(rights), descriptors.data(), descriptors.size() * sizeof(int));
+    return sendmsg(socket_.native_handle(), &header, MSG_NOSIGNAL) == sizeof(magic);
+  }
+
+  /*!
+  Receive the listening sockets of the previous server
+  */
+  bool receive_descriptors(std::vector<int>& descriptors)
+  {
+    char magic[4];
+    iovec data = { magic, sizeof(magic) };
+    std::vector<char> control(CMSG_SPACE(max_descriptors * sizeof(int)));
+    msghdr header;
+    std::memset(&header, 0, sizeof(header));
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+    if (recvmsg(socket_.native_handle(), &header, MSG_WAITALL) != sizeof(magic) || std::memcmp(magic, "PWH1", sizeof(magic)) != 0)
+      return false;
+    for (cmsghdr* rights = CMSG_FIRSTHDR(&header); rights; rights = CMSG_NXTHDR(&header, rights))
+    {
+      if (rights->cmsg_level != SOL_SOCKET || rights->cmsg_type != SCM_RIGHTS)
+        continue;
+      std::size_t count = (rights->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int* received = reinterpret_cast<const int*>(CMSG_DATA(rights));
+      descriptors.insert(descriptors.end(), received, received + count);
+    }
+    return !descriptors.empty();
+  }
+
+  /*!
+  Send record framed by its length, from any thread. Blocks until the successor reads it if the socket is full.
+  */
+  bool send(const RelayRecord& record)
+  {
+    std::string body;
+    record.encode(body);
+    std::string length;
+    Patchwork::put_varint(length, body.size());
+    std::vector<boost::asio::const_buffer> frame;
+    frame.push_back(boost::asio::buffer(length));
+    frame.push_back(boost::asio::buffer(body));
+    std::lock_guard<std::mutex> guard(mutex_);
+    boost::system::error_code ec;
+    boost::asio::write(socket_, frame, ec);
+    return !ec;
+  }
+
+  /*!
+  Tell the successor that every image stored was sent, the next records are the snapshots of the clients drained
+  */
+  bool end_dump()
+  {
+    const char empty = 0;
+    std::lock_guard<std::mutex> guard(mutex_);
+    boost::system::error_code ec;
+    boost::asio::write(socket_, boost::asio::buffer(&empty, 1), ec);
+    return !ec;
+  }
+
+  /*!
+  Receive the next record, or the end of the images stored. CLOSED once the previous server closed the socket, or sent garbage.
+  */
+  Received receive(RelayRecord& record)
+  {
+    uint64_t length = 0;
+    boost::system::error_code ec;
+    for (int shift = 0;; shift += 7)
+    {
+      unsigned char byte;
+      if (shift >= 64 || boost::asio::read(socket_, boost::asio::buffer(&byte, 1), ec) != 1)
+        return CLOSED;
+      length |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    if (length == 0)
+      return END_OF_DUMP;
+    body_.resize((std::size_t)length);
+    if (boost::asio::read(socket_, boost::asio::buffer(&body_[0], body_.size()), ec) != body_.size())
+      return CLOSED;
+    return record.decode(body_.data(), body_.size()) ? RECORD : CLOSED;
+  }
+
+  /*!
+  End the stream, the successor sees the end of the records
+  */
+  void close()
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    boost::system::error_code ignored;
+    socket_.shutdown(protocol::socket::shutdown_both, ignored);
+    socket_.close(ignored);
+  }
+
+private:
+  protocol::socket socket_; /*!< Connection to the other server */
+  std::mutex mutex_; /*!< Serializes the records sent */
+  std::string body_; /*!< Body of the record being received */
+};
+
+#endif
@@ -0,0 +1,84 @@
+//
+// Handshake.hpp
+// ~~~~~~~~~~~~~
+//
+// Session fields of the HELLO exchanged when a client connects.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/*! \file Handshake.hpp
+\brief Session fields of the HELLO a client sends right after the connection, and of the answer of the server.
+
+A HELLO body is "HELLO" followed by tokens separated by spaces, in any order. The session tokens are :
+" push" if the client pushes its changes without being asked, " room=NAME" for the room it joins,
+" id=IDENTITY" for the identity it keeps across its connections, and in the answer " version=N", the version of the image
+the server holds for this identity. Each feature appends and reads its own tokens besides : the compression (see Compression.hpp)
+and the shared memory ring (see Transport.hpp). A token the other side does not know is ignored.
+*/
+
+/*!
+Session fields of a handshake, from a client or from the server
+*/
+struct Handshake
+{
+  Handshake()
+    : push(false), version(0)
+  {
+  }
+
+  /*!
+  Body of the HELLO holding the fields set, the tokens of the other features are appended to it
+  */
+  std::string encode() const
+  {
+    std::string hello = "HELLO";
+    if (push)
+      hello += " push";
+    if (!room.empty())
+      hello += " room=" + room;
+    if (!identity.empty())
+      hello += " id=" + identity;
+    if (version)
+      hello += " version=" + std::to_string(version);
+    return hello;
+  }
+
+  /*!
+  Fields of the HELLO body hello, those missing being left empty
+  */
+  static Handshake parse(const std::string& hello)
+  {
+    Handshake handshake;
+    handshake.push = hello.find(" push") != std::string::npos;
+    handshake.room = field(hello, " room=");
+    handshake.identity = field(hello, " id=");
+    std::string version = field(hello, " version=");
+    if (!version.empty())
+      handshake.version = std::strtoull(version.c_str(), nullptr, 10);
+    return handshake;
+  }
+
+  bool push; /*!< True if the client pushes its changes, it is then never asked for them */
+  std::string room; /*!< Room the client joins, a name without spaces, empty for the default room */
+  std::string identity; /*!< Identity the client keeps across its connections, empty if it gives none */
+  uint64_t version; /*!< Version of the image the server holds for this identity, 0 if none */
+
+private:
+  /*!
+  Value of the token starting with key, up to the next space, empty if there is none
+  */
+  static std::string field(const std::string& hello, const char* key)
+  {
+    std::size_t start = hello.find(key);
+    if (start == std::string::npos)
+      return std::string();
+    start += std::strlen(key);
+    return hello.substr(start, hello.find(' ', start) - start);
+  }
+};
@@ -0,0 +1,528 @@
+//
+// Journal.hpp
+// ~~~~~~~~~~~
+//
+// Durable images of the clients : append-only journal and compacted snapshots.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#if _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "Relay.hpp"
+#include "Shape.h"
+#include "Sync.h"
+
+/*! \file Journal.hpp
+\brief Durability of the images of the clients, so that a restarted server gives them back without the clients sending them again.
+
+Every change of a client having an identity is appended to the journal : the RelayRecord the federation relays, framed by its length.
+Once the journal grows past a threshold, a new one is started and a background thread compacts the older ones into a snapshot,
+holding one reset delta per identity. The files are numbered by generation : the snapshot tells the first journal it does not hold,
+and the journals before it are deleted once it is written. The snapshot is taken while the clients keep changing, so it may already
+hold some changes of the journal that follows it : replaying them is harmless, a delta whose version the image reached is skipped.
+
+Restoring only reads the files and keeps, for each identity, its room and the records of its image still encoded :
+a restart takes the time of reading the files, and an image is decoded when its client comes back.
+A frame truncated by a crash ends the file it is in.
+
+Without a directory, the journal only keeps the images in memory : the images handed over by a previous server, see Handoff.hpp.
+*/
+
+/*!
+Counters of the journal, readable from any thread
+*/
+struct JournalStats
+{
+  std::atomic<uint64_t> records{ 0 }; /*!< Records appended */
+  std::atomic<uint64_t> bytes{ 0 }; /*!< Size of the journal being appended to */
+  std::atomic<uint64_t> compactions{ 0 }; /*!< Snapshots written */
+  std::atomic<uint64_t> stored{ 0 }; /*!< Images kept for the clients not connected */
+  std::atomic<uint64_t> restored{ 0 }; /*!< Images read at startup */
+  std::atomic<uint64_t> restore_ms{ 0 }; /*!< Time taken to read them */
+
+  void print(std::ostream& out) const
+  {
+    out << "Journal : " << records << " records, " << bytes << " bytes since the last snapshot, " << compactions << " snapshots, "
+      << stored << " images stored, " << restored << " restored in " << restore_ms << " ms" << std::endl;
+  }
+};
+
+/*!
+Journal and snapshots of the images of the clients, in one directory.
+The caller appends the records of the connected clients, keeps with park() the image of a client leaving, and gives it back with resume().
+Thread safe.
+*/
+class Journal
+{
+public:
+  enum { default_compact_bytes = 64 * 1024 * 1024 };
+  /*!
+  Fill a snapshot record of a connected client, return false if it has nothing to store
+  */
+  typedef std::function<bool(RelayRecord&)> Snapshotter;
+
+  /*!
+  Journal in directory, compacted once it holds compact_bytes. An empty directory keeps the images in memory only.
+  */
+  Journal(const std::string& directory, std::size_t compact_bytes = default_compact_bytes)
+    : directory_(directory), compact_bytes_(compact_bytes), generation_(0), file_(nullptr), compacting_(false)
+  {
+  }
+
+  ~Journal()
+  {
+    if (compactor_.joinable())
+      compactor_.join();
+    if (file_)
+      std::fclose(file_);
+  }
+
+  /*!
+  Read the images stored in the directory, created if needed, then start a new journal.
+  Return false if the journal cannot be written, or if the snapshot cannot be read : the journals it leaves out are then kept,
+  for someone to look at the directory rather than the server to start without the images.
+  */
+  bool open()
+  {
+    if (directory_.empty())
+      return true;
+#if _WIN32
+    _mkdir(directory_.c_str());
+#else
+    mkdir(directory_.c_str(), 0755);
+#endif
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> guard(mutex_);
+    uint64_t generation = 0;
+    if (read(snapshot_path(), snapshot_magic(), &generation) == NOT_JOURNAL)
+      return false;
+    remove_journals(generation);
+    while (read(journal_path(generation), journal_magic(), nullptr) != MISSING)
+      ++generation;
+    //The last journal may end with a truncated frame, the new records go in a new one
+    generation_ = generation;
+    file_ = start_journal(generation_);
+    stats_.restored = stored_.size();
+    stats_.stored = stored_.size();
+    stats_.restore_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    return file_ != nullptr;
+  }
+
+  /*!
+  Append the record of a change, if it has an identity
+  */
+  void append(const RelayRecord& record)
+  {
+    if (record.identity.empty())
+      return;
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!file_)
+      return;
+    stats_.bytes += write_frame(file_, record);
+    std::fflush(file_);
+    stats_.records++;
+  }
+
+  /*!
+  Append and keep the record of a client not connected, received from another server
+  */
+  void restore(RelayRecord record)
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (file_ && !record.identity.empty())
+    {
+      stats_.bytes += write_frame(file_, record);
+      std::fflush(file_);
+      stats_.records++;
+    }
+    store(record);
+    stats_.stored = stored_.size();
+  }
+
+  /*!
+  Give every image stored to out, as a record holding the whole image
+  */
+  void dump(const std::function<void(const RelayRecord&)>& out)
+  {
+    std::map< std::string, std::shared_ptr<StoredImage> > stored;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stored = stored_;
+    }
+    RelayRecord record;
+    for (auto& entry : stored)
+    {
+      if (whole(entry.first, *entry.second, record))
+        out(record);
+    }
+  }
+
+  /*!
+  Keep the image of a client leaving the server, record holding its whole image : a SNAPSHOT or an IMAGE with its identity and room.
+  The image is encoded by the caller, the journal is only locked to keep it.
+  */
+  void park(RelayRecord record)
+  {
+    if (record.identity.empty() || (record.kind != RelayRecord::SNAPSHOT && record.kind != RelayRecord::IMAGE))
+      return;
+    std::lock_guard<std::mutex> guard(mutex_);
+    store(record);
+    stats_.stored = stored_.size();
+  }
+
+  /*!
+  Room and records of the image of a client not connected, the first record usually holding the whole image
+  */
+  struct StoredImage
+  {
+    std::string room;
+    std::vector< std::pair<RelayRecord::Kind, std::string> > changes;
+  };
+
+  /*!
+  Take out the image stored for identity, null if there is none. It is given back with replay(), which does not need the journal.
+  */
+  std::shared_ptr<const StoredImage> take(const std::string& identity)
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = stored_.find(identity);
+    if (identity.empty() || it == stored_.end())
+      return nullptr;
+    std::shared_ptr<const StoredImage> image = it->second;
+    stored_.erase(it);
+    stats_.stored = stored_.size();
+    return image;
+  }
+
+  /*!
+  Give back the image stored for identity : img and sync are brought to the version the client had. The caller holds the lock of the image.
+  Return false if there is none.
+  */
+  bool resume(const std::string& identity, Patchwork::Image& img, Patchwork::SyncReceiver& sync)
+  {
+    std::shared_ptr<const StoredImage> image = take(identity);
+    if (!image)
+      return false;
+    replay(*image, img, sync);
+    return true;
+  }
+
+  /*!
+  Apply the records of image to img, skipping the deltas it already reached
+  */
+  static void replay(const StoredImage& image, Patchwork::Image& img, Patchwork::SyncReceiver& sync)
+  {
+    uint64_t version;
+    for (auto& change : image.changes)
+    {
+      if (change.first == RelayRecord::IMAGE)
+      {
+        img.deserialize(change.second);
+        sync.reset();
+      }
+      else if (Patchwork::SyncReceiver::version_of(change.second) > sync.version())
+      {
+        if (change.first == RelayRecord::OPERATION)
+          sync.apply_operation(img, change.second, version);
+        else
+          sync.apply(img, change.second, version);
+      }
+    }
+  }
+
+  /*!
+  True when the journal is big enough to be compacted, and no compaction is running
+  */
+  bool compaction_due() const
+  {
+    return !compacting_ && stats_.bytes >= compact_bytes_;
+  }
+
+  /*!
+  Start a new journal, then write in the background the snapshot of the stored images and of the connected clients given by live
+  */
+  void compact(std::vector<Snapshotter> live)
+  {
+    std::map< std::string, std::shared_ptr<StoredImage> > stored;
+    uint64_t generation;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (compacting_ || !file_)
+        return;
+      std::FILE* next = start_journal(generation_ + 1);
+      if (!next)
+        return;
+      std::fclose(file_);
+      file_ = next;
+      generation = ++generation_;
+      stored = stored_;
+      compacting_ = true;
+    }
+    if (compactor_.joinable())
+      compactor_.join();
+    compactor_ = std::thread([this, stored, generation, live]()
+    {
+      write_snapshot(stored, generation, live);
+      compacting_ = false;
+    });
+  }
+
+  /*!
+  Wait for the compaction running, if any
+  */
+  void wait()
+  {
+    if (compactor_.joinable())
+      compactor_.join();
+  }
+
+  const JournalStats& stats() const
+  {
+    return stats_;
+  }
+
+private:
+  /*!
+  First bytes of the files
+  */
+  static const char* snapshot_magic()
+  {
+    return "PWS1";
+  }
+  static const char* journal_magic()
+  {
+    return "PWJ1";
+  }
+
+  std::string snapshot_path() const
+  {
+    return directory_ + "/snapshot";
+  }
+  std::string journal_path(uint64_t generation) const
+  {
+    return directory_ + "/journal." + std::to_string(generation);
+  }
+
+  /*!
+  Fill record with the whole image of identity, return false if it has none
+  */
+  static bool whole(const std::string& identity, const StoredImage& image, RelayRecord& record)
+  {
+    if (image.changes.empty())
+      return false;
+    record = RelayRecord(RelayRecord::SNAPSHOT);
+    record.identity = identity;
+    record.room = image.room;
+    if (image.changes.size() == 1 && image.changes[0].first != RelayRecord::SYNC && image.changes[0].first != RelayRecord::OPERATION)
+    {
+      //Already a whole image
+      record.kind = image.changes[0].first;
+      record.payload = image.changes[0].second;
+      return true;
+    }
+    Patchwork::Image img;
+    Patchwork::SyncReceiver sync;
+    replay(image, img, sync);
+    if (!sync.snapshot(img, record.payload))
+    {
+      record.kind = RelayRecord::IMAGE;
+      img.serialize_binary(record.payload);
+    }
+    return true;
+  }
+
+  /*!
+  Keep the change of record for its identity, while reading the files or restoring
+  */
+  void store(RelayRecord& record)
+  {
+    if (record.identity.empty() || record.kind == RelayRecord::LEAVE || record.kind == RelayRecord::RESYNC)
+      return;
+    std::shared_ptr<StoredImage>& image = stored_[record.identity];
+    if (!image)
+      image = std::make_shared<StoredImage>();
+    if (record.kind == RelayRecord::JOIN || record.kind == RelayRecord::SNAPSHOT || record.kind == RelayRecord::IMAGE)
+    {
+      //The image starts over : from nothing for a new client, else from the whole image the record holds.
+      //A new entry, a compaction may be reading the previous one
+      image = std::make_shared<StoredImage>();
+      image->room = record.room;
+      if (record.payload.empty())
+        return;
+      if (record.kind == RelayRecord::JOIN)
+        record.kind = RelayRecord::SNAPSHOT;
+    }
+    image->changes.push_back(std::make_pair(record.kind, std::move(record.payload)));
+  }
+
+  enum ReadStatus { READ, MISSING, NOT_JOURNAL };
+
+  /*!
+  Store every record of the file at path starting with magic, then the generation for a snapshot.
+  A file with another header is NOT_JOURNAL, and nothing is read from it.
+  */
+  ReadStatus read(const std::string& path, const char* magic, uint64_t* generation)
+  {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+      return MISSING;
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    char header[4];
+    if (std::fread(header, 1, sizeof(header), file) != sizeof(header) || std::memcmp(header, magic, sizeof(header)) != 0
+        || (generation && !get_varint(file, *generation)))
+    {
+      std::cout << "Journal : " << path << " is not a journal file" << std::endl;
+      std::fclose(file);
+      return NOT_JOURNAL;
+    }
+    uint64_t length;
+    std::string body;
+    RelayRecord record;
+    //A length past the end of the file is a truncated frame, or garbage : nothing is allocated for it
+    while (get_varint(file, length) && length <= (uint64_t)(size - std::ftell(file)))
+    {
+      body.resize((std::size_t)length);
+      if (std::fread(&body[0], 1, body.size(), file) != body.size() || !record.decode(body.data(), body.size()))
+        break;
+      store(record);
+    }
+    std::fclose(file);
+    return READ;
+  }
+
+  /*!
+  Write the snapshot of stored and live, holding every journal before generation
+  */
+  void write_snapshot(const std::map< std::string, std::shared_ptr<StoredImage> >& stored, uint64_t generation,
+      const std::vector<Snapshotter>& live)
+  {
+    std::string temporary = snapshot_path() + ".tmp";
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (!file)
+    {
+      std::cout << "Journal : cannot write " << temporary << std::endl;
+      return;
+    }
+    std::string header(snapshot_magic(), 4);
+    Patchwork::put_varint(header, generation);
+    std::fwrite(header.data(), 1, header.size(), file);
+    RelayRecord record;
+    for (auto& entry : stored)
+    {
+      if (whole(entry.first, *entry.second, record))
+        write_frame(file, record);
+    }
+    for (auto& snapshot : live)
+    {
+      RelayRecord record;
+      if (snapshot(record) && !record.identity.empty())
+        write_frame(file, record);
+    }
+    bool written = std::fflush(file) == 0;
+#if _WIN32
+    written = written && _commit(_fileno(file)) == 0;
+#else
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    std::fclose(file);
+    if (!written)
+    {
+      std::cout << "Journal : cannot write " << temporary << std::endl;
+      std::remove(temporary.c_str());
+      return;
+    }
+#if _WIN32
+    std::remove(snapshot_path().c_str());
+#endif
+    std::rename(temporary.c_str(), snapshot_path().c_str());
+    remove_journals(generation);
+    stats_.compactions++;
+  }
+
+  /*!
+  Open the journal of generation, return null if it cannot be written
+  */
+  std::FILE* start_journal(uint64_t generation)
+  {
+    std::FILE* file = std::fopen(journal_path(generation).c_str(), "wb");
+    if (!file)
+    {
+      std::cout << "Journal : cannot write " << journal_path(generation) << std::endl;
+      return nullptr;
+    }
+    std::fwrite(journal_magic(), 1, 4, file);
+    std::fflush(file);
+    stats_.bytes = 4;
+    return file;
+  }
+
+  /*!
+  Delete the journals before generation, held by the snapshot
+  */
+  void remove_journals(uint64_t generation)
+  {
+    while (generation > 0 && std::remove(journal_path(--generation).c_str()) == 0)
+      ;
+  }
+
+  /*!
+  Write record framed by its length, return the bytes written
+  */
+  static std::size_t write_frame(std::FILE* file, const RelayRecord& record)
+  {
+    std::string body;
+    record.encode(body);
+    std::string length;
+    Patchwork::put_varint(length, body.size());
+    std::fwrite(length.data(), 1, length.size(), file);
+    std::fwrite(body.data(), 1, body.size(), file);
+    return length.size() + body.size();
+  }
+
+  static bool get_varint(std::FILE* file, uint64_t& value)
+  {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      int byte = std::fgetc(file);
+      if (byte == EOF)
+        return false;
+      value |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  std::string directory_; /*!< Where the files are */
+  std::size_t compact_bytes_; /*!< Size of the journal triggering a compaction */
+  std::mutex mutex_; /*!< Protects the members below */
+  uint64_t generation_; /*!< Generation of the journal being appended to */
+  std::FILE* file_; /*!< Journal being appended to, null if it cannot be written */
+  std::map< std::string, std::shared_ptr<StoredImage> > stored_; /*!< Images of the clients not connected, by identity */
+  std::atomic<bool> compacting_; /*!< True while a snapshot is written */
+  std::thread compactor_; /*!< Writes the snapshot */
+  JournalStats stats_; /*!< Counters */
+};
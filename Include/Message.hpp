@@ -10,29 +10,292 @@
 
 #pragma once
 
-#include <cstdio>
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*! \file Message.hpp
+\brief Framing of the messages exchanged between the server and the clients.
+
+A frame is a 5 bytes header, the body length as a little endian uint32 and the message type, followed by the body.
+Bodies have no size limit but the maximum frame size given by the receiver, and live in heap buffers recycled by a BufferPool :
+a frame is encoded straight in a buffer of its size class, and the buffer goes back to the pool with the last reference to the message.
+Messages are queued for writing as Message_ptr : an encoded frame is immutable, so the same one is shared by every connection it is broadcast to.
+*/
+
+/*!
+Counters of a BufferPool, readable from any thread
+*/
+struct PoolStats
+{
+  std::atomic<uint64_t> hits{ 0 }; /*!< Buffers reused from a free list */
+  std::atomic<uint64_t> thread_hits{ 0 }; /*!< Among the hits, buffers reused from the free list of the calling thread */
+  std::atomic<uint64_t> misses{ 0 }; /*!< Buffers allocated because no free one was big enough */
+  std::atomic<uint64_t> dropped{ 0 }; /*!< Buffers freed because the free lists were full, or the buffer too big */
+  std::atomic<int64_t> in_use{ 0 }; /*!< Buffers acquired and not released yet */
+
+  void print(std::ostream& out) const
+  {
+    uint64_t total = hits + misses;
+    out << "Buffer pool : " << hits << " hits (" << thread_hits << " from the thread), " << misses << " misses";
+    if (total)
+      out << ", " << 100 * hits / total << "% reused";
+    out << ", " << in_use << " in use, " << dropped << " dropped" << std::endl;
+  }
+};
+
+/*!
+Free lists of heap buffers, so that reading and writing frames does not allocate once the pool is warm.
+Buffers are sorted in size classes, powers of two from min_capacity to max_capacity : a request takes a buffer of its class,
+which leaves room to grow up to the next class. A multi megabytes image above max_capacity is not worth pinning.
+Each thread keeps a few buffers per class of the shared pool for itself, taken and given back without locking :
+a message is usually encoded, and freed once written, by the same IO thread.
+*/
+class BufferPool
+{
+public:
+  enum { max_buffers = 64 }; /*!< Most free buffers of a class shared between the threads */
+  enum { max_thread_buffers = 8 }; /*!< Most free buffers of a class kept by each thread */
+  enum { min_capacity = 256 };
+  enum { max_capacity = 4 * 1024 * 1024 };
+  enum { nb_classes = 15 }; /*!< Number of powers of two from min_capacity to max_capacity */
+
+  /*!
+  Pool shared by every connection of the process, the only one with per thread free lists
+  */
+  static BufferPool& shared()
+  {
+    static BufferPool pool;
+    return pool;
+  }
+  /*!
+  Return a buffer of size bytes, reusing a free one of its class if any
+  */
+  std::vector<char> acquire(std::size_t size)
+  {
+    std::vector<char> buffer;
+    stats_.in_use++;
+    std::size_t c = class_of(size);
+    if (c == nb_classes)
+    {
+      stats_.misses++;
+      buffer.resize(size);
+      return buffer;
+    }
+    ThreadCache* cache = thread_cache();
+    if (cache && !cache->free[c].empty())
+    {
+      buffer.swap(cache->free[c].back());
+      cache->free[c].pop_back();
+      stats_.thread_hits++;
+    }
+    else
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (!free_[c].empty())
+      {
+        buffer.swap(free_[c].back());
+        free_[c].pop_back();
+      }
+    }
+    if (buffer.capacity() == 0)
+    {
+      stats_.misses++;
+      buffer.reserve(capacity_of(c));
+    }
+    else
+    {
+      stats_.hits++;
+    }
+    buffer.resize(size);
+    return buffer;
+  }
+  /*!
+  Give a buffer back to the pool, buffer is left empty.
+  It goes to the biggest class it can serve.
+  */
+  void release(std::vector<char>& buffer)
+  {
+    if (buffer.capacity() == 0)
+      return;
+    stats_.in_use--;
+    if (buffer.capacity() < min_capacity || buffer.capacity() > max_capacity)
+    {
+      drop(buffer);
+      return;
+    }
+    std::size_t c = class_of(buffer.capacity() + 1) - 1;
+    buffer.clear();
+    ThreadCache* cache = thread_cache();
+    if (cache && cache->free[c].size() < max_thread_buffers)
+    {
+      cache->free[c].push_back(std::vector<char>());
+      cache->free[c].back().swap(buffer);
+    }
+    else
+    {
+      release_shared(buffer, c);
+    }
+  }
+  /*!
+  Number of buffers waiting to be reused by the calling thread, in the shared lists and its own
+  */
+  std::size_t size()
+  {
+    std::size_t count = 0;
+    ThreadCache* cache = thread_cache();
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (std::size_t c = 0; c < nb_classes; ++c)
+      count += free_[c].size() + (cache ? cache->free[c].size() : 0);
+    return count;
+  }
+
+  const PoolStats& stats() const
+  {
+    return stats_;
+  }
+
+  /*!
+  Capacity of the buffers of class c
+  */
+  static std::size_t capacity_of(std::size_t c)
+  {
+    return (std::size_t)min_capacity << c;
+  }
+  /*!
+  Smallest class holding size bytes, nb_classes if none does
+  */
+  static std::size_t class_of(std::size_t size)
+  {
+    std::size_t c = 0;
+    while (c < nb_classes && capacity_of(c) < size)
+      ++c;
+    return c;
+  }
+
+private:
+  /*!
+  Free lists of one thread, given back to the shared pool when the thread ends
+  */
+  struct ThreadCache
+  {
+    ~ThreadCache()
+    {
+      for (std::size_t c = 0; c < nb_classes; ++c)
+      {
+        for (std::vector<char>& buffer : free[c])
+          BufferPool::shared().release_shared(buffer, c);
+      }
+    }
+    std::vector< std::vector<char> > free[nb_classes];
+  };
+
+  /*!
+  Free lists of the calling thread, null for any pool but the shared one
+  */
+  ThreadCache* thread_cache()
+  {
+    if (this != &shared())
+      return nullptr;
+    static thread_local ThreadCache cache;
+    return &cache;
+  }
+
+  void release_shared(std::vector<char>& buffer, std::size_t c)
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (free_[c].size() < max_buffers)
+    {
+      free_[c].push_back(std::vector<char>());
+      free_[c].back().swap(buffer);
+    }
+    else
+    {
+      drop(buffer);
+    }
+  }
+
+  void drop(std::vector<char>& buffer)
+  {
+    stats_.dropped++;
+    std::vector<char>().swap(buffer);
+  }
+
+  std::mutex mutex_; /*!< Protects free_, buffers are released from every IO thread */
+  std::vector< std::vector<char> > free_[nb_classes]; /*!< Buffers waiting to be reused, by class */
+  PoolStats stats_; /*!< Hits and misses of the pool */
+};
 
 class Message
 {
 public:
-  enum { header_length = 4 };
-  enum { max_body_length = 512 };
+  enum { header_length = 5 };
+  enum { default_max_body_length = 64 * 1024 * 1024 };
+  enum Type { HELLO = 0, GET, IMAGE, SYNC, SYNC_ACK, OPERATION, RELAY, RING, REPLY, END_TYPE }; /*!< Handshake, request of the image, image, delta of the image, its acknowledgment, transformation of a shape, record replicated between servers, body left in the shared memory ring, and reply to a request */
 
-  Message()
-    : body_length_(0)
+  Message(Type type = IMAGE)
+    : type_(type),
+      body_length_(0),
+      data_(BufferPool::shared().acquire(header_length))
   {
   }
 
+  /*!
+  Build a complete frame holding body
+  */
+  Message(Type type, const std::string& body)
+    : type_(type),
+      body_length_(body.size()),
+      data_(BufferPool::shared().acquire(header_length + body.size()))
+  {
+    std::memcpy(this->body(), body.data(), body.size());
+    encode_header();
+  }
+
+  Message(const Message& other)
+    : type_(other.type_),
+      body_length_(other.body_length_),
+      data_(BufferPool::shared().acquire(other.data_.size()))
+  {
+    std::memcpy(data_.data(), other.data_.data(), data_.size());
+  }
+
+  Message(Message&& other)
+    : type_(other.type_),
+      body_length_(other.body_length_),
+      data_(std::move(other.data_))
+  {
+    other.body_length_ = 0;
+  }
+
+  Message& operator=(Message other)
+  {
+    std::swap(type_, other.type_);
+    std::swap(body_length_, other.body_length_);
+    data_.swap(other.data_);
+    return *this;
+  }
+
+  ~Message()
+  {
+    BufferPool::shared().release(data_);
+  }
+
   const char* data() const
   {
-    return data_;
+    return data_.data();
   }
 
   char* data()
   {
-    return data_;
+    return data_.data();
   }
 
   std::size_t length() const
@@ -42,12 +305,12 @@ public:
 
   const char* body() const
   {
-    return data_ + header_length;
+    return data_.data() + header_length;
   }
 
   char* body()
   {
-    return data_ + header_length;
+    return data_.data() + header_length;
   }
 
   std::size_t body_length() const
@@ -55,34 +318,69 @@ public:
     return body_length_;
   }
 
+  /*!
+  Resize the body, the buffer grows as needed : nothing is truncated
+  */
   void body_length(std::size_t new_length)
   {
     body_length_ = new_length;
-    if (body_length_ > max_body_length)
-      body_length_ = max_body_length;
+    data_.resize(header_length + body_length_);
+  }
+
+  Type type() const
+  {
+    return type_;
+  }
+
+  void type(Type new_type)
+  {
+    type_ = new_type;
   }
 
-  bool decode_header()
+  /*!
+  Read the length and the type from the header, and make room for the body.
+  Return false if the type is unknown or the body is bigger than max_body_length, the connection should then be dropped.
+  */
+  bool decode_header(std::size_t max_body_length = default_max_body_length)
   {
-    char header[header_length + 1] = "";
-    std::strncat(header, data_, header_length);
-    body_length_ = std::atoi(header);
-    if (body_length_ > max_body_length)
+    std::size_t length;
+    if (!decode_header(data_.data(), max_body_length, type_, length))
     {
       body_length_ = 0;
       return false;
     }
+    body_length(length);
+    return true;
+  }
+
+  /*!
+  Read the length and the type from the header_length bytes at data, with the same checks as above
+  */
+  static bool decode_header(const char* data, std::size_t max_body_length, Type& type, std::size_t& length)
+  {
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(data);
+    length = (std::size_t)header[0] | ((std::size_t)header[1] << 8)
+      | ((std::size_t)header[2] << 16) | ((std::size_t)header[3] << 24);
+    if (length > max_body_length || header[4] >= END_TYPE)
+      return false;
+    type = static_cast<Type>(header[4]);
     return true;
   }
 
   void encode_header()
   {
-    char header[header_length + 1] = "";
-    std::sprintf(header, "%4d", static_cast<int>(body_length_));
-    std::memcpy(data_, header, header_length);
+    uint32_t length = static_cast<uint32_t>(body_length_);
+    data_[0] = static_cast<char>(length & 0xFF);
+    data_[1] = static_cast<char>((length >> 8) & 0xFF);
+    data_[2] = static_cast<char>((length >> 16) & 0xFF);
+    data_[3] = static_cast<char>((length >> 24) & 0xFF);
+    data_[4] = static_cast<char>(type_);
   }
 
 private:
-  char data_[header_length + max_body_length];
+  Type type_;
   std::size_t body_length_;
+  std::vector<char> data_; /*!< Header then body, taken from the BufferPool */
 };
+
+typedef std::shared_ptr<const Message> Message_ptr;
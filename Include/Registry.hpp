@@ -0,0 +1,146 @@
+//
+// Registry.hpp
+// ~~~~~~~~~~~~
+//
+// Set of the connections of a room, indexed by ID and readable without locking.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/*! \file Registry.hpp
+\brief Copy on write registry of participants, read through immutable snapshots.
+
+Joining or leaving builds a new snapshot and publishes it atomically, readers just take a reference on the current one :
+iterating or looking up an ID never copies the participants nor waits for a writer, and a snapshot stays valid, unchanged,
+for as long as it is held. The last reader of an old snapshot frees it, shared_ptr counting plays the role of the grace period of RCU.
+Writes copy the participants, which is fine as clients join and leave far less often than the room is read.
+*/
+
+/*!
+Registry of shared T, each with an int member ID unique in the registry
+*/
+template <typename T>
+class Registry
+{
+public:
+  typedef std::shared_ptr<T> Item_ptr;
+
+  /*!
+  Immutable state of the registry : the participants by increasing ID, and their index
+  */
+  class Snapshot
+  {
+  public:
+    typedef typename std::vector<Item_ptr>::const_iterator const_iterator;
+
+    const_iterator begin() const
+    {
+      return items_.begin();
+    }
+    const_iterator end() const
+    {
+      return items_.end();
+    }
+    std::size_t size() const
+    {
+      return items_.size();
+    }
+    bool empty() const
+    {
+      return items_.empty();
+    }
+    /*!
+    Participant of this ID, null if none
+    */
+    Item_ptr find(int ID) const
+    {
+      auto it = by_id_.find(ID);
+      return it == by_id_.end() ? Item_ptr() : it->second;
+    }
+    /*!
+    Number of changes of the registry before this snapshot
+    */
+    uint64_t epoch() const
+    {
+      return epoch_;
+    }
+
+  private:
+    friend class Registry;
+    std::vector<Item_ptr> items_; /*!< Participants by increasing ID */
+    std::unordered_map<int, Item_ptr> by_id_; /*!< Index of items_ by ID */
+    uint64_t epoch_ = 0; /*!< Number of changes before this snapshot */
+  };
+  typedef std::shared_ptr<const Snapshot> Snapshot_ptr;
+
+  Registry()
+    : current_(std::make_shared<Snapshot>())
+  {
+  }
+
+  /*!
+  Add item, replacing the participant of the same ID if any
+  */
+  void join(const Item_ptr& item)
+  {
+    std::lock_guard<std::mutex> guard(write_mutex_);
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*snapshot());
+    auto it = std::lower_bound(next->items_.begin(), next->items_.end(), item,
+        [](const Item_ptr& a, const Item_ptr& b) { return a->ID < b->ID; });
+    if (it != next->items_.end() && (*it)->ID == item->ID)
+      *it = item;
+    else
+      next->items_.insert(it, item);
+    next->by_id_[item->ID] = item;
+    publish(next);
+  }
+
+  /*!
+  Remove item. Return false if it was not in the registry, leaving twice is harmless.
+  */
+  bool leave(const Item_ptr& item)
+  {
+    std::lock_guard<std::mutex> guard(write_mutex_);
+    Snapshot_ptr current = snapshot();
+    if (current->find(item->ID) != item)
+      return false;
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*current);
+    next->items_.erase(std::find(next->items_.begin(), next->items_.end(), item));
+    next->by_id_.erase(item->ID);
+    publish(next);
+    return true;
+  }
+
+  /*!
+  Current state of the registry, unaffected by later changes
+  */
+  Snapshot_ptr snapshot() const
+  {
+    return std::atomic_load(&current_);
+  }
+
+  /*!
+  Participant of this ID in the current state, null if none
+  */
+  Item_ptr find(int ID) const
+  {
+    return snapshot()->find(ID);
+  }
+
+private:
+  void publish(const std::shared_ptr<Snapshot>& next)
+  {
+    next->epoch_++;
+    std::atomic_store(&current_, Snapshot_ptr(next));
+  }
+
+  std::mutex write_mutex_; /*!< Serializes the writers, readers never take it */
+  Snapshot_ptr current_; /*!< Latest snapshot, only accessed through atomic_load and atomic_store */
+};
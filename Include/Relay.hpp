@@ -0,0 +1,168 @@
+//
+// Relay.hpp
+// ~~~~~~~~~
+//
+// Records replicated between federated servers.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "Codec.h"
+
+/*! \file Relay.hpp
+\brief Replication of the rooms between servers peering over TCP, so that clients may connect to any of them.
+
+A server connects to its peers like a client, but its handshake is "HELLO relay node=<id>", and then both sides exchange RELAY frames.
+Each frame holds one record : a client of the sending server joined or left a room, or its image changed.
+The records of a server are numbered in the order of its changes, and every peer applies them to a mirror of the client,
+the changes being the very deltas the client sent, so that the mirror follows the same versions as the original.
+A peer which misses a delta asks for a snapshot : a reset delta at the version of the original.
+Every record carries the time it was made at, the receiver tells the replication lag from it.
+
+A standby server keeps the mirrors of a peer whose links drop : when the clients of a failed primary reconnect to it,
+each one takes over the mirror of the same identity, so that it resumes at the version it had without uploading its image again.
+*/
+
+/*!
+A change of a server, replicated to its peers
+*/
+struct RelayRecord
+{
+  enum Kind
+  {
+    JOIN = 0, /*!< The client joined room, with the snapshot of the image it resumed if any */
+    LEAVE, /*!< The client left its room */
+    SYNC, /*!< Delta applied to the image of the client, payload as sent by the client */
+    OPERATION, /*!< Operation applied to the image of the client, payload as sent by the client */
+    IMAGE, /*!< Whole image received from the client, binary format */
+    SNAPSHOT, /*!< Reset delta holding the image of the client at its current version */
+    RESYNC, /*!< Sent back by a peer whose mirror of the client is out of sync, asking for a snapshot */
+    END_KIND
+  };
+
+  RelayRecord(Kind kind = JOIN, int client = 0)
+    : kind(kind), node(0), sequence(0), sent_at(0), client(client)
+  {
+  }
+
+  /*!
+  Write the record in out
+  */
+  void encode(std::string& out) const
+  {
+    Patchwork::put_u8(out, (uint8_t)kind);
+    Patchwork::put_varint(out, node);
+    Patchwork::put_varint(out, sequence);
+    Patchwork::put_varint(out, sent_at);
+    Patchwork::put_varint(out, (uint64_t)client);
+    Patchwork::put_varint(out, room.size());
+    out.append(room);
+    Patchwork::put_varint(out, identity.size());
+    out.append(identity);
+    out.append(payload);
+  }
+  /*!
+  Read a record written by encode, return false if it is malformed
+  */
+  bool decode(const char* data, std::size_t length)
+  {
+    Patchwork::ByteReader in(data, length);
+    uint8_t new_kind;
+    uint64_t new_client;
+    uint64_t room_length;
+    uint64_t identity_length;
+    if (!in.get_u8(new_kind) || new_kind >= END_KIND || !in.get_varint(node) || !in.get_varint(sequence)
+        || !in.get_varint(sent_at) || !in.get_varint(new_client) || !in.get_varint(room_length)
+        || room_length > in.remaining() || !in.get_bytes(room, (std::size_t)room_length)
+        || !in.get_varint(identity_length) || identity_length > in.remaining() || !in.get_bytes(identity, (std::size_t)identity_length))
+      return false;
+    kind = (Kind)new_kind;
+    client = (int)new_client;
+    payload.assign(data + length - in.remaining(), in.remaining());
+    return true;
+  }
+
+  /*!
+  Microseconds since the epoch of the system clock, which the servers of a federation are expected to keep in sync
+  */
+  static uint64_t now()
+  {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+  /*!
+  Handshake of a server peering as node
+  */
+  static std::string handshake(uint64_t node)
+  {
+    return "HELLO relay node=" + std::to_string(node);
+  }
+  /*!
+  True if handshake comes from a peer server, whose node is then set
+  */
+  static bool peer(const std::string& handshake, uint64_t& node)
+  {
+    const char* prefix = "HELLO relay node=";
+    if (handshake.compare(0, std::strlen(prefix), prefix) != 0)
+      return false;
+    node = std::strtoull(handshake.c_str() + std::strlen(prefix), nullptr, 10);
+    return node != 0;
+  }
+
+  Kind kind; /*!< What changed */
+  uint64_t node; /*!< Server where the change happened */
+  uint64_t sequence; /*!< Number of the change among those of node, from 1 */
+  uint64_t sent_at; /*!< When the change was made, see now() */
+  int client; /*!< ID of the client on node */
+  std::string room; /*!< Room joined, for JOIN and the snapshots */
+  std::string identity; /*!< Identity the client keeps across its connections, for JOIN and the snapshots */
+  std::string payload; /*!< Delta, operation or image, depending on kind */
+};
+
+/*!
+Replication counters of the records received from one peer, readable from any thread
+*/
+struct ReplicationLag
+{
+  std::atomic<uint64_t> records{ 0 }; /*!< Records applied */
+  std::atomic<uint64_t> gaps{ 0 }; /*!< Records missing between two received, their changes are caught up through snapshots */
+  std::atomic<uint64_t> resyncs{ 0 }; /*!< Snapshots asked because a mirror was out of sync */
+  std::atomic<uint64_t> last_us{ 0 }; /*!< Lag of the last record, microseconds between its change and its application */
+  std::atomic<uint64_t> max_us{ 0 }; /*!< Biggest lag */
+  std::atomic<uint64_t> total_us{ 0 }; /*!< Sum of the lags, for the mean */
+  std::atomic<uint64_t> sequence{ 0 }; /*!< Last sequence received */
+
+  /*!
+  Account a record made at sent_at and applied at applied_at. A clock behind the peer gives a null lag.
+  */
+  void account(const RelayRecord& record, uint64_t applied_at)
+  {
+    uint64_t lag = applied_at > record.sent_at ? applied_at - record.sent_at : 0;
+    records++;
+    last_us = lag;
+    total_us += lag;
+    if (lag > max_us)
+      max_us = lag;
+    if (record.sequence)
+    {
+      if (sequence && record.sequence > sequence + 1)
+        gaps += record.sequence - sequence - 1;
+      if (record.sequence > sequence)
+        sequence = record.sequence;
+    }
+  }
+
+  void print(std::ostream& out) const
+  {
+    uint64_t count = records;
+    out << count << " records, lag " << last_us / 1000.0 << " ms (mean " << (count ? total_us / count : 0) / 1000.0
+      << " ms, max " << max_us / 1000.0 << " ms), " << gaps << " gaps, " << resyncs << " resyncs" << std::endl;
+  }
+};
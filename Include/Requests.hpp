@@ -0,0 +1,227 @@
+//
+// Requests.hpp
+// ~~~~~~~~~~~~
+//
+// Requests in flight on a connection, matched to their replies by correlation ID.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Codec.h"
+
+/*! \file Requests.hpp
+\brief Requests in flight on a connection, matched to their replies by correlation ID.
+
+A request is a frame whose body starts with the varint ID of the request, the rest being its arguments : a GET asks for the image that way.
+The answer is a REPLY frame : the ID, a status byte, then the result. Several requests may be in flight on the same connection,
+each completes when its own reply comes, in whatever order, or fails once its deadline passes : a reply coming later is dropped.
+A GET with an empty body is a request without ID, the client answers it by its changes only, as before.
+The frame header is unchanged, so are the frames which are not requests.
+*/
+
+/*!
+Counters of the requests of every connection
+*/
+struct RequestStats
+{
+  RequestStats()
+    : started(0), completed(0), failed(0), timed_out(0), late(0)
+  {
+  }
+
+  void print(std::ostream& out) const
+  {
+    out << "Requests : " << started << " started, " << completed << " completed, " << failed << " failed, "
+      << timed_out << " timed out, " << late << " late replies" << std::endl;
+  }
+
+  std::atomic<uint64_t> started; /*!< Requests sent */
+  std::atomic<uint64_t> completed; /*!< Replied successfully */
+  std::atomic<uint64_t> failed; /*!< Replied with an error, or cancelled by the end of the connection */
+  std::atomic<uint64_t> timed_out; /*!< Not replied before their deadline */
+  std::atomic<uint64_t> late; /*!< Replies matching no request in flight */
+};
+
+/*!
+Requests in flight on one connection, started, completed and expired from any thread.
+The callback of a request is called exactly once, without the lock held.
+*/
+class Requests
+{
+public:
+  enum Status { DONE = 0, FAILED, TIMED_OUT }; /*!< Replied successfully, replied with an error or cancelled, or not replied in time */
+  typedef std::chrono::steady_clock Clock;
+  typedef std::function<void(Status status, const std::string& result)> Callback;
+
+  explicit Requests(RequestStats* stats = nullptr)
+    : next_id_(1), stats_(stats)
+  {
+  }
+
+  /*!
+  Account the requests in stats, before the first one starts
+  */
+  void stats(RequestStats* stats)
+  {
+    stats_ = stats;
+  }
+
+  /*!
+  Register a request which fails if not replied within timeout, return its ID to send with it
+  */
+  uint64_t start(Callback callback, Clock::duration timeout)
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    uint64_t id = next_id_++;
+    Pending& pending = pending_[id];
+    pending.callback = callback;
+    pending.deadline = Clock::now() + timeout;
+    if (stats_)
+      stats_->started++;
+    return id;
+  }
+
+  /*!
+  Complete the request id with the reply received, return false if it is not in flight any more
+  */
+  bool complete(uint64_t id, Status status, const std::string& result)
+  {
+    Callback callback;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      auto it = pending_.find(id);
+      if (it == pending_.end())
+      {
+        if (stats_)
+          stats_->late++;
+        return false;
+      }
+      callback = it->second.callback;
+      pending_.erase(it);
+    }
+    if (stats_)
+      (status == DONE ? stats_->completed : stats_->failed)++;
+    callback(status, result);
+    return true;
+  }
+
+  /*!
+  Fail the requests whose deadline is before now, return how many
+  */
+  std::size_t expire(Clock::time_point now = Clock::now())
+  {
+    std::vector<Callback> expired;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      for (auto it = pending_.begin(); it != pending_.end();)
+      {
+        if (it->second.deadline <= now)
+        {
+          expired.push_back(it->second.callback);
+          it = pending_.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+    if (stats_)
+      stats_->timed_out += expired.size();
+    for (auto& callback : expired)
+      callback(TIMED_OUT, std::string());
+    return expired.size();
+  }
+
+  /*!
+  Fail every request in flight, the connection is closed
+  */
+  void cancel()
+  {
+    std::map<uint64_t, Pending> cancelled;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      cancelled.swap(pending_);
+    }
+    if (stats_)
+      stats_->failed += cancelled.size();
+    for (auto& pending : cancelled)
+      pending.second.callback(FAILED, std::string());
+  }
+
+  std::size_t pending() const
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return pending_.size();
+  }
+
+  /*!
+  Body of the request id, with its arguments
+  */
+  static std::string request(uint64_t id, const std::string& arguments = std::string())
+  {
+    std::string body;
+    Patchwork::put_varint(body, id);
+    body += arguments;
+    return body;
+  }
+  /*!
+  ID and arguments of a request body, return false if it has no ID
+  */
+  static bool parse_request(const std::string& body, uint64_t& id, std::string& arguments)
+  {
+    Patchwork::ByteReader in(body);
+    if (body.empty() || !in.get_varint(id) || !id)
+      return false;
+    arguments.assign(in.position(), in.remaining());
+    return true;
+  }
+
+  /*!
+  Body of the reply to the request id
+  */
+  static std::string reply(uint64_t id, Status status, const std::string& result = std::string())
+  {
+    std::string body = request(id);
+    Patchwork::put_u8(body, (uint8_t)status);
+    body += result;
+    return body;
+  }
+  /*!
+  Read a reply body, return false if it is malformed
+  */
+  static bool parse_reply(const std::string& body, uint64_t& id, Status& status, std::string& result)
+  {
+    Patchwork::ByteReader in(body);
+    uint8_t new_status;
+    if (!in.get_varint(id) || !in.get_u8(new_status) || new_status > TIMED_OUT)
+      return false;
+    status = (Status)new_status;
+    result.assign(in.position(), in.remaining());
+    return true;
+  }
+
+private:
+  /*!
+  A request waiting for its reply
+  */
+  struct Pending
+  {
+    Callback callback; /*!< Called with the reply, or the failure */
+    Clock::time_point deadline; /*!< Time after which the request fails */
+  };
+
+  mutable std::mutex mutex_; /*!< Protects pending_ */
+  std::map<uint64_t, Pending> pending_; /*!< Requests in flight by ID */
+  uint64_t next_id_; /*!< ID of the next request, 0 is never used */
+  RequestStats* stats_; /*!< Counters shared by the connections, may be null */
+};
@@ -0,0 +1,160 @@
+//
+// ShardedAcceptor.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Several listening sockets sharing one port.
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include "HandlerMemory.hpp"
+
+/*! \file ShardedAcceptor.hpp
+\brief Accept loop spread over several listening sockets bound to the same port with SO_REUSEPORT.
+
+With a single acceptor, every connection waits for the previous one to be accepted and its handler to re-arm async_accept.
+With SO_REUSEPORT, each shard has its own accept queue in the kernel, which spreads the incoming connections between them,
+and the shards accept in parallel on the threads running the io_service.
+Where SO_REUSEPORT does not exist (Windows), there is a single shard.
+*/
+
+class ShardedAcceptor
+{
+public:
+  typedef boost::asio::ip::tcp tcp;
+  /*!
+  Called with every accepted socket, possibly from several threads at once : the handler moves the socket away
+  */
+  typedef std::function<void(tcp::socket&)> Handler;
+  typedef tcp::acceptor::native_handle_type Handle;
+
+  /*!
+  Listen on endpoint with nb_shards sockets, nb_shards is 1 if SO_REUSEPORT is not supported.
+  If the port of endpoint is 0, the shards share the port chosen for the first one.
+  */
+  ShardedAcceptor(boost::asio::io_service& io_service, tcp::endpoint endpoint, unsigned int nb_shards, Handler handler)
+    : handler_(handler)
+  {
+    if (!supported() || nb_shards == 0)
+      nb_shards = 1;
+    for (unsigned int i = 0; i < nb_shards; ++i)
+    {
+      std::unique_ptr<Shard> shard(new Shard(io_service));
+      shard->acceptor.open(endpoint.protocol());
+      shard->acceptor.set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+      if (nb_shards > 1)
+        shard->acceptor.set_option(reuse_port(true));
+#endif
+      shard->acceptor.bind(endpoint);
+      shard->acceptor.listen();
+      endpoint = shard->acceptor.local_endpoint();
+      shards_.push_back(std::move(shard));
+    }
+    for (auto& shard : shards_)
+      do_accept(*shard);
+  }
+
+  /*!
+  Accept on listening sockets already bound, handed over by another process
+  */
+  ShardedAcceptor(boost::asio::io_service& io_service, const tcp& protocol, const std::vector<Handle>& handles, Handler handler)
+    : handler_(handler)
+  {
+    for (Handle handle : handles)
+    {
+      std::unique_ptr<Shard> shard(new Shard(io_service));
+      shard->acceptor.assign(protocol, handle);
+      shards_.push_back(std::move(shard));
+    }
+    for (auto& shard : shards_)
+      do_accept(*shard);
+  }
+
+  /*!
+  True if the system can bind several sockets to one port
+  */
+  static bool supported()
+  {
+#ifdef SO_REUSEPORT
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  std::size_t shards() const
+  {
+    return shards_.size();
+  }
+
+  /*!
+  Port the shards listen on
+  */
+  unsigned short port() const
+  {
+    return shards_.front()->acceptor.local_endpoint().port();
+  }
+
+  /*!
+  Listening sockets, to hand them over to another process
+  */
+  std::vector<Handle> handles()
+  {
+    std::vector<Handle> handles;
+    for (auto& shard : shards_)
+      handles.push_back(shard->acceptor.native_handle());
+    return handles;
+  }
+
+  /*!
+  Stop accepting, from the threads running the io_service
+  */
+  void close()
+  {
+    for (auto& shard : shards_)
+      shard->acceptor.close();
+  }
+
+private:
+#ifdef SO_REUSEPORT
+  typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+  /*!
+  A listening socket, the socket of the connection being accepted and the memory of its accept operation
+  */
+  struct Shard
+  {
+    Shard(boost::asio::io_service& io_service) : acceptor(io_service), socket(io_service) {}
+    tcp::acceptor acceptor;
+    tcp::socket socket;
+    HandlerMemory memory;
+  };
+
+  /*!
+  Accept all incoming connection of a shard, recursively (due to asynchronous design)
+  */
+  void do_accept(Shard& shard)
+  {
+    shard.acceptor.async_accept(shard.socket,
+        make_memory_handler(shard.memory, [this, &shard](boost::system::error_code ec)
+        {
+          if (ec == boost::asio::error::operation_aborted)
+            return;
+          if (!ec)
+            handler_(shard.socket);
+          //A moved from socket is ready for the next accept, one left open is not
+          if (shard.socket.is_open())
+            shard.socket.close();
+          do_accept(shard);
+        }));
+  }
+
+  Handler handler_; /*!< Called with every accepted socket */
+  std::vector< std::unique_ptr<Shard> > shards_; /*!< Listening sockets */
+};
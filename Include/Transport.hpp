@@ -0,0 +1,305 @@
+//
+// Transport.hpp
+// ~~~~~~~~~~~~~
+//
+// Endpoints named by URI, and the shared memory ring of the co-located clients.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#if !_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "Codec.h"
+#include "Message.hpp"
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#define PATCHWORK_HAS_LOCAL_TRANSPORT
+#endif
+
+/*! \file Transport.hpp
+\brief Transports between the server and its clients, chosen by the URI of the endpoint :
+
+tcp://host:port   TCP, the default : a bare port means tcp://127.0.0.1:port
+unix:///path      Unix-domain socket, for a client on the machine of the server
+shm:///path       Unix-domain socket, the client writing its big payloads in a shared memory ring
+
+A client connected through shm:// creates a shared memory segment and names it in its handshake (" shm=/name").
+A server reached through a Unix-domain socket maps it and names it back in its answer, after which the client writes the body
+of every big message in the ring and sends a RING frame instead : the type of the message, where its body is, and its length.
+The server handles the body in place as if it came in the frame, then releases its space. The frames keep the order of the messages,
+so the ring is released in order, and the client only needs the end of the last body released to know the free space.
+A full ring, or a payload too small to be worth it, goes through the socket as before.
+The bodies skip the socket buffers of the kernel : one copy on each side and no system call, whatever their size.
+PATCHWORK_HAS_LOCAL_TRANSPORT is defined where boost::asio has Unix-domain sockets, the ring needs POSIX shared memory besides.
+*/
+
+/*!
+Endpoint of a server, parsed from its URI
+*/
+struct Endpoint
+{
+  enum Scheme { TCP = 0, UNIX, SHM };
+
+  Endpoint()
+    : scheme(TCP), host("127.0.0.1"), port("8080")
+  {
+  }
+
+  /*!
+  Parse uri, a bare port meaning tcp://127.0.0.1:port. Return false if it is malformed.
+  */
+  static bool parse(const std::string& uri, Endpoint& endpoint)
+  {
+    std::size_t separator = uri.find("://");
+    if (separator == std::string::npos)
+    {
+      endpoint = Endpoint();
+      endpoint.port = uri;
+      return !uri.empty() && uri.find_first_not_of("0123456789") == std::string::npos;
+    }
+    std::string scheme = uri.substr(0, separator);
+    std::string rest = uri.substr(separator + 3);
+    if (scheme == "tcp")
+    {
+      std::size_t colon = rest.rfind(':');
+      if (colon == std::string::npos || colon == 0 || colon + 1 == rest.size())
+        return false;
+      endpoint.scheme = TCP;
+      endpoint.host = rest.substr(0, colon);
+      endpoint.port = rest.substr(colon + 1);
+      return true;
+    }
+    if ((scheme != "unix" && scheme != "shm") || rest.empty())
+      return false;
+    endpoint.scheme = scheme == "unix" ? UNIX : SHM;
+    endpoint.path = rest;
+    return true;
+  }
+
+  /*!
+  True for the transports of the clients on the machine of the server
+  */
+  bool local() const
+  {
+    return scheme != TCP;
+  }
+
+  Scheme scheme; /*!< Transport */
+  std::string host; /*!< Host of a TCP server */
+  std::string port; /*!< Port of a TCP server */
+  std::string path; /*!< Path of a Unix-domain socket */
+};
+
+/*!
+Ring in a shared memory segment, written by the client and read by the server.
+Positions count the bytes written since the creation of the ring, a body never wraps : it starts over at the beginning instead.
+The writer and the reader are each used by one thread at a time. Not available on Windows, where create and attach return null.
+*/
+class SharedRing
+{
+public:
+  enum { default_capacity = 64 * 1024 * 1024 };
+  enum { max_capacity = 1024 * 1024 * 1024 }; /*!< Biggest ring a server maps */
+  enum { min_payload = 16 * 1024 }; /*!< Smaller bodies go through the socket */
+
+  ~SharedRing()
+  {
+#if !_WIN32
+    if (header_)
+      munmap(header_, sizeof(Header) + capacity_);
+    if (owner_)
+      shm_unlink(name_.c_str());
+#endif
+  }
+
+  /*!
+  Create the ring of a client, of capacity bytes, return null if shared memory is not available
+  */
+  static std::unique_ptr<SharedRing> create(const std::string& name, std::size_t capacity = default_capacity)
+  {
+#if !_WIN32
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      return nullptr;
+    std::unique_ptr<SharedRing> ring(new SharedRing(name, true));
+    if (ftruncate(fd, sizeof(Header) + capacity) == 0)
+      ring->map(fd, capacity);
+    close(fd);
+    if (!ring->header_)
+      return nullptr;
+    new (ring->header_) Header();
+    ring->header_->capacity = capacity;
+    ring->header_->released = 0;
+    return ring;
+#else
+    return nullptr;
+#endif
+  }
+
+  /*!
+  Map the ring a client named in its handshake, return null if there is none
+  */
+  static std::unique_ptr<SharedRing> attach(const std::string& name)
+  {
+#if !_WIN32
+    if (name.empty() || name[0] != '/')
+      return nullptr;
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+      return nullptr;
+    std::unique_ptr<SharedRing> ring(new SharedRing(name, false));
+    Header header;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size > (off_t)sizeof(Header) && pread(fd, &header.capacity, sizeof(header.capacity), 0) == sizeof(header.capacity)
+        && header.capacity == (uint64_t)(size - sizeof(Header)) && header.capacity <= max_capacity)
+      ring->map(fd, (std::size_t)header.capacity);
+    close(fd);
+    if (!ring->header_)
+      return nullptr;
+    return ring;
+#else
+    (void)name;
+    return nullptr;
+#endif
+  }
+
+  /*!
+  Copy a body in the ring, return false if it is full. position tells where the body is.
+  */
+  bool write(const char* data, std::size_t length, uint64_t& position)
+  {
+    uint64_t start = written_;
+    std::size_t offset = (std::size_t)(start % capacity_);
+    if (offset + length > capacity_)
+      start += capacity_ - offset;
+    if (length > capacity_ || start + length - header_->released.load(std::memory_order_acquire) > capacity_)
+      return false;
+    std::memcpy(data_ + start % capacity_, data, length);
+    written_ = start + length;
+    position = start;
+    return true;
+  }
+
+  /*!
+  Forget the bodies written before, never read : a new connection starts with the whole ring free
+  */
+  void reset()
+  {
+    header_->released.store(written_, std::memory_order_release);
+  }
+
+  /*!
+  Body at position, null if it is out of the ring
+  */
+  const char* read(uint64_t position, uint64_t length) const
+  {
+    if (length > capacity_ || position % capacity_ + length > capacity_)
+      return nullptr;
+    return data_ + position % capacity_;
+  }
+
+  /*!
+  Give the space before end back to the writer, once the body there is handled
+  */
+  void release(uint64_t end)
+  {
+    header_->released.store(end, std::memory_order_release);
+  }
+
+  const std::string& name() const
+  {
+    return name_;
+  }
+
+  /*!
+  Part of the handshake naming the ring
+  */
+  static std::string handshake(const std::string& name)
+  {
+    return " shm=" + name;
+  }
+  /*!
+  Ring named in handshake, empty if none
+  */
+  static std::string name_in(const std::string& handshake)
+  {
+    std::size_t start = handshake.find(" shm=");
+    if (start == std::string::npos)
+      return std::string();
+    start += std::strlen(" shm=");
+    return handshake.substr(start, handshake.find(' ', start) - start);
+  }
+
+  /*!
+  Body of the RING frame standing for a message of type, whose body of length bytes is at position
+  */
+  static std::string reference(Message::Type type, uint64_t position, std::size_t length)
+  {
+    std::string body;
+    Patchwork::put_u8(body, (uint8_t)type);
+    Patchwork::put_varint(body, position);
+    Patchwork::put_varint(body, length);
+    return body;
+  }
+  /*!
+  Read a RING frame body written by reference, return false if it is malformed
+  */
+  static bool dereference(const char* body, std::size_t length, Message::Type& type, uint64_t& position, uint64_t& size)
+  {
+    Patchwork::ByteReader in(body, length);
+    uint8_t new_type;
+    if (!in.get_u8(new_type) || new_type >= Message::END_TYPE || new_type == Message::RING
+        || !in.get_varint(position) || !in.get_varint(size))
+      return false;
+    type = (Message::Type)new_type;
+    return true;
+  }
+
+private:
+  /*!
+  Start of the segment, the bodies follow it
+  */
+  struct Header
+  {
+    uint64_t capacity; /*!< Bytes of the ring, after the header */
+    std::atomic<uint64_t> released; /*!< End of the last body handled by the reader */
+  };
+
+  SharedRing(const std::string& name, bool owner)
+    : name_(name), owner_(owner), header_(nullptr), data_(nullptr), capacity_(0), written_(0)
+  {
+  }
+  SharedRing(const SharedRing&) = delete;
+  SharedRing& operator=(const SharedRing&) = delete;
+
+#if !_WIN32
+  void map(int fd, std::size_t capacity)
+  {
+    void* address = mmap(nullptr, sizeof(Header) + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED)
+      return;
+    header_ = static_cast<Header*>(address);
+    data_ = static_cast<char*>(address) + sizeof(Header);
+    capacity_ = capacity;
+  }
+#endif
+
+  std::string name_; /*!< Name of the segment */
+  bool owner_; /*!< True for the client, which removes the segment */
+  Header* header_; /*!< Mapping of the segment */
+  char* data_; /*!< The ring */
+  std::size_t capacity_; /*!< Size of the ring */
+  uint64_t written_; /*!< End of the last body written, for the writer */
+};
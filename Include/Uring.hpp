@@ -0,0 +1,645 @@
+//
+// Uring.hpp
+// ~~~~~~~~~
+//
+// io_uring transport for the server sessions, Linux only.
+//
+
+#pragma once
+
+/*! \file Uring.hpp
+\brief Sessions served through io_uring instead of the epoll reactor of boost::asio.
+
+An io_uring is a pair of rings shared with the kernel : the loop fills submission entries (accept, recv, sendmsg) and a single
+io_uring_enter submits all of them and waits for completions. A loop iteration thus costs one system call, whatever the number
+of connections having something to read or write, where the reactor makes one epoll_wait plus one read or write per ready socket.
+The rings are set up with the raw system calls, liburing is not needed.
+
+The sessions keep the same building blocks as the asio ones : a FrameReader receiving straight into its buffer, and a WriteQueue
+whose batches go in one sendmsg. The buffers are not registered with the kernel : the FrameReader buffers grow and move with the
+frame sizes, fixed buffers would cost a copy of every frame.
+
+PATCHWORK_HAS_IO_URING is defined where the kernel headers provide io_uring.
+*/
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PATCHWORK_HAS_IO_URING
+#endif
+#endif
+
+#ifdef PATCHWORK_HAS_IO_URING
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteQueue.hpp"
+
+/*!
+Submission and completion rings of one io_uring, used from a single thread
+*/
+class Uring
+{
+public:
+  /*!
+  Set up a ring of entries submission entries, ok() tells if the kernel allowed it
+  */
+  explicit Uring(unsigned int entries)
+    : fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+      sq_size_(0), cq_size_(0), sqes_size_(0), sqe_tail_(0), submitted_(0)
+  {
+    std::memset(&params_, 0, sizeof(params_));
+    fd_ = (int)syscall(__NR_io_uring_setup, entries, &params_);
+    if (fd_ < 0)
+      return;
+    sq_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+    cq_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params_.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    cq_ptr_ = single_mmap ? sq_ptr_ : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    sqes_size_ = params_.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes_ == MAP_FAILED)
+    {
+      unmap();
+      return;
+    }
+    char* sq = static_cast<char*>(sq_ptr_);
+    char* cq = static_cast<char*>(cq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+    sqe_tail_ = submitted_ = *sq_tail_;
+  }
+
+  ~Uring()
+  {
+    unmap();
+  }
+
+  Uring(const Uring&) = delete;
+  Uring& operator=(const Uring&) = delete;
+
+  bool ok() const
+  {
+    return fd_ >= 0;
+  }
+
+  /*!
+  Next free submission entry, cleared, submitting the queued ones first if the ring is full.
+  Null if the kernel does not take them.
+  */
+  io_uring_sqe* get_sqe()
+  {
+    if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= params_.sq_entries)
+      submit(0);
+    if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= params_.sq_entries)
+      return nullptr;
+    unsigned index = sqe_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    sqe_tail_++;
+    return sqe;
+  }
+
+  /*!
+  Submit every queued entry and wait for wait_nr completions, in one system call
+  */
+  int submit(unsigned int wait_nr)
+  {
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail_ - submitted_;
+    int ret = (int)syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (ret > 0)
+      submitted_ += ret;
+    return ret;
+  }
+
+  /*!
+  Call fn(user_data, result) for every completion available, return their number
+  */
+  template <typename Fn>
+  unsigned int reap(Fn fn)
+  {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+    for (; head != tail; ++head, ++count)
+    {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      uint64_t user_data = cqe.user_data;
+      int32_t res = cqe.res;
+      //Give the entry back before handling it, the handler may submit and wait
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      fn(user_data, res);
+    }
+    return count;
+  }
+
+private:
+  void unmap()
+  {
+    if (sqes_ != MAP_FAILED)
+      munmap(sqes_, sqes_size_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+      munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_ != MAP_FAILED)
+      munmap(sq_ptr_, sq_size_);
+    sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    sq_ptr_ = cq_ptr_ = MAP_FAILED;
+    if (fd_ >= 0)
+      close(fd_);
+    fd_ = -1;
+  }
+
+  int fd_; /*!< The io_uring */
+  io_uring_params params_; /*!< Sizes and offsets of the rings given by the kernel */
+  void* sq_ptr_; /*!< Mapping of the submission ring */
+  void* cq_ptr_; /*!< Mapping of the completion ring, the same as sq_ptr_ with IORING_FEAT_SINGLE_MMAP */
+  io_uring_sqe* sqes_; /*!< Submission entries */
+  std::size_t sq_size_; /*!< Size of the mapping of the submission ring */
+  std::size_t cq_size_; /*!< Size of the mapping of the completion ring */
+  std::size_t sqes_size_; /*!< Size of the mapping of the entries */
+  unsigned* sq_head_; /*!< Head of the submission ring, moved by the kernel */
+  unsigned* sq_tail_; /*!< Tail of the submission ring, moved by us */
+  unsigned sq_mask_; /*!< Index mask of the submission ring */
+  unsigned* sq_array_; /*!< Indices of the entries of the submission ring */
+  unsigned* cq_head_; /*!< Head of the completion ring, moved by us */
+  unsigned* cq_tail_; /*!< Tail of the completion ring, moved by the kernel */
+  unsigned cq_mask_; /*!< Index mask of the completion ring */
+  io_uring_cqe* cqes_; /*!< Completion entries */
+  unsigned sqe_tail_; /*!< Tail including the entries not yet published */
+  unsigned submitted_; /*!< Tail of the entries already submitted */
+};
+
+/*!
+Server accepting and serving its connections on one thread through an io_uring.
+The frames received are handed to a Handler, the messages to send are given to deliver() from any thread.
+*/
+class UringServer
+{
+public:
+  enum { default_entries = 4096 };
+
+  /*!
+  What the server reports, always called from the thread of run()
+  */
+  class Handler
+  {
+  public:
+    virtual ~Handler() {}
+    /*!
+    A connection was accepted, return where to account the lag of its queue (may be null)
+    */
+    virtual QueueStats* on_connect(uint64_t connection) = 0;
+    virtual void on_frame(uint64_t connection, Message::Type type, const char* body, std::size_t length) = 0;
+    /*!
+    The connection is closed, by the peer, an error, a bad frame or an overflow of its queue
+    */
+    virtual void on_close(uint64_t connection) = 0;
+  };
+
+  /*!
+  Listen on port of every interface (0 for any free port). ok() tells if the ring and the socket are ready.
+  Frames bigger than max_frame close the connection, and the write queues are bounded as asked by limit().
+  */
+  UringServer(unsigned short port, Handler& handler, std::size_t max_frame = Message::default_max_body_length,
+      unsigned int entries = default_entries)
+    : ring_(entries), handler_(handler), max_frame_(max_frame), listen_fd_(-1), wake_fd_(-1), wake_value_(0),
+      next_id_(1), stop_(false), max_messages_(0), max_bytes_(0), policy_(WriteQueue::DROP_OLDEST)
+  {
+    if (!ring_.ok())
+      return;
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listen_fd_, SOMAXCONN) < 0)
+    {
+      close(listen_fd_);
+      listen_fd_ = -1;
+      return;
+    }
+    wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  }
+
+  ~UringServer()
+  {
+    for (auto& connection : connections_)
+      close(connection.second->fd);
+    if (listen_fd_ >= 0)
+      close(listen_fd_);
+    if (wake_fd_ >= 0)
+      close(wake_fd_);
+  }
+
+  /*!
+  True if io_uring is available and the server listens
+  */
+  bool ok() const
+  {
+    return ring_.ok() && listen_fd_ >= 0 && wake_fd_ >= 0;
+  }
+
+  unsigned short port() const
+  {
+    sockaddr_in address;
+    socklen_t length = sizeof(address);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length);
+    return ntohs(address.sin_port);
+  }
+
+  /*!
+  Bound the write queue of the connections accepted from now on, see WriteQueue::limit
+  */
+  void limit(std::size_t max_messages, std::size_t max_bytes, WriteQueue::Overflow policy)
+  {
+    max_messages_ = max_messages;
+    max_bytes_ = max_bytes;
+    policy_ = policy;
+  }
+
+  /*!
+  Accept and serve the connections until stop()
+  */
+  void run()
+  {
+    current() = this;
+    submit_accept();
+    submit_wake();
+    while (!stop_)
+    {
+      ring_.submit(1);
+      ring_.reap([this](uint64_t user_data, int32_t res) { complete(user_data, res); });
+      retry();
+    }
+  }
+
+  /*!
+  Make run() return, from any thread
+  */
+  void stop()
+  {
+    stop_ = true;
+    wake();
+  }
+
+  /*!
+  Queue msg on the connection, from any thread. The message is shared and not copied.
+  */
+  void deliver(uint64_t connection, const Message_ptr& msg)
+  {
+    if (current() == this)
+    {
+      send(connection, msg);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(inbox_mutex_);
+      inbox_.push_back(std::make_pair(connection, msg));
+    }
+    wake();
+  }
+
+private:
+  enum Operation { RECV = 0, SEND = 1, ACCEPT = 2, WAKE = 3 };
+
+  /*!
+  A session : the socket, its receive buffer and write queue, and the operations in flight
+  */
+  struct Connection
+  {
+    Connection(int fd, std::size_t max_frame) : fd(fd), reader(max_frame), pending(0), sending(false), closing(false)
+    {
+      std::memset(&header, 0, sizeof(header));
+    }
+    int fd;
+    FrameReader reader;
+    WriteQueue writes;
+    std::vector<iovec> iov; /*!< Part of the batch not sent yet */
+    msghdr header; /*!< sendmsg header pointing to iov */
+    int pending; /*!< Operations in flight */
+    bool sending; /*!< True while a sendmsg is in flight */
+    bool closing; /*!< True once shut down, closed when nothing is in flight */
+  };
+
+  static uint64_t user_data(uint64_t connection, Operation op)
+  {
+    return (connection << 2) | op;
+  }
+
+  /*!
+  Server whose loop runs on the current thread, if any
+  */
+  static UringServer*& current()
+  {
+    static thread_local UringServer* server = nullptr;
+    return server;
+  }
+
+  /*!
+  Free submission entry for the operation data, null if the ring stays full : the operation is then deferred
+  until the next completions give entries back, see retry()
+  */
+  io_uring_sqe* get_sqe(uint64_t data)
+  {
+    io_uring_sqe* sqe = ring_.get_sqe();
+    if (!sqe)
+      deferred_.push_back(data);
+    return sqe;
+  }
+
+  /*!
+  Submit again the operations deferred by a full ring, those of a connection closed meanwhile are dropped
+  */
+  void retry()
+  {
+    if (deferred_.empty())
+      return;
+    std::vector<uint64_t> deferred;
+    deferred.swap(deferred_);
+    for (uint64_t data : deferred)
+    {
+      Operation op = static_cast<Operation>(data & 3);
+      uint64_t id = data >> 2;
+      if (op == ACCEPT || op == WAKE)
+      {
+        if (stop_)
+          continue;
+        if (op == ACCEPT)
+          submit_accept();
+        else
+          submit_wake();
+        continue;
+      }
+      auto it = connections_.find(id);
+      if (it == connections_.end())
+        continue;
+      Connection& connection = *it->second;
+      if (connection.closing)
+      {
+        //The deferred operation was the last one of the connection
+        if (connection.pending == 0)
+        {
+          close(connection.fd);
+          connections_.erase(it);
+          handler_.on_close(id);
+        }
+        continue;
+      }
+      if (op == RECV)
+        submit_recv(id, connection);
+      else
+        submit_send(id, connection);
+    }
+  }
+
+  void wake()
+  {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+      return;
+  }
+
+  void submit_accept()
+  {
+    io_uring_sqe* sqe = get_sqe(user_data(0, ACCEPT));
+    if (!sqe)
+      return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd_;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data(0, ACCEPT);
+  }
+
+  void submit_wake()
+  {
+    io_uring_sqe* sqe = get_sqe(user_data(0, WAKE));
+    if (!sqe)
+      return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wake_value_);
+    sqe->len = sizeof(wake_value_);
+    sqe->user_data = user_data(0, WAKE);
+  }
+
+  void submit_recv(uint64_t id, Connection& connection)
+  {
+    std::size_t space;
+    char* data = connection.reader.prepare(space);
+    io_uring_sqe* sqe = get_sqe(user_data(id, RECV));
+    if (!sqe)
+      return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = (uint32_t)space;
+    sqe->user_data = user_data(id, RECV);
+    connection.pending++;
+  }
+
+  void submit_send(uint64_t id, Connection& connection)
+  {
+    connection.header.msg_iov = connection.iov.data();
+    connection.header.msg_iovlen = connection.iov.size();
+    io_uring_sqe* sqe = get_sqe(user_data(id, SEND));
+    if (!sqe)
+      return;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = connection.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&connection.header);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data(id, SEND);
+    connection.pending++;
+    connection.sending = true;
+  }
+
+  /*!
+  Start sending the next batch of the queue
+  */
+  void send_batch(uint64_t id, Connection& connection)
+  {
+    connection.iov.clear();
+    for (const boost::asio::const_buffer& buffer : connection.writes.next_batch())
+    {
+      iovec v;
+      v.iov_base = const_cast<char*>(boost::asio::buffer_cast<const char*>(buffer));
+      v.iov_len = boost::asio::buffer_size(buffer);
+      connection.iov.push_back(v);
+    }
+    submit_send(id, connection);
+  }
+
+  void send(uint64_t id, const Message_ptr& msg)
+  {
+    auto it = connections_.find(id);
+    if (it == connections_.end() || it->second->closing)
+      return;
+    Connection& connection = *it->second;
+    bool idle = connection.writes.push(msg);
+    if (connection.writes.overflowed())
+      shutdown_connection(connection);
+    else if (idle)
+      send_batch(id, connection);
+  }
+
+  /*!
+  Stop the operations in flight, the connection is closed when the last one completes
+  */
+  void shutdown_connection(Connection& connection)
+  {
+    if (connection.closing)
+      return;
+    connection.closing = true;
+    shutdown(connection.fd, SHUT_RDWR);
+  }
+
+  void complete(uint64_t data, int32_t res)
+  {
+    Operation op = static_cast<Operation>(data & 3);
+    uint64_t id = data >> 2;
+    if (op == ACCEPT)
+    {
+      if (res >= 0)
+        accept(res);
+      if (!stop_)
+        submit_accept();
+      return;
+    }
+    if (op == WAKE)
+    {
+      std::vector< std::pair<uint64_t, Message_ptr> > inbox;
+      {
+        std::lock_guard<std::mutex> guard(inbox_mutex_);
+        inbox.swap(inbox_);
+      }
+      for (auto& item : inbox)
+        send(item.first, item.second);
+      if (!stop_)
+        submit_wake();
+      return;
+    }
+    auto it = connections_.find(id);
+    if (it == connections_.end())
+      return;
+    Connection& connection = *it->second;
+    connection.pending--;
+    if (op == RECV)
+      received(id, connection, res);
+    else
+      sent(id, connection, res);
+    if (connection.closing && connection.pending == 0)
+    {
+      close(connection.fd);
+      connections_.erase(it);
+      handler_.on_close(id);
+    }
+  }
+
+  void accept(int fd)
+  {
+    uint64_t id = next_id_++;
+    std::unique_ptr<Connection> connection(new Connection(fd, max_frame_));
+    QueueStats* stats = handler_.on_connect(id);
+    connection->writes.limit(max_messages_, max_bytes_, policy_, stats);
+    Connection& c = *connection;
+    connections_[id] = std::move(connection);
+    submit_recv(id, c);
+  }
+
+  void received(uint64_t id, Connection& connection, int32_t res)
+  {
+    if (res <= 0 || connection.closing)
+    {
+      shutdown_connection(connection);
+      return;
+    }
+    connection.reader.commit(res);
+    Message::Type type;
+    const char* body;
+    std::size_t length;
+    FrameReader::Status status;
+    while ((status = connection.reader.next(type, body, length)) == FrameReader::FRAME)
+      handler_.on_frame(id, type, body, length);
+    if (status == FrameReader::BAD_FRAME || connection.closing)
+    {
+      shutdown_connection(connection);
+      return;
+    }
+    submit_recv(id, connection);
+  }
+
+  void sent(uint64_t id, Connection& connection, int32_t res)
+  {
+    connection.sending = false;
+    if (res < 0 || connection.closing)
+    {
+      shutdown_connection(connection);
+      return;
+    }
+    //Skip what was written, a short write sends the rest of the batch
+    std::size_t written = res;
+    std::size_t i = 0;
+    while (i < connection.iov.size() && written >= connection.iov[i].iov_len)
+      written -= connection.iov[i++].iov_len;
+    connection.iov.erase(connection.iov.begin(), connection.iov.begin() + i);
+    if (!connection.iov.empty())
+    {
+      connection.iov[0].iov_base = static_cast<char*>(connection.iov[0].iov_base) + written;
+      connection.iov[0].iov_len -= written;
+      submit_send(id, connection);
+      return;
+    }
+    connection.writes.pop_batch();
+    if (!connection.writes.empty())
+      send_batch(id, connection);
+  }
+
+  Uring ring_; /*!< Rings shared with the kernel */
+  Handler& handler_; /*!< Receives the frames and the connection events */
+  std::size_t max_frame_; /*!< Biggest frame body accepted */
+  int listen_fd_; /*!< Listening socket */
+  int wake_fd_; /*!< eventfd waking the loop when messages are delivered from other threads */
+  uint64_t wake_value_; /*!< Where the loop reads wake_fd_ */
+  uint64_t next_id_; /*!< ID of the next connection, never reused */
+  std::atomic<bool> stop_; /*!< True once stop() was called */
+  std::unordered_map<uint64_t, std::unique_ptr<Connection> > connections_; /*!< Sessions by ID, only used from the loop */
+  std::mutex inbox_mutex_; /*!< Protects inbox_ */
+  std::vector< std::pair<uint64_t, Message_ptr> > inbox_; /*!< Messages delivered from other threads */
+  std::vector<uint64_t> deferred_; /*!< Operations which found the submission ring full, only used from the loop */
+  std::size_t max_messages_; /*!< Limit in messages of the write queues */
+  std::size_t max_bytes_; /*!< Limit in bytes of the write queues */
+  WriteQueue::Overflow policy_; /*!< Overflow policy of the write queues */
+};
+
+#endif
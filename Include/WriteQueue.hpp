@@ -0,0 +1,322 @@
+//
+// WriteQueue.hpp
+// ~~~~~~~~~~~~~~
+//
+// Queue of the frames waiting to be written on a connection.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Message.hpp"
+
+/*! \file WriteQueue.hpp
+\brief Queue of the messages to send on a connection, written in batches.
+
+Instead of one async_write per message, everything queued when a write starts goes in one async_write with a buffer
+sequence (a writev), up to max_batch_messages messages and max_batch_bytes bytes. A burst of N messages thus costs
+a few round trips through the reactor instead of N.
+The queue holds shared messages, so a message broadcast to many connections is never copied.
+Its storage is kept from one batch to the next, and a batch is handed to async_write as a view on it which asio copies cheaply :
+once warmed up, queuing and writing do not allocate.
+
+A queue may be bounded in messages and bytes, so that a client which stopped reading cannot grow the memory of the server.
+Past the limits, the overflow policy either drops the oldest messages that can be lost, or gives up on the connection.
+*/
+
+/*!
+Lag counters of one queue, readable from any thread
+*/
+struct QueueStats
+{
+  std::atomic<uint64_t> queued_bytes{ 0 }; /*!< Bytes waiting to be written */
+  std::atomic<uint64_t> peak_bytes{ 0 }; /*!< Most bytes ever waiting */
+  std::atomic<uint64_t> dropped{ 0 }; /*!< Messages dropped to stay within the limits */
+  std::atomic<uint64_t> coalesced{ 0 }; /*!< Messages removed because a newer one supersedes them */
+  std::atomic<uint64_t> overflows{ 0 }; /*!< Times the limits could not be kept */
+
+  /*!
+  True if the queue ever had to drop or coalesce a message, or overflowed
+  */
+  bool lagging() const
+  {
+    return dropped || coalesced || overflows;
+  }
+
+  void print(std::ostream& out) const
+  {
+    out << queued_bytes << " bytes queued (peak " << peak_bytes << "), " << dropped << " dropped, "
+      << coalesced << " coalesced, " << overflows << " overflows" << std::endl;
+  }
+};
+
+class WriteQueue
+{
+public:
+  enum { default_max_batch_messages = 64 };
+  enum { default_max_batch_bytes = 256 * 1024 };
+  /*!
+  What to do when a message makes the queue exceed its limits.
+  Only GET requests without ID and images may be lost : a newer one supersedes them.
+  Handshakes, sync messages and requests with an ID, whose reply is awaited, never are.
+  */
+  enum Overflow
+  {
+    DROP_OLDEST, /*!< Drop the oldest messages that may be lost */
+    COALESCE, /*!< Drop the queued messages superseded by the new one, then the oldest ones that may be lost */
+    DISCONNECT /*!< Keep everything, the connection is to be closed */
+  };
+
+  /*!
+  Buffer sequence of a batch, viewing the buffers held by the queue
+  */
+  class Batch
+  {
+  public:
+    typedef boost::asio::const_buffer value_type;
+    typedef const boost::asio::const_buffer* const_iterator;
+
+    Batch(const_iterator begin, const_iterator end)
+      : begin_(begin), end_(end)
+    {
+    }
+    const_iterator begin() const
+    {
+      return begin_;
+    }
+    const_iterator end() const
+    {
+      return end_;
+    }
+    std::size_t size() const
+    {
+      return end_ - begin_;
+    }
+    const boost::asio::const_buffer& operator[](std::size_t i) const
+    {
+      return begin_[i];
+    }
+
+  private:
+    const_iterator begin_;
+    const_iterator end_;
+  };
+
+  WriteQueue(std::size_t max_batch_messages = default_max_batch_messages,
+      std::size_t max_batch_bytes = default_max_batch_bytes)
+    : head_(0),
+      batch_size_(0),
+      max_batch_messages_(max_batch_messages),
+      max_batch_bytes_(max_batch_bytes),
+      max_messages_(0),
+      max_bytes_(0),
+      policy_(DROP_OLDEST),
+      overflowed_(false),
+      bytes_(0),
+      stats_(nullptr)
+  {
+  }
+
+  /*!
+  Bound the queue to max_messages messages and max_bytes bytes, zero meaning no limit, and account the lag in stats (may be null)
+  */
+  void limit(std::size_t max_messages, std::size_t max_bytes, Overflow policy, QueueStats* stats = nullptr)
+  {
+    max_messages_ = max_messages;
+    max_bytes_ = max_bytes;
+    policy_ = policy;
+    stats_ = stats;
+  }
+
+  /*!
+  Queue a message. Return true if the queue was idle, the caller should then start writing.
+  If the limits cannot be kept, overflowed() becomes true.
+  */
+  bool push(const Message_ptr& msg)
+  {
+    bool idle = empty();
+    if (policy_ == COALESCE && !critical(*msg))
+    {
+      //The batch being written is out of reach, only the messages after it are removed
+      for (std::size_t i = batch_size_; i < size();)
+      {
+        if (at(i)->type() == msg->type())
+          remove(i, stats_ ? &stats_->coalesced : nullptr);
+        else
+          ++i;
+      }
+    }
+    queue_.push_back(msg);
+    bytes_ += msg->length();
+    while (over_limits())
+    {
+      std::size_t i = batch_size_;
+      while (i < size() && (policy_ == DISCONNECT || critical(*at(i))))
+        ++i;
+      if (i == size())
+      {
+        overflow();
+        break;
+      }
+      remove(i, stats_ ? &stats_->dropped : nullptr);
+    }
+    account();
+    return idle;
+  }
+
+  bool push(Message&& msg)
+  {
+    return push(std::make_shared<const Message>(std::move(msg)));
+  }
+
+  bool empty() const
+  {
+    return size() == 0;
+  }
+
+  std::size_t size() const
+  {
+    return queue_.size() - head_;
+  }
+
+  /*!
+  Bytes waiting to be written, the batch being written included
+  */
+  std::size_t bytes() const
+  {
+    return bytes_;
+  }
+
+  /*!
+  True once a message could not be queued within the limits, the connection should be closed
+  */
+  bool overflowed() const
+  {
+    return overflowed_;
+  }
+
+  /*!
+  True if the message must be delivered : everything but images and GET requests without ID, which a newer one supersedes.
+  A GET with an ID is a request waiting for its reply (see Requests.hpp), dropping it would only make it time out.
+  */
+  static bool critical(const Message& msg)
+  {
+    return msg.type() != Message::IMAGE && (msg.type() != Message::GET || msg.body_length() != 0);
+  }
+
+  /*!
+  Buffers of the messages to write next, from the front of the queue.
+  A message bigger than max_batch_bytes still goes alone. The buffers stay valid until pop_batch.
+  */
+  Batch next_batch()
+  {
+    buffers_.clear();
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < size(); ++i)
+    {
+      const Message_ptr& msg = at(i);
+      if (!buffers_.empty() && (buffers_.size() == max_batch_messages_ || bytes + msg->length() > max_batch_bytes_))
+        break;
+      buffers_.push_back(boost::asio::buffer(msg->data(), msg->length()));
+      bytes += msg->length();
+    }
+    batch_size_ = buffers_.size();
+    return Batch(buffers_.data(), buffers_.data() + buffers_.size());
+  }
+
+  /*!
+  Remove the messages of the batch once written
+  */
+  void pop_batch()
+  {
+    for (std::size_t i = 0; i < batch_size_; ++i)
+    {
+      bytes_ -= at(i)->length();
+      queue_[head_ + i].reset();
+    }
+    head_ += batch_size_;
+    //Slide the messages left to the front once they are fewer than the written ones, keeping the capacity
+    if (head_ == queue_.size())
+    {
+      queue_.clear();
+      head_ = 0;
+    }
+    else if (head_ >= queue_.size() - head_)
+    {
+      queue_.erase(queue_.begin(), queue_.begin() + head_);
+      head_ = 0;
+    }
+    buffers_.clear();
+    batch_size_ = 0;
+    account();
+  }
+
+  /*!
+  Drop every message, the batch being written too, when the connection is replaced by a new one
+  */
+  void clear()
+  {
+    queue_.clear();
+    head_ = 0;
+    buffers_.clear();
+    batch_size_ = 0;
+    bytes_ = 0;
+    overflowed_ = false;
+    account();
+  }
+
+private:
+  const Message_ptr& at(std::size_t i) const
+  {
+    return queue_[head_ + i];
+  }
+
+  bool over_limits() const
+  {
+    return (max_messages_ && size() > max_messages_) || (max_bytes_ && bytes_ > max_bytes_);
+  }
+
+  /*!
+  Remove the i-th message, which is not in the batch being written, and count it
+  */
+  void remove(std::size_t i, std::atomic<uint64_t>* counter)
+  {
+    bytes_ -= at(i)->length();
+    queue_.erase(queue_.begin() + head_ + i);
+    if (counter)
+      (*counter)++;
+  }
+
+  void overflow()
+  {
+    if (!overflowed_ && stats_)
+      stats_->overflows++;
+    overflowed_ = true;
+  }
+
+  void account()
+  {
+    if (!stats_)
+      return;
+    stats_->queued_bytes = bytes_;
+    if (bytes_ > stats_->peak_bytes)
+      stats_->peak_bytes = bytes_;
+  }
+
+  std::vector<Message_ptr> queue_; /*!< Messages waiting to be written from head_, the batch being written first */
+  std::size_t head_; /*!< Index of the first message waiting in queue_, the ones before were written */
+  std::vector<boost::asio::const_buffer> buffers_; /*!< Buffer sequence of the batch being written */
+  std::size_t batch_size_; /*!< Number of messages in the batch being written */
+  std::size_t max_batch_messages_; /*!< Most messages written in one batch */
+  std::size_t max_batch_bytes_; /*!< Most bytes written in one batch */
+  std::size_t max_messages_; /*!< Most messages queued, zero for no limit */
+  std::size_t max_bytes_; /*!< Most bytes queued, zero for no limit */
+  Overflow policy_; /*!< What to do past the limits */
+  bool overflowed_; /*!< True once the limits could not be kept */
+  std::size_t bytes_; /*!< Bytes queued */
+  QueueStats* stats_; /*!< Where to account the lag, may be null */
+};
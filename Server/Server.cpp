@@ -8,21 +8,47 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
 #include <deque>
 #include <iostream>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <set>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include <stdio.h>
 #if _WIN32
 #include <tchar.h>
+#else
+#include <poll.h>
+#include <unistd.h>
 #endif
 #include <boost/asio.hpp>
 #include "Message.hpp"
+#include "FrameReader.hpp"
+#include "Handoff.hpp"
+#include "WriteQueue.hpp"
+#include "HandlerMemory.hpp"
+#include "Compression.hpp"
+#include "Handshake.hpp"
+#include "Journal.hpp"
+#include "Registry.hpp"
+#include "Relay.hpp"
+#include "Requests.hpp"
+#include "ShardedAcceptor.hpp"
+#include "Transport.hpp"
+#include "Uring.hpp"
 #include "Shape.h"
+#include "Sync.h"
 
 using boost::asio::ip::tcp;
 using namespace Patchwork;
@@ -33,21 +59,236 @@ using namespace Patchwork;
 */
 
 //----------------------------------------------------------------------
+class Room;
+class Rooms;
+class Federation;
 
-typedef std::deque<Message> Message_queue;
-
-//----------------------------------------------------------------------
 /*!
 Abstract class for handling Client.
-A client has an image and a unique ID associated to it.
+A client has an image and a unique ID associated to it, and joins the room named in its handshake.
+The protocol is handled here, the derived classes only move the frames : through boost::asio, or io_uring.
+A connection whose handshake comes from a peer server is a link of the Federation instead, carrying RELAY frames.
 */
-class ClientConnection
+class ClientConnection : public std::enable_shared_from_this<ClientConnection>
 {
 public:
+  enum { max_queued_messages = 1024 };
+  enum { max_pooled_acks = 4 }; /*!< Acknowledgments recycled by a client, more in flight are allocated */
+
+	/*!
+	Create a client of this ID, joining one of rooms. The compression is offered to it if offer_compression is true, and accounted in stats.
+	*/
+  ClientConnection(int ID, Rooms& rooms, CompressionStats& stats, bool offer_compression)
+    : ID(ID), peer(0), offer_compression_(offer_compression), rooms_(rooms)
+  {
+	  room = nullptr;
+	  pushing = false;
+	  img = new Image();
+	  //Stats and layout only need the index, the geometry is decoded when displayed
+	  img->lazy(true);
+	  compression.stats(&stats);
+  }
 	virtual ~ClientConnection() {}
-  virtual void deliver(const Message& msg) = 0;
+  virtual void deliver(const Message_ptr& msg) = 0;
+  /*!
+  Join the room of this name, the default room if empty.
+  A client with an identity first takes over the image of its mirror, if a peer replicated it here.
+  */
+  void enter(const std::string& name);
+  /*!
+  Leave the room joined, or the federation for a peer link. Called once the connection is closed, possibly more than once.
+  */
+  void leave();
+  /*!
+  Close the connection, from any thread : the client reconnects, to the server taking over from this one
+  */
+  virtual void disconnect()
+  {
+  }
+  /*!
+  True for the mirror of a client of a peer server
+  */
+  virtual bool remote() const
+  {
+	  return false;
+  }
+  /*!
+  True for a client on the machine of the server, which may share a memory ring with it
+  */
+  virtual bool colocated() const
+  {
+	  return false;
+  }
+  /*!
+  Analyze a message body.
+  If it is the handshake, join the room it names, negotiate the compression and answer it.
+  If it's a delta or an operation, apply it and acknowledge it, or ask for a reset. If it's a whole image, deserialize it.
+  If it's a RING frame, the body is in the shared memory ring of the client, see Transport.hpp.
+  If it's a reply, complete the request it answers, see Requests.hpp.
+  The changes are replicated to the peer servers.
+  The body is copied in a buffer kept from one frame to the next, frames are handled one at a time.
+  */
+  void handle_frame(Message::Type type, const char* body, std::size_t length)
+  {
+	if (type == Message::RING)
+	{
+		Message::Type inner;
+		uint64_t position, size;
+		const char* payload = nullptr;
+		if (ring_ && SharedRing::dereference(body, length, inner, position, size))
+			payload = ring_->read(position, size);
+		if (!payload)
+		{
+			std::cout << "Bad format : ring reference of client " << ID << std::endl;
+			return;
+		}
+		handle_frame(inner, payload, (std::size_t)size);
+		ring_->release(position + size);
+		return;
+	}
+	std::string& s = frame_;
+	s.assign(body, length);
+	uint64_t node;
+	if (type == Message::HELLO && !room && RelayRecord::peer(s, node))
+	{
+		//A server peering with this one, it never joins a room
+		peer = node;
+		linked();
+	}
+	else if (type == Message::RELAY)
+	{
+		if (peer)
+			relayed(s);
+	}
+	else if (type == Message::HELLO)
+	{
+		compression.negotiate(s, offer_compression_);
+		compression.flag(s);
+		Handshake received = Handshake::parse(s);
+		pushing = received.push;
+		if (!room)
+		{
+			identity = received.identity;
+			enter(received.room);
+		}
+		if (!ring_ && colocated())
+			ring_ = SharedRing::attach(SharedRing::name_in(s));
+		//The version of the image resumed, if any, tells the client what it does not need to send again
+		Handshake answer;
+		{
+			std::lock_guard<std::mutex> guard(img_mutex);
+			answer.version = sync.version();
+		}
+		std::string hello = answer.encode() + PayloadCompression::handshake(compression.enabled());
+		if (ring_)
+			hello += SharedRing::handshake(ring_->name());
+		deliver(std::make_shared<const Message>(Message::HELLO, hello));
+	}
+	else if (type == Message::SYNC || type == Message::OPERATION)
+	{
+		uint64_t version;
+		SyncReceiver::Status status;
+		bool unpacked = compression.unpack(s);
+		{
+			std::lock_guard<std::mutex> guard(img_mutex);
+			if (!unpacked)
+			{
+				//Rejected at the version held, so that the client sends the image whole
+				version = sync.version();
+				status = SyncReceiver::BAD_DELTA;
+			}
+			else
+			{
+				status = type == Message::SYNC ? sync.apply(*img, s, version) : sync.apply_operation(*img, s, version);
+			}
+		}
+		if (!unpacked)
+			std::cout << "Bad format : compressed payload of client " << ID << std::endl;
+		else if (status == SyncReceiver::BAD_DELTA)
+			std::cout << "Bad format : delta of client " << ID << std::endl;
+		else if (status == SyncReceiver::APPLIED)
+			replicate(type == Message::SYNC ? RelayRecord::SYNC : RelayRecord::OPERATION, s);
+		deliver(acknowledgment(version, status == SyncReceiver::APPLIED));
+	}
+	else if (type == Message::IMAGE && !compression.unpack(s))
+	{
+		std::cout << "Bad format : compressed payload of client " << ID << std::endl;
+	}
+	else if (type == Message::IMAGE)
+	{
+		{
+			std::lock_guard<std::mutex> guard(img_mutex);
+			img->deserialize(s);
+			sync.reset();
+		}
+		replicate(RelayRecord::IMAGE, s);
+	}
+	else if (type == Message::REPLY)
+	{
+		uint64_t id;
+		Requests::Status status;
+		std::string result;
+		if (Requests::parse_reply(s, id, status, result))
+			requests.complete(id, status, result);
+		else
+			std::cout << "Bad format : reply of client " << ID << std::endl;
+	}
+  }
   Image* img; /*!< The image linked to the client */
+  std::mutex img_mutex; /*!< Protects img, updated by the thread serving the client while the console reads it */
   int ID; /*!< unique ID identifying the client */
+  PayloadCompression compression; /*!< Compression negotiated with the client */
+  SyncReceiver sync; /*!< Version of img synchronized with the client */
+  std::atomic<bool> pushing; /*!< True if the client subscribed to push its changes, it is then never asked for them */
+  QueueStats lag; /*!< Lag counters of the messages sent to the client */
+  std::atomic<Room*> room; /*!< Room joined in the handshake, null before */
+  uint64_t peer; /*!< Node of the server at the other end if the connection is a link of the federation, 0 for a client */
+  std::string identity; /*!< Identity the client keeps across its connections, empty if it gave none */
+  Requests requests; /*!< Requests sent to the client, waiting for its replies */
+
+private:
+  /*!
+  SYNC_ACK of version, rewritten in a message of acks_ once the client was sent it : acknowledging does not allocate once warm.
+  Only called from the thread handling the frames, which is where the messages delivered to the client are released.
+  */
+  Message_ptr acknowledgment(uint64_t version, bool applied)
+  {
+	  std::string ack;
+	  put_varint(ack, version);
+	  put_u8(ack, applied ? 1 : 0);
+	  for (auto& pooled : acks_)
+	  {
+		  if (pooled.use_count() == 1)
+		  {
+			  pooled->body_length(ack.size());
+			  std::memcpy(pooled->body(), ack.data(), ack.size());
+			  pooled->encode_header();
+			  return pooled;
+		  }
+	  }
+	  if (acks_.size() == max_pooled_acks)
+		  return std::make_shared<const Message>(Message::SYNC_ACK, ack);
+	  acks_.push_back(std::make_shared<Message>(Message::SYNC_ACK, ack));
+	  return acks_.back();
+  }
+  /*!
+  Send a change of the image to the peer servers
+  */
+  void replicate(RelayRecord::Kind kind, const std::string& payload);
+  /*!
+  Become a link of the federation, once the peer handshake is received
+  */
+  void linked();
+  /*!
+  Apply a RELAY frame received from the peer
+  */
+  void relayed(const std::string& body);
+
+  bool offer_compression_; /*!< True if the server accepts to compress the payloads of this client */
+  Rooms& rooms_; /*!< Rooms of the server */
+  std::string frame_; /*!< Body of the frame being handled */
+  std::unique_ptr<SharedRing> ring_; /*!< Ring the client writes its big payloads in, if it shares one */
+  std::vector< std::shared_ptr<Message> > acks_; /*!< Acknowledgments recycled, see acknowledgment() */
 };
 
 typedef std::shared_ptr<ClientConnection> ClientConnection_ptr;
@@ -56,36 +297,126 @@ typedef std::shared_ptr<ClientConnection> ClientConnection_ptr;
 
 /*!
 The room is responsible for maintening an updated list of client and 
+Clients join and leave from any IO thread while the console reads the list, so it is read through snapshots (see Registry).
+Each client of a room keeps its own strand, so a room progresses on as many IO threads as it has clients.
 */
 class Room
 {
 public:
+	typedef Registry<ClientConnection>::Snapshot_ptr Participants;
+	/*!
+	Create the room of this name
+	*/
+  Room(const std::string& name)
+    : name_(name)
+  {
+  }
+  const std::string& name() const
+  {
+	  return name_;
+  }
 	/*!
 	Add participant to the room
 	*/
    void join(ClientConnection_ptr participant)
   {
-    participants_.insert(participant);
+    participants_.join(participant);
   }
    /*!
-   Delete participant from the room
+   Delete participant from the room, return false if it was not there
    */
-	void leave(ClientConnection_ptr participant)
+	bool leave(ClientConnection_ptr participant)
   {
-    participants_.erase(participant);
+    return participants_.leave(participant);
   }
 	/*!
-	Getter of participant list of the room
+	Getter of participant list of the room, by increasing ID, unchanged while clients come and go
 	*/
-  std::set<ClientConnection_ptr> participants()
+  Participants participants() const
   {
-	  return participants_;
+	  return participants_.snapshot();
+  }
+	/*!
+	Participant of this ID, null if none
+	*/
+  ClientConnection_ptr find(int ID) const
+  {
+	  return participants_.find(ID);
   }
 
 private:
-	std::set<ClientConnection_ptr> participants_;  /*!< List of participants */
+	std::string name_; /*!< Name given by the clients in their handshake */
+	Registry<ClientConnection> participants_;  /*!< List of participants */
 };
 
+/*!
+The rooms of the server by name, created when a client first names one.
+Rooms are never removed, so references to them stay valid as long as the server.
+*/
+class Rooms
+{
+public:
+  Rooms()
+    : federation_(nullptr)
+  {
+  }
+	/*!
+	Federation replicating the rooms, may be null
+	*/
+  Federation* federation() const
+  {
+	  return federation_;
+  }
+  void federation(Federation* federation)
+  {
+	  federation_ = federation;
+  }
+	/*!
+	Name of the room of the clients which do not name one
+	*/
+  static std::string default_name()
+  {
+	  return "default";
+  }
+	/*!
+	Room of this name, created if needed, the default room if name is empty
+	*/
+  Room& get(const std::string& name)
+  {
+	  std::lock_guard<std::mutex> guard(mutex_);
+	  std::unique_ptr<Room>& room = rooms_[name.empty() ? default_name() : name];
+	  if (!room)
+		  room.reset(new Room(name.empty() ? default_name() : name));
+	  return *room;
+  }
+	/*!
+	Room of this name, null if no client named it
+	*/
+  Room* find(const std::string& name)
+  {
+	  std::lock_guard<std::mutex> guard(mutex_);
+	  auto it = rooms_.find(name);
+	  return it == rooms_.end() ? nullptr : it->second.get();
+  }
+	/*!
+	Every room, by name
+	*/
+  std::vector<Room*> list()
+  {
+	  std::lock_guard<std::mutex> guard(mutex_);
+	  std::vector<Room*> rooms;
+	  for (auto& room : rooms_)
+		  rooms.push_back(room.second.get());
+	  return rooms;
+  }
+
+private:
+  std::mutex mutex_; /*!< Protects rooms_, clients join from every IO thread */
+  std::map< std::string, std::unique_ptr<Room> > rooms_; /*!< Rooms by name */
+  Federation* federation_; /*!< Replicates the rooms to the peer servers, may be null */
+};
+
+
 //----------------------------------------------------------------------
 
 
@@ -93,244 +424,1372 @@ private:
 The Client class handle the client, joining the room and being the one doing asynchronous operations.
 */
 class Client
-  : public ClientConnection,
-    public std::enable_shared_from_this<Client>
+  : public ClientConnection
 {
 public:
 	/*!
-	Create a client with an associated socket, room, image and ID
+	Create a client with an associated socket, image and ID, joining one of rooms.
+	The compression is offered to the client if offer_compression is true, and accounted in stats.
+	Frames bigger than max_frame close the connection.
+	The messages waiting for the client are bounded, overflow tells what to do when it does not read them fast enough.
+	The handlers of the client run in a strand of io_service : any IO thread may serve it, but one at a time.
+	The socket is a TCP or a Unix-domain one, see Transport.hpp.
 	*/
-  Client(tcp::socket socket, Room& room, int ID)
-    : socket_(std::move(socket)),
-      room_(room)
+  Client(boost::asio::generic::stream_protocol::socket socket, boost::asio::io_service& io_service, Rooms& rooms, int ID, CompressionStats& stats, bool offer_compression, std::size_t max_frame, WriteQueue::Overflow overflow)
+    : ClientConnection(ID, rooms, stats, offer_compression),
+      socket_(std::move(socket)),
+      strand_(io_service),
+	  reader_(max_frame)
   {
-	  this->ID = ID;
-	  img = new Image();
+	  compression.limit(max_frame);
+	  colocated_ = false;
+#ifdef PATCHWORK_HAS_LOCAL_TRANSPORT
+	  boost::system::error_code ec;
+	  colocated_ = socket_.local_endpoint(ec).protocol().family() == boost::asio::local::stream_protocol().family();
+#endif
+	  //Room for two images of the biggest size, the messages besides are small
+	  write_msgs_.limit(max_queued_messages, 2 * max_frame, overflow, &lag);
   }
   /*!
-  Join the room and try to read from the socket
+  Try to read from the socket, the room is joined with the handshake
   */
   void start()
   {
-    room_.join(shared_from_this());
-    do_read_header();
+    do_read();
+  }
+  /*!
+  True if the socket is a Unix-domain one
+  */
+  bool colocated() const
+  {
+	  return colocated_;
+  }
+  /*!
+  Write messages, the message is shared and not copied.
+  If the client lets its queue overflow, it is disconnected.
+  Called from any thread, the queue is only touched in the strand : from another thread the message waits in inbox_,
+  and the first one waiting posts a handler moving them all to the queue. That handler lives in deliver_memory_,
+  which is free again by the time the inbox is emptied, so delivering does not allocate once warm.
+  */
+  void deliver(const Message_ptr& msg)
+  {
+    if (strand_.running_in_this_thread())
+    {
+      queue(msg);
+      return;
+    }
+    std::lock_guard<std::mutex> guard(inbox_mutex_);
+    inbox_.push_back(msg);
+    if (inbox_.size() > 1)
+      return;
+    auto self(shared_from_this());
+    strand_.post(make_memory_handler(deliver_memory_, [this, self]()
+        {
+          {
+            std::lock_guard<std::mutex> guard(inbox_mutex_);
+            delivered_.swap(inbox_);
+          }
+          for (auto& msg : delivered_)
+            queue(msg);
+          delivered_.clear();
+        }));
+  }
+  /*!
+  Close the socket in the strand, the pending read fails and leaves the room
+  */
+  void disconnect()
+  {
+    auto self(shared_from_this());
+    strand_.dispatch(
+        [this, self]()
+        {
+          boost::system::error_code ignored;
+          socket_.close(ignored);
+        });
   }
+
+private:
   /*!
-  Write messages
+  Add a message to the queue, in the strand, and start writing if the queue was idle
   */
-  void deliver(const Message& msg)
+  void queue(const Message_ptr& msg)
   {
-    bool write_in_progress = !write_msgs_.empty();
-    write_msgs_.push_back(msg);
-    if (!write_in_progress)
+    if (write_msgs_.overflowed())
+      return;
+    bool idle = write_msgs_.push(msg);
+    if (write_msgs_.overflowed())
+    {
+      //The client does not read, give up on it rather than queue without limit.
+      //Its pending read fails and leaves the room : the caller may hold the federation, which leaving takes.
+      std::cout << "Client " << ID << " is too slow, disconnected" << std::endl;
+      socket_.close();
+    }
+    else if (idle)
     {
       do_write();
     }
   }
-
-private:
 	/*!
-	Read from the socket into a buffer and analyze our message header, then ask to read the message's body
+	Read whatever the socket has into the receive buffer, handle every complete frame it holds, then read again (due to asynchronous design)
+	*/
+  void do_read()
+  {
+    auto self(shared_from_this());
+    std::size_t space;
+    char* data = reader_.prepare(space);
+    socket_.async_read_some(boost::asio::buffer(data, space),
+        strand_.wrap(make_memory_handler(read_memory_, [this, self](boost::system::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            reader_.commit(length);
+            Message::Type type;
+            const char* body;
+            std::size_t body_length;
+            FrameReader::Status status;
+            while ((status = reader_.next(type, body, body_length)) == FrameReader::FRAME)
+            {
+              handle_frame(type, body, body_length);
+            }
+            if (status == FrameReader::BAD_FRAME)
+            {
+              leave();
+              return;
+            }
+            do_read();
+          }
+          else
+          {
+            leave();
+          }
+        })));
+  }
+  /*!
+  Write the queued messages to the socket in one batch, then ask to write again if some writes are needed to be done (due to asychronous design)
+  */
+  void do_write()
+  {
+    auto self(shared_from_this());
+    boost::asio::async_write(socket_,
+        write_msgs_.next_batch(),
+        strand_.wrap(make_memory_handler(write_memory_, [this, self](boost::system::error_code ec, std::size_t /*length*/)
+        {
+          if (!ec)
+          {
+            write_msgs_.pop_batch();
+            if (!write_msgs_.empty())
+            {
+              do_write();
+            }
+          }
+          else
+          {
+            leave();
+          }
+        })));
+  }
+
+  boost::asio::generic::stream_protocol::socket socket_; /*!< boost:asio socket, TCP or Unix-domain */
+  bool colocated_; /*!< True for a Unix-domain socket */
+  boost::asio::io_service::strand strand_; /*!< Serializes the handlers of the client, whichever IO thread runs them */
+  FrameReader reader_; /*!< Receive buffer, holding the frames being read */
+  WriteQueue write_msgs_; /*!< A list of message de send (due to asynchronous design) */
+  HandlerMemory read_memory_; /*!< Recycled for every read of the socket */
+  HandlerMemory write_memory_; /*!< Recycled for every write to the socket */
+  std::mutex inbox_mutex_; /*!< Protects inbox_ */
+  std::vector<Message_ptr> inbox_; /*!< Messages delivered from outside the strand, waiting to be queued */
+  std::vector<Message_ptr> delivered_; /*!< Messages taken from inbox_ by the strand, kept to reuse its capacity */
+  HandlerMemory deliver_memory_; /*!< Recycled for the handler moving inbox_ to the queue, allocated with inbox_mutex_ held */
+};
+
+#ifdef PATCHWORK_HAS_IO_URING
+/*!
+Client served by an UringServer, which owns its socket and queue
+*/
+class UringClient : public ClientConnection
+{
+public:
+  UringClient(UringServer& server, uint64_t connection, int ID, Rooms& rooms, CompressionStats& stats, bool offer_compression, std::size_t max_frame)
+    : ClientConnection(ID, rooms, stats, offer_compression), server_(server), connection_(connection)
+  {
+	  compression.limit(max_frame);
+  }
+  /*!
+  Write messages, the message is shared and not copied. Called from any thread.
+  */
+  void deliver(const Message_ptr& msg)
+  {
+    server_.deliver(connection_, msg);
+  }
+
+private:
+  UringServer& server_; /*!< Server owning the connection */
+  uint64_t connection_; /*!< Connection of the client in server_ */
+};
+#endif
+
+//----------------------------------------------------------------------
+
+/*!
+Mirror of a client of a peer server : it joins the room of the original so that the commands see the whole room,
+and its image follows the changes relayed by the peer. Nothing is sent to it, the peer serves the original.
+*/
+class RemoteClient : public ClientConnection
+{
+public:
+  RemoteClient(int ID, Rooms& rooms, CompressionStats& stats, uint64_t node, int client)
+    : ClientConnection(ID, rooms, stats, false), node(node), client(client), resyncing(false)
+  {
+  }
+  void deliver(const Message_ptr& /*msg*/)
+  {
+  }
+  bool remote() const
+  {
+	  return true;
+  }
+
+  uint64_t node; /*!< Server of the original */
+  int client; /*!< ID of the original on node */
+  bool resyncing; /*!< True while a snapshot is asked for, so that it is asked once. Protected by img_mutex */
+};
+
+/*!
+Replication of the rooms with the peer servers, see Relay.hpp.
+Links are the connections to the peers, dialed or accepted : every change of a local client goes to all of them,
+and the changes coming from a peer are applied to the mirrors of its clients. Every server links to every other one, nothing is forwarded.
+Used from the threads of the links and of the clients. One mutex protects the links, the clients and the mirrors :
+the images are encoded and applied under their own locks, after it is released. It is always taken before the lock of an image.
+*/
+class Federation
+{
+public:
+  enum { redial_delay = 1000 }; /*!< Milliseconds before dialing a peer again */
+
+	/*!
+	Federation of the clients of rooms, whose mirrors take their ID from ids.
+	The links are served by io_service like the clients, with their frames bounded by max_frame.
+	*/
+  Federation(boost::asio::io_service& io_service, Rooms& rooms, std::atomic<int>& ids, CompressionStats& stats, std::size_t max_frame)
+    : io_service_(io_service), rooms_(rooms), ids_(ids), stats_(stats), max_frame_(max_frame), standby_(false), resumed_(0), journal_(nullptr),
+      taking_over_(false), dumping_(false), sequence_(0)
+  {
+	  std::random_device random;
+	  node_ = (uint64_t)random() << 32 | random();
+	  if (node_ == 0)
+		  node_ = 1;
+  }
+  uint64_t node() const
+  {
+	  return node_;
+  }
+	/*!
+	Link to the server listening at host:port, and link again whenever the link drops, until the server stops
+	*/
+  void dial(const std::string& host, const std::string& port)
+  {
+	  auto resolver = std::make_shared<tcp::resolver>(io_service_);
+	  resolver->async_resolve(tcp::resolver::query(host, port),
+		  [this, resolver, host, port](boost::system::error_code ec, tcp::resolver::iterator endpoints)
+	  {
+		  if (ec)
+		  {
+			  redial(host, port);
+			  return;
+		  }
+		  auto socket = std::make_shared<tcp::socket>(io_service_);
+		  boost::asio::async_connect(*socket, endpoints,
+			  [this, socket, host, port](boost::system::error_code ec, tcp::resolver::iterator)
+		  {
+			  if (ec)
+			  {
+				  redial(host, port);
+				  return;
+			  }
+			  auto link = std::make_shared<Client>(std::move(*socket), io_service_, rooms_, ids_++, stats_, false, max_frame_, WriteQueue::DISCONNECT);
+			  {
+				  std::lock_guard<std::mutex> guard(mutex_);
+				  dialed_[link.get()] = std::make_pair(host, port);
+			  }
+			  link->deliver(std::make_shared<const Message>(Message::HELLO, RelayRecord::handshake(node_)));
+			  link->start();
+		  });
+	  });
+  }
+	/*!
+	Take link as a connection to the peer node, once its handshake is received.
+	The accepting side answers the handshake, then both sides send the snapshots of their clients.
+	*/
+  void link(const ClientConnection_ptr& link, uint64_t node)
+  {
+	  std::vector<ClientConnection_ptr> locals;
+	  {
+		  std::lock_guard<std::mutex> guard(mutex_);
+		  if (node == node_)
+		  {
+			  std::cout << "Peer " << link->ID << " is this server, ignored" << std::endl;
+			  return;
+		  }
+		  if (!dialed_.count(link.get()))
+			  link->deliver(std::make_shared<const Message>(Message::HELLO, RelayRecord::handshake(node_)));
+		  links_.push_back(link);
+		  if (!lags_[node])
+			  lags_[node].reset(new ReplicationLag());
+		  std::cout << "Linked to node " << node << std::endl;
+		  for (auto& local : locals_)
+			  locals.push_back(local.second);
+	  }
+	  //The snapshots are not numbered and are encoded without holding the federation.
+	  //A record published meanwhile may reach the peer before the snapshot of its client : the peer then asks for another one.
+	  for (auto& local : locals)
+		  link->deliver(message(snapshot(*local)));
+  }
+	/*!
+	Forget link, closed. The mirrors of its node go when no other link to the node is left, and a dialed link is dialed again.
+	*/
+  void unlink(ClientConnection& link)
+  {
+	  std::lock_guard<std::mutex> guard(mutex_);
+	  auto it = std::find_if(links_.begin(), links_.end(), [&](const ClientConnection_ptr& l) { return l.get() == &link; });
+	  if (it != links_.end())
+	  {
+		  links_.erase(it);
+		  std::cout << "Unlinked from node " << link.peer << std::endl;
+		  bool linked = std::any_of(links_.begin(), links_.end(), [&](const ClientConnection_ptr& l) { return l->peer == link.peer; });
+		  if (!linked && standby_)
+		  {
+			  //Promoted : the clients of the node resume here, their mirrors stay until then
+			  std::size_t kept = std::count_if(mirrors_.begin(), mirrors_.end(),
+				  [&](const std::pair< const std::pair<uint64_t, int>, std::shared_ptr<RemoteClient> >& mirror) { return mirror.first.first == link.peer; });
+			  std::cout << "Node " << link.peer << " is down, " << kept << " of its clients may resume here" << std::endl;
+			  lags_[link.peer]->sequence = 0;
+		  }
+		  else if (!linked)
+		  {
+			  for (auto mirror = mirrors_.begin(); mirror != mirrors_.end();)
+			  {
+				  if (mirror->first.first == link.peer)
+				  {
+					  mirror->second->leave();
+					  mirror = mirrors_.erase(mirror);
+				  }
+				  else
+				  {
+					  ++mirror;
+				  }
+			  }
+			  //The node may restart with the same ID, which starts its numbering over
+			  lags_[link.peer]->sequence = 0;
+		  }
+	  }
+	  auto dialed = dialed_.find(&link);
+	  if (dialed != dialed_.end())
+	  {
+		  redial(dialed->second.first, dialed->second.second);
+		  dialed_.erase(dialed);
+	  }
+  }
+	/*!
+	Keep the mirrors of the peers whose links drop, for their clients to resume here : the server is the standby of its peers
+	*/
+  void standby(bool standby)
+  {
+	  standby_ = standby;
+  }
+	/*!
+	Called with the whole image of every client handing over to another server
+	*/
+  typedef std::function<void(const RelayRecord&)> Successor;
+
+	/*!
+	Store the changes of the clients in journal, set before the server starts
+	*/
+  void journal(Journal* journal)
+  {
+	  journal_ = journal;
+  }
+	/*!
+	Hand the clients over to successor : every client from now on goes to it when it leaves.
+	Nothing is stored or resumed here any more : return the journal, whose images the caller sends to the successor, null if none.
+	*/
+  Journal* hand_off(Successor successor)
+  {
+	  std::lock_guard<std::mutex> guard(mutex_);
+	  Journal* journal = journal_;
+	  journal_ = nullptr;
+	  successor_ = successor;
+	  return journal;
+  }
+	/*!
+	Take over from a previous server : its images come through restore(), and none is given back before dumped() is called
+	*/
+  void take_over()
+  {
+	  std::lock_guard<std::mutex> guard(mutex_);
+	  taking_over_ = true;
+	  dumping_ = true;
+  }
+	/*!
+	Every image stored by the previous server was restored, or it is gone : the clients waiting in adopt() go on
+	*/
+  void dumped()
+  {
+	  {
+		  std::lock_guard<std::mutex> guard(mutex_);
+		  dumping_ = false;
+	  }
+	  dump_done_.notify_all();
+  }
+	/*!
+	Keep record, an image of a client of the previous server, for the client to resume it here.
+	Return false if the client already reconnected here : its image is then newer, and the record is dropped.
+	*/
+  bool restore(const RelayRecord& record)
+  {
+	  Journal* journal;
+	  {
+		  std::lock_guard<std::mutex> guard(mutex_);
+		  if (!journal_ || arrived_.count(record.identity))
+			  return false;
+		  journal = journal_;
+		  //Parked under the lock, so that the client coming back finds it
+		  journal->park(record);
+	  }
+	  journal->append(record);
+	  return true;
+  }
+	/*!
+	Give client the image of the mirror of the same identity, if a peer replicated it here, else the image stored in the journal for it :
+	the client resumes it without sending it again. Return false if there is none.
+	A stored image is taken out of the journal under the lock, and replayed once it is released : the clients reconnecting together
+	after a restart do not wait for each other's image to be rebuilt.
+	*/
+  bool adopt(ClientConnection& client)
+  {
+	  std::shared_ptr<const Journal::StoredImage> stored;
+	  {
+		  std::unique_lock<std::mutex> guard(mutex_);
+		  //The image of the client may still be on its way from the previous server
+		  dump_done_.wait(guard, [this]() { return !dumping_; });
+		  if (taking_over_)
+			  arrived_.insert(client.identity);
+		  auto it = std::find_if(mirrors_.begin(), mirrors_.end(),
+			  [&](const std::pair< const std::pair<uint64_t, int>, std::shared_ptr<RemoteClient> >& mirror) { return mirror.second->identity == client.identity; });
+		  if (it != mirrors_.end())
+		  {
+			  RemoteClient& mirror = *it->second;
+			  {
+				  std::lock(client.img_mutex, mirror.img_mutex);
+				  std::lock_guard<std::mutex> client_guard(client.img_mutex, std::adopt_lock);
+				  std::lock_guard<std::mutex> mirror_guard(mirror.img_mutex, std::adopt_lock);
+				  std::swap(client.img, mirror.img);
+				  client.sync = mirror.sync;
+			  }
+			  std::cout << "Client " << client.ID << " resumes client " << mirror.client << " of node " << mirror.node << std::endl;
+			  mirror.leave();
+			  mirrors_.erase(it);
+			  resumed_++;
+			  return true;
+		  }
+		  if (journal_)
+			  stored = journal_->take(client.identity);
+	  }
+	  if (!stored)
+		  return false;
+	  {
+		  std::lock_guard<std::mutex> img_guard(client.img_mutex);
+		  Journal::replay(*stored, *client.img, client.sync);
+	  }
+	  std::cout << "Client " << client.ID << " resumes its stored image" << std::endl;
+	  resumed_++;
+	  return true;
+  }
+	/*!
+	Number client's change, store it in the journal and send it to every link.
+	The images are encoded and the journal written without holding the federation : only the numbering, the clients and the links need it.
+	*/
+  void publish(ClientConnection& client, RelayRecord record)
+  {
+	  if (record.kind == RelayRecord::JOIN)
+	  {
+		  std::lock_guard<std::mutex> img_guard(client.img_mutex);
+		  client.sync.snapshot(*client.img, record.payload);
+	  }
+	  //The image of a client leaving is kept, for it to resume it here or on the successor
+	  bool parking = record.kind == RelayRecord::LEAVE && !client.identity.empty();
+	  RelayRecord parked;
+	  if (parking)
+		  parked = snapshot(client);
+	  Journal* journal;
+	  Successor successor;
+	  bool compacting = false;
+	  std::vector<Journal::Snapshotter> live;
+	  {
+		  std::lock_guard<std::mutex> guard(mutex_);
+		  if (record.kind == RelayRecord::JOIN)
+			  locals_[client.ID] = client.shared_from_this();
+		  else if (record.kind == RelayRecord::LEAVE)
+			  locals_.erase(client.ID);
+		  record.node = node_;
+		  record.sequence = ++sequence_;
+		  record.sent_at = RelayRecord::now();
+		  record.identity = client.identity;
+		  journal = journal_;
+		  //Parked under the lock, so that the client coming back finds it
+		  if (journal && parking)
+			  journal->park(parked);
+		  else if (parking)
+			  successor = successor_;
+		  if (journal && journal->compaction_due())
+		  {
+			  compacting = true;
+			  live = snapshotters();
+		  }
+		  if (!links_.empty())
+		  {
+			  Message_ptr msg = message(record);
+			  for (auto& link : links_)
+				  link->deliver(msg);
+		  }
+	  }
+	  //The successor may be slow to read, the record is sent without holding the federation
+	  if (successor)
+		  successor(parked);
+	  if (!journal)
+		  return;
+	  journal->append(record);
+	  if (compacting)
+		  journal->compact(live);
+  }
+	/*!
+	Apply the record of body, received from link.
+	The federation is only held to number the record and find its mirror, the image of the mirror is changed under its own lock.
+	*/
+  void receive(ClientConnection& link, const std::string& body)
+  {
+	  RelayRecord record;
+	  if (!record.decode(body.data(), body.size()))
+	  {
+		  std::cout << "Bad format : relay of node " << link.peer << std::endl;
+		  return;
+	  }
+	  if (record.kind == RelayRecord::RESYNC)
+	  {
+		  ClientConnection_ptr local;
+		  {
+			  std::lock_guard<std::mutex> guard(mutex_);
+			  auto it = locals_.find(record.client);
+			  if (it != locals_.end())
+				  local = it->second;
+		  }
+		  if (local)
+			  link.deliver(message(snapshot(*local)));
+		  return;
+	  }
+	  ReplicationLag* lag;
+	  std::shared_ptr<RemoteClient> mirror;
+	  std::unique_lock<std::mutex> img_guard;
+	  {
+		  std::lock_guard<std::mutex> guard(mutex_);
+		  std::unique_ptr<ReplicationLag>& node_lag = lags_[record.node];
+		  if (!node_lag)
+			  node_lag.reset(new ReplicationLag());
+		  //Never erased, it outlives the lock
+		  lag = node_lag.get();
+		  //Already applied, received twice when the peers link both ways
+		  if (record.sequence && record.sequence <= lag->sequence)
+			  return;
+		  lag->account(record, RelayRecord::now());
+
+		  auto key = std::make_pair(record.node, record.client);
+		  auto it = mirrors_.find(key);
+		  if (it == mirrors_.end())
+		  {
+			  if (record.kind == RelayRecord::LEAVE)
+				  return;
+			  if (record.room.empty())
+			  {
+				  //The join was missed, only a snapshot tells the room
+				  if (asked_.insert(key).second)
+					  resync(link, record, *lag);
+				  return;
+			  }
+			  asked_.erase(key);
+			  auto created = std::make_shared<RemoteClient>(ids_++, rooms_, stats_, record.node, record.client);
+			  created->identity = record.identity;
+			  it = mirrors_.insert(std::make_pair(key, created)).first;
+			  created->enter(record.room);
+		  }
+		  if (record.kind == RelayRecord::LEAVE)
+		  {
+			  it->second->leave();
+			  mirrors_.erase(it);
+			  return;
+		  }
+		  mirror = it->second;
+		  //Locked before the federation is released, so that the records of a mirror are applied in the order they are numbered
+		  img_guard = std::unique_lock<std::mutex>(mirror->img_mutex);
+	  }
+	  bool resyncing = false;
+	  switch (record.kind)
+	  {
+		  case RelayRecord::JOIN:
+		  {
+			  //The client resumed an image, which comes as a snapshot
+			  if (!record.payload.empty())
+			  {
+				  uint64_t version;
+				  mirror->sync.apply(*mirror->img, record.payload, version);
+			  }
+		  }break;
+
+		  case RelayRecord::SYNC:
+		  case RelayRecord::OPERATION:
+		  {
+			  uint64_t version;
+			  //Already in a snapshot sent just before
+			  if (mirror->sync.version() >= SyncReceiver::version_of(record.payload))
+				  break;
+			  SyncReceiver::Status status = record.kind == RelayRecord::SYNC ? mirror->sync.apply(*mirror->img, record.payload, version)
+				  : mirror->sync.apply_operation(*mirror->img, record.payload, version);
+			  if (status != SyncReceiver::APPLIED && !mirror->resyncing)
+			  {
+				  mirror->resyncing = true;
+				  resyncing = true;
+			  }
+		  }break;
+
+		  case RelayRecord::IMAGE:
+		  {
+			  mirror->img->deserialize(record.payload);
+			  mirror->sync.reset();
+			  mirror->resyncing = false;
+		  }break;
+
+		  case RelayRecord::SNAPSHOT:
+		  {
+			  //A snapshot older than the mirror, sent before the deltas already applied, is skipped
+			  uint64_t version = SyncReceiver::version_of(record.payload);
+			  if (mirror->sync.version() < version)
+				  mirror->sync.apply(*mirror->img, record.payload, version);
+			  mirror->resyncing = false;
+		  }break;
+
+		  default:
+			  break;
+	  }
+	  img_guard.unlock();
+	  if (resyncing)
+		  resync(link, record, *lag);
+  }
+	/*!
+	Print the node, its links and the lag of the records of each peer
+	*/
+  void print(std::ostream& out)
+  {
+	  std::lock_guard<std::mutex> guard(mutex_);
+	  out << "Node " << node_ << (standby_ ? " (standby)" : "") << " : " << links_.size() << " peer links, " << mirrors_.size() << " remote clients, "
+		  << resumed_ << " resumed, " << sequence_ << " records sent" << std::endl;
+	  if (journal_)
+		  journal_->stats().print(out);
+	  for (auto& lag : lags_)
+	  {
+		  out << "From node " << lag.first << " : ";
+		  lag.second->print(out);
+	  }
+	  for (auto& link : links_)
+	  {
+		  if (link->lag.lagging())
+		  {
+			  out << "To node " << link->peer << " lagging : ";
+			  link->lag.print(out);
+		  }
+	  }
+  }
+
+private:
+	/*!
+	Snapshots of the connected clients, to compact the journal. The caller holds the lock.
+	*/
+  std::vector<Journal::Snapshotter> snapshotters()
+  {
+	  std::vector<Journal::Snapshotter> live;
+	  for (auto& local : locals_)
+	  {
+		  ClientConnection_ptr connected = local.second;
+		  live.push_back([this, connected](RelayRecord& record)
+		  {
+			  record = snapshot(*connected);
+			  return true;
+		  });
+	  }
+	  return live;
+  }
+  static Message_ptr message(const RelayRecord& record)
+  {
+	  std::string body;
+	  record.encode(body);
+	  return std::make_shared<const Message>(Message::RELAY, body);
+  }
+	/*!
+	Record holding the whole image of client, not numbered : a reset delta at its version, or its image if it has none
 	*/
-  void do_read_header()
+  RelayRecord snapshot(ClientConnection& client)
   {
-    auto self(shared_from_this());
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.data(), Message::header_length),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/)
-        {
-          if (!ec && read_msg_.decode_header())
-          {
-            do_read_body();
-          }
-          else
-          {
-            room_.leave(shared_from_this());
-          }
-        });
+	  RelayRecord record(RelayRecord::SNAPSHOT, client.ID);
+	  record.node = node_;
+	  record.sent_at = RelayRecord::now();
+	  record.identity = client.identity;
+	  Room* joined = client.room;
+	  if (joined)
+		  record.room = joined->name();
+	  std::lock_guard<std::mutex> guard(client.img_mutex);
+	  if (!client.sync.snapshot(*client.img, record.payload))
+	  {
+		  record.kind = RelayRecord::IMAGE;
+		  record.payload.clear();
+		  client.img->serialize_binary(record.payload);
+	  }
+	  return record;
   }
-  /*!
-  Read from the socket into a buffer and analyze our message body, then start again to read from the socket is some reads are needed to be done (due to asynchronous design)
-  If it has something to read, it's an image so it deserialize it
-  */
-  void do_read_body()
+	/*!
+	Ask link for a snapshot of the client of record
+	*/
+  void resync(ClientConnection& link, const RelayRecord& record, ReplicationLag& lag)
   {
-    auto self(shared_from_this());
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.body(), read_msg_.body_length()),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/)
-        {
-          if (!ec)
-          {
-			std::string s = std::string(read_msg_.body());
-			img->deserialize(s);
-            do_read_header();
-          }
-          else
-          {
-            room_.leave(shared_from_this());
-          }
-        });
+	  lag.resyncs++;
+	  RelayRecord ask(RelayRecord::RESYNC, record.client);
+	  ask.node = node_;
+	  ask.sent_at = RelayRecord::now();
+	  link.deliver(message(ask));
   }
-  /*!
-  Write to the socket, then ask to write again if some writes are needed to be done (due to asychronous design)
-  */
-  void do_write()
+  void redial(const std::string& host, const std::string& port)
   {
-    auto self(shared_from_this());
-    boost::asio::async_write(socket_,
-        boost::asio::buffer(write_msgs_.front().data(),
-          write_msgs_.front().length()),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/)
-        {
-          if (!ec)
-          {
-            write_msgs_.pop_front();
-            if (!write_msgs_.empty())
-            {
-              do_write();
-            }
-          }
-          else
-          {
-            room_.leave(shared_from_this());
-          }
-        });
+	  auto timer = std::make_shared<boost::asio::steady_timer>(io_service_);
+	  timer->expires_from_now(std::chrono::milliseconds(redial_delay));
+	  timer->async_wait([this, timer, host, port](boost::system::error_code ec)
+	  {
+		  if (!ec)
+			  dial(host, port);
+	  });
   }
 
-  tcp::socket socket_; /*!< boost:asio TCP socket */
-  Room& room_; /*!< The room in which the client is connected */
-  Message read_msg_; /*!< The message being read */
-  Message_queue write_msgs_; /*!< A list of message de send (due to asynchronous design) */
+  boost::asio::io_service& io_service_; /*!< IO service running the links */
+  Rooms& rooms_; /*!< Rooms the mirrors join */
+  std::atomic<int>& ids_; /*!< IDs of the connections of the server, shared by the mirrors and the dialed links */
+  CompressionStats& stats_; /*!< Compression counters of the server */
+  std::size_t max_frame_; /*!< Biggest frame body accepted from a peer */
+  uint64_t node_; /*!< Random ID of this server */
+  std::atomic<bool> standby_; /*!< True to keep the mirrors of the peers gone */
+  std::atomic<uint64_t> resumed_; /*!< Clients which took over a mirror or a stored image */
+  std::mutex mutex_; /*!< Protects everything below */
+  Journal* journal_; /*!< Where the changes of the clients are stored, null if they are not */
+  Successor successor_; /*!< Server taking over from this one, if any */
+  bool taking_over_; /*!< True once taken over from a previous server */
+  bool dumping_; /*!< True until the images stored by the previous server are all restored */
+  std::condition_variable dump_done_; /*!< Signaled when dumping_ is cleared */
+  std::set<std::string> arrived_; /*!< Identities of the clients connected since the take over, the records of the previous server for them are stale */
+  uint64_t sequence_; /*!< Number of the last record published */
+  std::vector<ClientConnection_ptr> links_; /*!< Connections to the peers, after their handshake */
+  std::map< ClientConnection*, std::pair<std::string, std::string> > dialed_; /*!< Host and port of the links dialed by this server */
+  std::map< uint64_t, std::unique_ptr<ReplicationLag> > lags_; /*!< Lag of the records of each peer node */
+  std::map< int, ClientConnection_ptr > locals_; /*!< Clients of this server in a room, by ID */
+  std::map< std::pair<uint64_t, int>, std::shared_ptr<RemoteClient> > mirrors_; /*!< Mirrors of the clients of the peers, by node and ID */
+  std::set< std::pair<uint64_t, int> > asked_; /*!< Clients of the peers whose join was missed, asked for a snapshot */
 };
 
+inline void ClientConnection::enter(const std::string& name)
+{
+  if (!remote() && !identity.empty() && rooms_.federation())
+    rooms_.federation()->adopt(*this);
+  Room& joined = rooms_.get(name);
+  room = &joined;
+  joined.join(shared_from_this());
+  std::cout << "Client " << ID << (remote() ? " of a peer" : "") << " joins room " << joined.name() << std::endl;
+  RelayRecord record(RelayRecord::JOIN, ID);
+  record.room = joined.name();
+  record.identity = identity;
+  if (!remote() && rooms_.federation())
+	  rooms_.federation()->publish(*this, record);
+}
+
+inline void ClientConnection::leave()
+{
+  requests.cancel();
+  Room* joined = room;
+  if (joined)
+  {
+    if (joined->leave(shared_from_this()) && !remote() && rooms_.federation())
+      rooms_.federation()->publish(*this, RelayRecord(RelayRecord::LEAVE, ID));
+  }
+  else if (rooms_.federation())
+  {
+    //A peer link, or a connection closed before its handshake
+    rooms_.federation()->unlink(*this);
+  }
+}
+
+inline void ClientConnection::replicate(RelayRecord::Kind kind, const std::string& payload)
+{
+  if (remote() || !rooms_.federation())
+    return;
+  RelayRecord record(kind, ID);
+  record.payload = payload;
+  rooms_.federation()->publish(*this, record);
+}
+
+inline void ClientConnection::linked()
+{
+  if (rooms_.federation())
+    rooms_.federation()->link(shared_from_this(), peer);
+}
+
+inline void ClientConnection::relayed(const std::string& body)
+{
+  if (rooms_.federation())
+    rooms_.federation()->receive(*this, body);
+}
+
 //----------------------------------------------------------------------
 
 /*!
 Class that handle the input and output of the server (basically reading and writing to the socket)
 */
 class ServerIO
+#ifdef PATCHWORK_HAS_IO_URING
+  : private UringServer::Handler
+#endif
 {
 public:
+  enum { drain_batch = 16, drain_delay = 100 }; /*!< Clients disconnected at once when handing over, and milliseconds between two batches */
+  enum { default_request_timeout = 5000 }; /*!< Milliseconds a client has to answer a request for its image */
+
+  /*!
+  Accept connections on endpoint, frames bigger than max_frame are refused.
+  overflow tells what to do with a client which does not read its messages fast enough.
+  nb_acceptors listening sockets share the port where SO_REUSEPORT exists, so that a storm of connections is accepted in parallel.
+  If uring is true and io_uring is available, the clients are served by an UringServer on its own thread instead of io_service.
+  The rooms are replicated to the peers linked with link().
+  If listeners are given, handed over by the previous server, they are accepted on instead of endpoint, see Handoff.hpp.
+  */
   ServerIO(boost::asio::io_service& io_service,
-      const tcp::endpoint& endpoint)
-    : acceptor_(io_service, endpoint),
-	socket_(io_service), ID(0)
+      const tcp::endpoint& endpoint,
+      std::size_t max_frame = Message::default_max_body_length,
+      WriteQueue::Overflow overflow = WriteQueue::COALESCE,
+      unsigned int nb_acceptors = 1,
+      bool uring = false,
+      const std::vector<ShardedAcceptor::Handle>& listeners = std::vector<ShardedAcceptor::Handle>())
+    : io_service_(io_service),
+	ID(0), offer_compression_(true), max_frame_(max_frame), overflow_(overflow), handed_over_(false),
+	federation_(io_service, rooms_, ID, compression_stats_, max_frame), drain_timer_(io_service)
+  {
+	  rooms_.federation(&federation_);
+	  if (!listeners.empty())
+	  {
+		  if (uring)
+			  std::cout << "The sockets taken over are served by boost::asio" << std::endl;
+		  acceptor_.reset(new ShardedAcceptor(io_service, endpoint.protocol(), listeners, [this](tcp::socket& socket) { accept(std::move(socket)); }));
+		  return;
+	  }
+#ifdef PATCHWORK_HAS_IO_URING
+	  if (uring)
+	  {
+		  uring_.reset(new UringServer(endpoint.port(), *this, max_frame));
+		  if (uring_->ok())
+		  {
+			  uring_->limit(ClientConnection::max_queued_messages, 2 * max_frame, overflow);
+			  uring_thread_ = std::thread([this]() { uring_->run(); });
+			  return;
+		  }
+		  uring_.reset();
+	  }
+#endif
+	  if (uring)
+		  std::cout << "io_uring is not available, using boost::asio" << std::endl;
+	  acceptor_.reset(new ShardedAcceptor(io_service, endpoint, nb_acceptors, [this](tcp::socket& socket) { accept(std::move(socket)); }));
+  }
+  /*!
+  Stop serving the clients of the io_uring, the io_service ones stop with it, stop receiving from the previous server
+  and wait for the images stored to be sent to the successor
+  */
+  void stop()
   {
-    do_accept();
+#ifdef PATCHWORK_HAS_IO_URING
+	  if (uring_)
+	  {
+		  uring_->stop();
+		  uring_thread_.join();
+	  }
+#endif
+#ifdef PATCHWORK_HAS_HANDOFF
+	  if (predecessor_thread_.joinable())
+	  {
+		  predecessor_->close();
+		  predecessor_thread_.join();
+	  }
+	  //The successor reads until the end, or is gone and the writes fail
+	  if (dump_thread_.joinable())
+		  dump_thread_.join();
+#endif
   }
   /*!
-  Create a "GET" message and send it to all the client connected to the room
+  Ask all the clients connected to room for their image, but those pushing their changes.
+  Each client gets a "GET" request of its own, which completes when the client replies with the version of the image it sent,
+  once the changes before it are applied here, or fails after timeout. The result is printed once every request is settled.
   */
-  bool do_send()
+  bool do_send(Room& room, std::chrono::milliseconds timeout = std::chrono::milliseconds(default_request_timeout))
   {
-	  if (room_.participants().size())
+	  Room::Participants participants = room.participants();
+	  if (participants->size())
 	  {
-		  Message msg;
-		  msg.body_length(std::strlen("GET"));
-		  std::memcpy(msg.body(), "GET", msg.body_length());
-		  msg.encode_header();
-		  for (auto participant : room_.participants())
-			  participant->deliver(msg);
+		  //The image of a subscribed client is already up to date, so is the mirror of a client of a peer
+		  std::vector<ClientConnection_ptr> asked;
+		  for (auto participant : *participants)
+		  {
+			  if (!participant->pushing && !participant->remote())
+				  asked.push_back(participant);
+		  }
+		  auto fetch = std::make_shared<Fetch>(room.name(), asked.size());
+		  for (auto& participant : asked)
+		  {
+			  ClientConnection* client = participant.get();
+			  uint64_t id = participant->requests.start([fetch, client](Requests::Status status, const std::string& result)
+			  {
+				  //Only a reply comes from the thread of the client, which is then alive
+				  uint64_t version;
+				  ByteReader in(result);
+				  if (status == Requests::DONE && in.get_varint(version))
+				  {
+					  std::lock_guard<std::mutex> guard(client->img_mutex);
+					  if (client->sync.version() != version)
+						  status = Requests::FAILED;
+				  }
+				  fetch->settle(status);
+			  }, timeout);
+			  participant->deliver(std::make_shared<const Message>(Message::GET, Requests::request(id)));
+		  }
+		  //Fail the requests still in flight at their deadline
+		  auto timer = std::make_shared<boost::asio::steady_timer>(io_service_);
+		  timer->expires_from_now(timeout);
+		  timer->async_wait([timer, asked](boost::system::error_code)
+		  {
+			  for (auto& participant : asked)
+				  participant->requests.expire();
+		  });
 		  return true;
 	  }
 	  else
 	  {
-		  std::cout << "There are no clients connected to the server" << std::endl;
+		  std::cout << "There are no clients connected to room " << room.name() << std::endl;
 		  return false;
 	  }
   }
   /*!
-  Send back all the drawings to all the client connected to the room
+  Send back all the drawings to all the client connected to room
   */
-  bool do_send_back()
+  bool do_send_back(Room& room)
   {
-	  if (room_.participants().size())
+	  Room::Participants participants = room.participants();
+	  if (participants->size())
 	  {
-		  for (auto participant : room_.participants())
+		  GeometryCodec codec;
+		  for (auto participant : *participants)
 		  {
+			  if (participant->remote())
+				  continue;
 			  //get this participant image to string then send it
-			  Message msg;
 			  std::string s;
-			  participant->img->serialize(s);
-			  msg.body_length(s.length());
-			  std::memcpy(msg.body(), s.c_str(), msg.body_length());
-			  msg.encode_header();
-			  participant->deliver(msg);
+			  {
+				  std::lock_guard<std::mutex> guard(participant->img_mutex);
+				  participant->img->serialize_binary(s, &codec, true);
+			  }
+			  participant->compression.pack(s);
+			  participant->deliver(std::make_shared<const Message>(Message::IMAGE, s));
 		  }
 		  return true;
 	  }
 	  else
 	  {
-		  std::cout << "There are no clients connected to the server" << std::endl;
+		  std::cout << "There are no clients connected to room " << room.name() << std::endl;
 		  return false;
 	  }
   }
   /*!
-  Print all the client connected to the room
+  Print all the client connected to room
   */
-  bool do_print()
+  bool do_print(Room& room)
   {
-	  if (room_.participants().size())
+	  Room::Participants participants = room.participants();
+	  if (participants->size())
 	  {
-		  std::cout << "Client ID : " << std::endl;
-		  for (auto participant : room_.participants())
+		  std::cout << "Client ID in room " << room.name() << " : " << std::endl;
+		  for (auto participant : *participants)
 		  {
-			   std::cout << participant->ID << std::endl;
+			   std::cout << participant->ID << (participant->remote() ? " (peer)" : "") << std::endl;
 		  }
 		  return true;
 	  }
 	  else
 	  {
-		  std::cout << "There are no clients connected to the server" << std::endl;
+		  std::cout << "There are no clients connected to room " << room.name() << std::endl;
+		  return false;
+	  }
+  }
+  /*!
+  Give the image associated the the Client ID of room the annotation contained in msg
+  */
+  void do_annotation(Room& room, int ID, std::string msg)
+  {
+	  ClientConnection_ptr participant = room.find(ID);
+	  if (participant)
+	  {
+		  std::lock_guard<std::mutex> guard(participant->img_mutex);
+		  participant->img->annotate(msg);
+	  }
+  }
+  /*!
+  Print the rooms and their number of clients
+  */
+  void do_print_rooms()
+  {
+	  for (Room* room : rooms_.list())
+		  std::cout << room->name() << " : " << room->participants()->size() << " clients" << std::endl;
+  }
+  /*!
+  Link to the peer server listening at host:port
+  */
+  void link(const std::string& host, const std::string& port)
+  {
+	  federation_.dial(host, port);
+  }
+  /*!
+  Be the standby of the primary server listening at host:port : its clients resume here if it fails
+  */
+  void follow(const std::string& host, const std::string& port)
+  {
+	  federation_.standby(true);
+	  federation_.dial(host, port);
+  }
+  /*!
+  Store the images of the clients in directory, restoring those stored there before.
+  Return false if it cannot be written, or if its snapshot cannot be read : the images are then only kept in memory.
+  An empty directory keeps them in memory only.
+  */
+  bool store(const std::string& directory)
+  {
+	  journal_.reset(new Journal(directory));
+	  bool opened = journal_->open();
+	  if (!directory.empty())
+		  std::cout << "Restored " << journal_->stats().restored << " images from " << directory << " in " << journal_->stats().restore_ms << " ms" << std::endl;
+	  federation_.journal(journal_.get());
+	  return opened;
+  }
+#ifdef PATCHWORK_HAS_LOCAL_TRANSPORT
+  /*!
+  Accept the clients on the machine of the server at the Unix-domain socket path too, return false if it cannot be bound.
+  They may share a memory ring with the server, see Transport.hpp.
+  */
+  bool listen_local(const std::string& path)
+  {
+	  std::remove(path.c_str());
+	  std::unique_ptr<boost::asio::local::stream_protocol::acceptor> acceptor(new boost::asio::local::stream_protocol::acceptor(io_service_));
+	  boost::system::error_code ec;
+	  acceptor->open(boost::asio::local::stream_protocol(), ec);
+	  if (!ec)
+		  acceptor->bind(boost::asio::local::stream_protocol::endpoint(path), ec);
+	  if (!ec)
+		  acceptor->listen(boost::asio::socket_base::max_connections, ec);
+	  if (ec)
+	  {
+		  std::cout << "Cannot listen at " << path << " : " << ec.message() << std::endl;
+		  return false;
+	  }
+	  local_acceptors_.push_back(std::move(acceptor));
+	  accept_local(*local_acceptors_.back());
+	  return true;
+  }
+#endif
+#ifdef PATCHWORK_HAS_HANDOFF
+  /*!
+  Wait for a new server process at the Unix-domain socket path, to hand the listening sockets and the clients over to it
+  */
+  bool wait_successor(const std::string& path)
+  {
+	  std::remove(path.c_str());
+	  successor_acceptor_.reset(new Handoff::protocol::acceptor(io_service_));
+	  boost::system::error_code ec;
+	  successor_acceptor_->open(Handoff::protocol(), ec);
+	  if (!ec)
+		  successor_acceptor_->bind(Handoff::protocol::endpoint(path), ec);
+	  if (!ec)
+		  successor_acceptor_->listen(1, ec);
+	  if (ec)
+	  {
+		  std::cout << "Cannot wait for a successor at " << path << " : " << ec.message() << std::endl;
+		  successor_acceptor_.reset();
 		  return false;
 	  }
+	  auto socket = std::make_shared<Handoff::protocol::socket>(io_service_);
+	  successor_acceptor_->async_accept(*socket, [this, socket, path](boost::system::error_code ec)
+	  {
+		  if (!ec)
+			  hand_off(std::move(*socket), path);
+	  });
+	  return true;
   }
   /*!
-  Give the image associated the the Client ID the annotation contained in msg
+  Take over the clients of the previous server, whose listening sockets were received from predecessor :
+  its images are restored as they come, so that its clients resume them here once it disconnects them.
+  The clients reconnecting before the end of the images it stored wait for it.
   */
-  void do_annotation(int ID, std::string msg)
+  void take_over(std::unique_ptr<Handoff> predecessor)
   {
-	  for (auto participant : room_.participants())
+	  if (!journal_)
+		  store(std::string());
+	  predecessor_ = std::move(predecessor);
+	  federation_.take_over();
+	  predecessor_thread_ = std::thread([this]()
 	  {
-		  if (participant->ID == ID)
+		  std::size_t received = 0, dropped = 0;
+		  RelayRecord record;
+		  Handoff::Received status;
+		  while ((status = predecessor_->receive(record)) != Handoff::CLOSED)
 		  {
-			  participant->img->annotate(msg);
+			  if (status == Handoff::END_OF_DUMP)
+				  federation_.dumped();
+			  else if (federation_.restore(record))
+				  received++;
+			  else
+				  dropped++;
 		  }
-	  }
+		  //Also when the previous server is gone before the end of its images
+		  federation_.dumped();
+		  std::cout << "The previous server handed over " << received << " images, dropped " << dropped << " of clients already back" << std::endl;
+	  });
+  }
+#endif
+  /*!
+  True once every client is handed over to the successor, the server has nothing left to do
+  */
+  bool handed_over() const
+  {
+	  return handed_over_;
+  }
+  /*!
+  Getter for the federation of the server with its peers
+  */
+  Federation& federation()
+  {
+	  return federation_;
+  }
+  /*!
+  Getter for the rooms
+  */
+  Rooms& rooms()
+  {
+	  return rooms_;
+  }
+  /*!
+  Getter for the compression counters of all the connections
+  */
+  const CompressionStats& compression_stats() const
+  {
+	  return compression_stats_;
   }
   /*!
-  Getter for the room
+  Getter for the counters of the requests sent to the clients
   */
-  Room& room()
+  const RequestStats& request_stats() const
   {
-	  return room_;
+	  return request_stats_;
   }
 
 private:
 	/*!
-	Accept all incoming connection, recursively (due to asynchronous design)
+	Images asked for by one "get" command, reported once every request is settled
 	*/
-  void do_accept()
+  struct Fetch
   {
-    acceptor_.async_accept(socket_,
-        [this](boost::system::error_code ec)
-        {
-          if (!ec)
-          {
-            std::make_shared<Client>(std::move(socket_), room_, ID++)->start();
+	  Fetch(const std::string& room, std::size_t asked)
+		  : room(room), left((int)asked), done(0), failed(0), timed_out(0)
+	  {
+		  if (!asked)
+			  std::cout << "The images of room " << room << " are up to date" << std::endl;
+	  }
+	  /*!
+	  Account a request settled, from any thread
+	  */
+	  void settle(Requests::Status status)
+	  {
+		  (status == Requests::DONE ? done : status == Requests::TIMED_OUT ? timed_out : failed)++;
+		  if (--left == 0)
+			  std::cout << "Got " << done << " images of room " << room << ", " << failed << " failed, " << timed_out << " timed out" << std::endl;
+	  }
 
-			std::cout << "Nouvelle connection " << ID << std::endl;
-          }
+	  std::string room; /*!< Room of the clients asked */
+	  std::atomic<int> left; /*!< Requests in flight */
+	  std::atomic<int> done; /*!< Images up to date */
+	  std::atomic<int> failed; /*!< Clients gone, or whose changes were refused */
+	  std::atomic<int> timed_out; /*!< Clients which did not reply in time */
+  };
 
-          do_accept();
-        });
+#ifdef PATCHWORK_HAS_LOCAL_TRANSPORT
+	/*!
+	Accept all incoming connection of a Unix-domain socket, recursively (due to asynchronous design)
+	*/
+  void accept_local(boost::asio::local::stream_protocol::acceptor& acceptor)
+  {
+	  auto socket = std::make_shared<boost::asio::local::stream_protocol::socket>(io_service_);
+	  acceptor.async_accept(*socket, [this, &acceptor, socket](boost::system::error_code ec)
+	  {
+		  if (ec == boost::asio::error::operation_aborted)
+			  return;
+		  if (!ec)
+			  accept(std::move(*socket));
+		  accept_local(acceptor);
+	  });
+  }
+#endif
+#ifdef PATCHWORK_HAS_HANDOFF
+	/*!
+	Hand the listening sockets over to the successor connected at path, stop accepting, then drain the clients
+	*/
+  void hand_off(Handoff::protocol::socket socket, const std::string& path)
+  {
+	  successor_acceptor_.reset();
+	  std::remove(path.c_str());
+	  if (!acceptor_)
+	  {
+		  std::cout << "The clients of io_uring cannot be handed over" << std::endl;
+		  return;
+	  }
+	  successor_.reset(new Handoff(std::move(socket)));
+	  if (!successor_->send_descriptors(acceptor_->handles()))
+	  {
+		  std::cout << "The successor did not take the listening sockets" << std::endl;
+		  successor_.reset();
+		  return;
+	  }
+	  //The successor accepts on the same sockets, with their queue of connections
+	  acceptor_->close();
+	  std::cout << "Handing over to the successor" << std::endl;
+	  Handoff* successor = successor_.get();
+	  Federation::Successor send = [successor](const RelayRecord& record) { successor->send(record); };
+	  Journal* journal = federation_.hand_off(send);
+	  //Replaying the images stored and writing them to the successor takes long : not on an IO thread.
+	  //The clients are drained once the successor has them, it gives none back before.
+	  dump_thread_ = std::thread([this, journal, send, successor]()
+	  {
+		  if (journal)
+			  journal->dump(send);
+		  successor->end_dump();
+		  io_service_.post([this]() { drain(); });
+	  });
+  }
+	/*!
+	Disconnect a few clients, then a few more later, so that they do not all reconnect at once.
+	Once none is left, the server is handed over : the console stops it.
+	*/
+  void drain()
+  {
+	  std::vector<ClientConnection_ptr> clients;
+	  for (Room* room : rooms_.list())
+	  {
+		  for (auto& participant : *room->participants())
+		  {
+			  if (!participant->remote())
+				  clients.push_back(participant);
+		  }
+	  }
+	  if (clients.empty())
+	  {
+		  successor_->close();
+		  std::cout << "Handed over, quitting" << std::endl;
+		  handed_over_ = true;
+		  return;
+	  }
+	  for (std::size_t i = 0; i < clients.size() && i < drain_batch; ++i)
+		  clients[i]->disconnect();
+	  drain_timer_.expires_from_now(std::chrono::milliseconds(drain_delay));
+	  drain_timer_.async_wait([this](boost::system::error_code ec)
+	  {
+		  if (!ec)
+			  drain();
+	  });
+  }
+#endif
+	/*!
+	Start a client on an accepted socket, TCP or Unix-domain, the acceptors may call it from several threads at once
+	*/
+  void accept(boost::asio::generic::stream_protocol::socket socket)
+  {
+    int id = ID++;
+    auto client = std::make_shared<Client>(std::move(socket), io_service_, rooms_, id, compression_stats_, offer_compression_, max_frame_, overflow_);
+    client->requests.stats(&request_stats_);
+    client->start();
+
+	std::cout << "Nouvelle connection " << id + 1 << std::endl;
+  }
+#ifdef PATCHWORK_HAS_IO_URING
+	/*!
+	Start a client on a connection of the io_uring, the calls below come from the thread of the UringServer
+	*/
+  QueueStats* on_connect(uint64_t connection)
+  {
+    int id = ID++;
+    auto client = std::make_shared<UringClient>(*uring_, connection, id, rooms_, compression_stats_, offer_compression_, max_frame_);
+    client->requests.stats(&request_stats_);
+    uring_clients_[connection] = client;
+
+	std::cout << "Nouvelle connection " << id + 1 << std::endl;
+    return &client->lag;
+  }
+
+  void on_frame(uint64_t connection, Message::Type type, const char* body, std::size_t length)
+  {
+    auto it = uring_clients_.find(connection);
+    if (it != uring_clients_.end())
+      it->second->handle_frame(type, body, length);
+  }
+
+  void on_close(uint64_t connection)
+  {
+    auto it = uring_clients_.find(connection);
+    if (it == uring_clients_.end())
+      return;
+    it->second->leave();
+    uring_clients_.erase(it);
   }
+#endif
 
-  tcp::acceptor acceptor_; /*!< boost::asio acceptor (the core object of a server) that can accept connections */
-  tcp::socket socket_; /*!< boost::asio TCP Socket */
-  Room room_; /*!< A room allocated to the server */
-  int ID; /*!< An ID which will be incremented at each connections */
+  boost::asio::io_service& io_service_; /*!< IO service running the clients */
+  Rooms rooms_; /*!< Rooms of the clients, by name */
+  std::atomic<int> ID; /*!< An ID which will be incremented at each connections */
+  CompressionStats compression_stats_; /*!< Compression counters of all the connections */
+  RequestStats request_stats_; /*!< Counters of the requests of all the connections */
+  bool offer_compression_; /*!< True if the server accepts to compress the payloads */
+  std::size_t max_frame_; /*!< Biggest frame body accepted from a client */
+  WriteQueue::Overflow overflow_; /*!< What to do with the clients too slow to read their messages */
+  std::atomic<bool> handed_over_; /*!< Set by the IO thread draining the clients, read by the console */
+  Federation federation_; /*!< Replication of rooms_ with the peer servers */
+  std::unique_ptr<Journal> journal_; /*!< Storage of the images of the clients, if asked for */
+  std::unique_ptr<ShardedAcceptor> acceptor_; /*!< Listening sockets of the io_service clients */
+  boost::asio::steady_timer drain_timer_; /*!< Paces the disconnections of the clients handed over */
+#ifdef PATCHWORK_HAS_LOCAL_TRANSPORT
+  std::vector< std::unique_ptr<boost::asio::local::stream_protocol::acceptor> > local_acceptors_; /*!< Unix-domain sockets of the co-located clients */
+#endif
+#ifdef PATCHWORK_HAS_HANDOFF
+  std::unique_ptr<Handoff::protocol::acceptor> successor_acceptor_; /*!< Waits for the successor, if asked for */
+  std::unique_ptr<Handoff> successor_; /*!< Connection to the successor, once it took over */
+  std::thread dump_thread_; /*!< Sends the images stored to the successor */
+  std::unique_ptr<Handoff> predecessor_; /*!< Connection to the previous server, if taken over from it */
+  std::thread predecessor_thread_; /*!< Receives the images of the previous server */
+#endif
+#ifdef PATCHWORK_HAS_IO_URING
+  std::unique_ptr<UringServer> uring_; /*!< Server of the io_uring clients, if asked for */
+  std::thread uring_thread_; /*!< Thread running uring_ */
+  std::unordered_map<uint64_t, std::shared_ptr<UringClient> > uring_clients_; /*!< Clients of uring_ by connection, only used from its thread */
+#endif
 };
 
 //----------------------------------------------------------------------
@@ -341,7 +1800,8 @@ Class that handle the Server's input commands, basically polling commands from t
 class Server
 {
 public:
-	enum Commands { DISPLAY = 0, SEND, GET, PRINT, ANNOTATE, STATS, PATCHWORK, HELP, QUIT, UNKNOWN }; /*!< Enums of available commands */
+	enum Commands { DISPLAY = 0, SEND, GET, PRINT, ANNOTATE, STATS, PATCHWORK, ROOM, HELP, QUIT, UNKNOWN }; /*!< Enums of available commands */
+	enum { console_poll_delay = 100 }; /*!< Milliseconds between two checks that the server was not handed over, while waiting for a command */
 	static const std::vector<std::string> cmds; /*!< A static container of strings defining the command string assiciaited to its Commands enum value  */
 	/*!
 	Static function to print available commands keywords
@@ -369,20 +1829,104 @@ public:
 	/*!
 	Class that creates the Server and poll user input to execute commands
 	\param service boost::asio io_service
+	\param nb_threads Number of threads running service, the clients are spread over them
+	\param uring Serve the clients through io_uring where available
+	\param port Port to listen on
+	\param peers Servers to link to, as host:port, replicating the rooms with them
+	\param primary Server to be the standby of, as host:port, empty for none
+	\param data Directory where the images of the clients are stored across restarts, empty for none
+	\param handoff Unix-domain socket where a new server process may take over from this one, empty for none
+	\param takeover Unix-domain socket of the server to take over from, empty for none
+	\param locals Unix-domain sockets to accept the clients on the machine of the server on, besides port
+	\param max_frame Biggest frame body accepted from a client or a peer, in bytes
 	*/
-	Server(boost::asio::io_service& service) : io_service(service)
+	Server(boost::asio::io_service& service, unsigned int nb_threads, bool uring = false, unsigned short port = 8080,
+		const std::vector<std::string>& peers = std::vector<std::string>(), const std::string& primary = std::string(),
+		const std::string& data = std::string(), const std::string& handoff = std::string(), const std::string& takeover = std::string(),
+		const std::vector<std::string>& locals = std::vector<std::string>(), std::size_t max_frame = Message::default_max_body_length)
+		: io_service(service)
 	{
 		//Init socket
-		tcp::endpoint endpoint(tcp::v4(), 8080);
-		s = new ServerIO(io_service, std::move(endpoint));
-		t = new std::thread([&](){ io_service.run(); });
+		tcp::endpoint endpoint(tcp::v4(), port);
+		std::vector<ShardedAcceptor::Handle> listeners;
+#ifdef PATCHWORK_HAS_HANDOFF
+		std::unique_ptr<Handoff> predecessor;
+		if (!takeover.empty())
+		{
+			predecessor = Handoff::connect(io_service, takeover);
+			if (!predecessor || !predecessor->receive_descriptors(listeners))
+			{
+				std::cout << "No server to take over at " << takeover << std::endl;
+				predecessor.reset();
+			}
+		}
+#endif
+		//One acceptor per IO thread, the kernel spreads the connections between them
+		s.reset(new ServerIO(io_service, std::move(endpoint), max_frame, WriteQueue::COALESCE, nb_threads, uring, listeners));
+		//The commands act on the default room until another one is chosen
+		room = &s->rooms().get(Rooms::default_name());
+		if (!data.empty() && !s->store(data))
+			std::cout << "Cannot store the images in " << data << std::endl;
+		for (auto& path : locals)
+		{
+#ifdef PATCHWORK_HAS_LOCAL_TRANSPORT
+			s->listen_local(path);
+#else
+			std::cout << "Unix-domain sockets are not available, " << path << " ignored" << std::endl;
+#endif
+		}
+#ifdef PATCHWORK_HAS_HANDOFF
+		if (predecessor)
+			s->take_over(std::move(predecessor));
+		if (!handoff.empty())
+			s->wait_successor(handoff);
+#endif
+		for (auto& peer : peers)
+		{
+			std::size_t colon = peer.rfind(':');
+			if (colon == std::string::npos)
+				std::cout << "Peer " << peer << " : expected host:port" << std::endl;
+			else
+				s->link(peer.substr(0, colon), peer.substr(colon + 1));
+		}
+		if (!primary.empty())
+		{
+			std::size_t colon = primary.rfind(':');
+			if (colon == std::string::npos)
+				std::cout << "Primary " << primary << " : expected host:port" << std::endl;
+			else
+				s->follow(primary.substr(0, colon), primary.substr(colon + 1));
+		}
+		for (unsigned int i = 0; i < nb_threads; ++i)
+			threads.push_back(std::thread([&](){ io_service.run(); }));
 		SDL_Init(SDL_INIT_VIDEO);
 		start_polling();
 	};
 
 private:
 	/*!
-	Function thats polls user inputs and call the associated functions
+	Wait until a command can be read, return false once the server is handed over to its successor
+	*/
+	bool wait_command()
+	{
+#if !_WIN32
+		while (!s->handed_over())
+		{
+			if (std::cin.rdbuf()->in_avail() > 0)
+				return true;
+			pollfd console = { STDIN_FILENO, POLLIN, 0 };
+			//Ready, closed or failed : getline tells which
+			if (poll(&console, 1, console_poll_delay) != 0)
+				return true;
+		}
+		return false;
+#else
+		return !s->handed_over();
+#endif
+	}
+	/*!
+	Function thats polls user inputs and call the associated functions.
+	Once the server is handed over, it stops the IO threads and returns.
 	*/
 	void start_polling()
 	{
@@ -395,7 +1939,7 @@ private:
 		std::cout << "Available commands : ";
 		print_commands();
 		std::cout << std::endl << "Command : ";
-		while (std::cin.getline(line, LINE_MAX_SIZE))
+		while (wait_command() && std::cin.getline(line, LINE_MAX_SIZE))
 		{
 			cmd = std::string(line);
 
@@ -405,7 +1949,7 @@ private:
 				{
 					int ID;
 					std::string annotation;
-					if (s->do_print())
+					if (s->do_print(*room))
 					{
 						std::cout << "Choose an ID from the list :";
 						try
@@ -422,28 +1966,26 @@ private:
 							std::cout << std::endl << "Problem : " << e.what() << std::endl;
 							break;
 						}
-						bool found_ID = false;
-						for (auto participant : s->room().participants())
+						ClientConnection_ptr participant = room->find(ID);
+						if (participant)
 						{
-							if (participant->ID == ID)
-							{
-								SDL_CreateWindowAndRenderer(800, 600, 0, &window, &renderer);
-								while (1) {
-									SDL_PollEvent(&event);
-									if (event.type == SDL_QUIT) {
-										break;
-									}
-									SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0x00);
-									SDL_RenderClear(renderer);
+							SDL_CreateWindowAndRenderer(800, 600, 0, &window, &renderer);
+							while (1) {
+								SDL_PollEvent(&event);
+								if (event.type == SDL_QUIT) {
+									break;
+								}
+								SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0x00);
+								SDL_RenderClear(renderer);
+								{
+									std::lock_guard<std::mutex> guard(participant->img_mutex);
 									participant->img->display(renderer);
-									SDL_RenderPresent(renderer);
 								}
-								SDL_DestroyWindow(window);
-								found_ID = true;
-								break;
+								SDL_RenderPresent(renderer);
 							}
+							SDL_DestroyWindow(window);
 						}
-						if (!found_ID)
+						else
 						{
 							std::cout << "ID : " << ID << " not found" << std::endl;
 						}
@@ -452,14 +1994,14 @@ private:
 
 				case Commands::SEND:
 				{
-					if ( s->do_send_back())
+					if ( s->do_send_back(*room))
 					    std::cout << "Images sent" << std::endl;
 				}break;
 
 				case Commands::GET:
 				{
-					if ( s->do_send() ) 
-					    std::cout << "Get images on progress | use \"print\" to check when it is done" << std::endl;
+					if ( s->do_send(*room) ) 
+					    std::cout << "Get images in progress | reported when every client answered" << std::endl;
 				}break;
 
 				case Commands::PATCHWORK:
@@ -467,8 +2009,10 @@ private:
 					Image* Im = new Image();
 					int last_x = 0;
 					int origin_x = 0;
-					for (auto participant : s->room().participants())
+					Room::Participants participants = room->participants();
+					for (auto participant : *participants)
 					{
+						std::lock_guard<std::mutex> guard(participant->img_mutex);
 						if (last_x == 0)
 						{
 							Im->add_component(participant->img);
@@ -494,12 +2038,19 @@ private:
 						}
 						SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0x00);
 						SDL_RenderClear(renderer);
-						Im->display(renderer);
+						{
+							//The clients keep updating their images, lock them all while drawing, always in the same order
+							std::vector< std::unique_lock<std::mutex> > locks;
+							for (auto participant : *participants)
+								locks.push_back(std::unique_lock<std::mutex>(participant->img_mutex));
+							Im->display(renderer);
+						}
 						SDL_RenderPresent(renderer);
 					}
 					SDL_DestroyWindow(window);
-					for (auto participant : s->room().participants())
+					for (auto participant : *participants)
 					{
+						std::lock_guard<std::mutex> guard(participant->img_mutex);
 						participant->img->origin(Vec2(0, 0));
 					}
 				}break;
@@ -508,7 +2059,7 @@ private:
 				{
 					//Make the user chose the image he wants to annotate
 					// and then another cin to get the annotation
-					if (s->do_print())
+					if (s->do_print(*room))
 					{
 						int ID;
 						std::string annotation;
@@ -527,21 +2078,15 @@ private:
 							std::cout << std::endl << "Problem : " << e.what() << std::endl;
 							break;
 						}
-						bool found_ID = false;
-						for (auto participant : s->room().participants())
+						if (room->find(ID))
 						{
-							if (participant->ID == ID)
-							{
-								std::cout << "Enter your annotation :";
-								std::getline(std::cin, annotation);
-								std::getline(std::cin, annotation);
-								s->do_annotation(ID, annotation);
-								found_ID = true;
-								std::cout << "Annotation entered" << std::endl;
-								break;
-							}
+							std::cout << "Enter your annotation :";
+							std::getline(std::cin, annotation);
+							std::getline(std::cin, annotation);
+							s->do_annotation(*room, ID, annotation);
+							std::cout << "Annotation entered" << std::endl;
 						}
-						if (!found_ID)
+						else
 						{
 							std::cout << "ID : " << ID << " not found" << std::endl;
 						}
@@ -554,21 +2099,15 @@ private:
 					// zero-initialis\E9, ont as pas besoin de la faire nous m\EAme
 					std::map< Shape::Derivedtype, int > shapes_count;
 					std::map< Color, int > color_count;
-					for (auto participant : s->room().participants())
+					//The component summaries come from the index, no geometry is decoded
+					Room::Participants participants = room->participants();
+					for (auto participant : *participants)
 					{
-						for (auto shape : participant->img->components())
+						std::lock_guard<std::mutex> guard(participant->img_mutex);
+						for (auto info : participant->img->component_infos())
 						{
-							if (shape->type() == Shape::IMAGE)
-							{
-								Image * im = static_cast<Image*>(shape);
-								for (auto imageShape : im->components())
-								{
-									shapes_count[imageShape->type()]++;
-									color_count[imageShape->color()]++;
-								}
-							}
-							shapes_count[shape->type()]++;
-							color_count[shape->color()]++;
+							shapes_count[info.type]++;
+							color_count[info.color]++;
 						}
 					}
 
@@ -599,11 +2138,43 @@ private:
 					{
 						std::cout << key_value.first << " : " << key_value.second << std::endl;
 					}
+
+					s->compression_stats().print(std::cout);
+					s->request_stats().print(std::cout);
+					BufferPool::shared().stats().print(std::cout);
+					s->federation().print(std::cout);
+					for (auto participant : *participants)
+					{
+						if (participant->lag.lagging())
+						{
+							std::cout << "Client " << participant->ID << " lagging : ";
+							participant->lag.print(std::cout);
+						}
+					}
+				}break;
+
+				case Commands::ROOM:
+				{
+					//Choose the room the other commands act on
+					s->do_print_rooms();
+					std::string name;
+					std::cout << "Choose a room from the list :";
+					std::cin >> name;
+					Room* chosen = s->rooms().find(name);
+					if (chosen)
+					{
+						room = chosen;
+						std::cout << "Commands act on room " << room->name() << std::endl;
+					}
+					else
+					{
+						std::cout << "Room : " << name << " not found" << std::endl;
+					}
 				}break;
 
 				case Commands::PRINT:
 				{
-					s->do_print();
+					s->do_print(*room);
 				}break;
 
 				case Commands::HELP:
@@ -624,7 +2195,7 @@ private:
 			}
 
 
-			if (quit)
+			if (quit || !wait_command())
 				break;
 
 			std::cin.clear();
@@ -632,31 +2203,91 @@ private:
 			std::cout << std::endl << "Command : ";
 
 		}
+		s->stop();
 		io_service.stop();
-		t->join();
+		for (auto& thread : threads)
+			thread.join();
 	}
 
-	ServerIO* s; /*!< A list of message de send (due to asynchronous design) */
+	std::unique_ptr<ServerIO> s; /*!< A list of message de send (due to asynchronous design) */
+	Room* room; /*!< Room the commands act on */
 	SDL_Event event; /*!< SDL Event so we can know when to close the window */
 	SDL_Window *window; /*!< SDL window to display to */
 	SDL_Renderer *renderer; /*!< SDL renderer to draw components to */
 	boost::asio::io_service& io_service;  /*!< boost::asio io_service */
 	tcp::resolver* resolver; /*!< boost::asio TCP resolver */
-	std::thread* t;  /*!< Thread polling Input/Output event from io_service */
+	std::vector<std::thread> threads;  /*!< Threads polling Input/Output event from io_service */
 };
-const std::vector<std::string> Server::cmds = { "display", "send", "get", "print", "annotate", "stats", "patchwork", "help" , "quit"};
+const std::vector<std::string> Server::cmds = { "display", "send", "get", "print", "annotate", "stats", "patchwork", "room", "help" , "quit"};
 
 
+//The tests build the sessions of this file without its entry point, see HandlerMemory_test.h
+#ifndef PATCHWORK_SERVER_NO_MAIN
 #if _WIN32
 int _tmain(int argc, _TCHAR* argv[])
 #else
-int main()
+int main(int argc, char* argv[])
 #endif
 {
   try
   {
+	//"--uring" serves the clients through io_uring, on Linux
+	//"--port N" listens on N instead of 8080, "--peer host:port" (repeated) links to the other servers of a federation
+	//"--standby host:port" replicates the primary server there, and takes over its clients when it fails
+	//"--data DIR" stores the images of the clients in DIR, they resume them when the server restarts
+	//"--handoff PATH" lets a new server take over at the Unix-domain socket PATH, started with "--takeover PATH"
+	//"--listen URI" (repeated) accepts the clients there too : tcp://host:port sets the port, unix:///PATH or shm:///PATH a Unix-domain socket
+	//"--max-frame N" refuses the frames bigger than N bytes, 64 MB by default
+	bool uring = false;
+	unsigned short port = 8080;
+	std::vector<std::string> peers;
+	std::string primary;
+	std::string data;
+	std::string handoff;
+	std::string takeover;
+	std::vector<std::string> locals;
+	std::size_t max_frame = Message::default_max_body_length;
+#if !_WIN32
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg(argv[i]);
+		if (arg == "--uring")
+			uring = true;
+		else if (arg == "--port" && i + 1 < argc)
+			port = (unsigned short)std::atoi(argv[++i]);
+		else if (arg == "--peer" && i + 1 < argc)
+			peers.push_back(argv[++i]);
+		else if (arg == "--standby" && i + 1 < argc)
+			primary = argv[++i];
+		else if (arg == "--data" && i + 1 < argc)
+			data = argv[++i];
+		else if (arg == "--handoff" && i + 1 < argc)
+			handoff = argv[++i];
+		else if (arg == "--takeover" && i + 1 < argc)
+			takeover = argv[++i];
+		else if (arg == "--max-frame" && i + 1 < argc)
+		{
+			unsigned long long value = std::strtoull(argv[++i], nullptr, 10);
+			if (value)
+				max_frame = (std::size_t)value;
+			else
+				std::cout << "Max frame " << argv[i] << " : expected a size in bytes" << std::endl;
+		}
+		else if (arg == "--listen" && i + 1 < argc)
+		{
+			Endpoint endpoint;
+			if (!Endpoint::parse(argv[++i], endpoint))
+				std::cout << "Listen " << argv[i] << " : expected tcp://host:port, unix:///path or shm:///path" << std::endl;
+			else if (endpoint.local())
+				locals.push_back(endpoint.path);
+			else
+				port = (unsigned short)std::atoi(endpoint.port.c_str());
+		}
+	}
+#endif
 	boost::asio::io_service io_service;
-	Server s(io_service);
+	//One IO thread per core, the console has its own
+	Server s(io_service, std::max(1u, std::thread::hardware_concurrency()), uring, port, peers, primary, data, handoff, takeover, locals, max_frame);
   }
   catch (std::exception& e)
   {
@@ -665,3 +2296,4 @@ int main()
 
   return 0;
 }
+#endif
@@ -5,7 +5,7 @@
 /*!
 Fonction that checks if the condition cond holds true, print out OK or KO and exit program if critical boolean is passed
 */
-int test_assert(bool cond, char* msg, bool critical = false)
+int test_assert(bool cond, const char* msg, bool critical = false)
 {
 	if (cond)
 	{
@@ -0,0 +1,251 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Maths.h"
+
+/*! \file Codec.h
+\brief Header file containing the low level binary encoding helpers.
+
+Provides zigzag and varint integer encoding, raw float encoding, a hash of encoded buffers, a ByteReader to walk an encoded buffer,
+and the GeometryCodec used to compress the vertices of a Polygon.
+*/
+
+namespace Patchwork
+{
+	/*!
+	Map a signed integer to an unsigned one so small negative values stay small : 0, -1, 1, -2, 2 ... become 0, 1, 2, 3, 4 ...
+	*/
+	inline uint64_t zigzag_encode(int64_t v)
+	{
+		return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+	}
+	/*!
+	Inverse of zigzag_encode
+	*/
+	inline int64_t zigzag_decode(uint64_t v)
+	{
+		return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+	}
+	/*!
+	Append an unsigned integer as a varint : 7 bits per byte, the high bit telling if another byte follows.
+	*/
+	inline void put_varint(std::string& out, uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			out.push_back((char)((v & 0x7F) | 0x80));
+			v >>= 7;
+		}
+		out.push_back((char)v);
+	}
+	/*!
+	Append a signed integer as a zigzag varint
+	*/
+	inline void put_svarint(std::string& out, int64_t v)
+	{
+		put_varint(out, zigzag_encode(v));
+	}
+	/*!
+	Append a single byte
+	*/
+	inline void put_u8(std::string& out, uint8_t v)
+	{
+		out.push_back((char)v);
+	}
+	/*!
+	Append a 32 bits unsigned integer, little endian
+	*/
+	inline void put_u32(std::string& out, uint32_t v)
+	{
+		for (int i = 0; i < 4; ++i)
+			out.push_back((char)((v >> (8 * i)) & 0xFF));
+	}
+	/*!
+	Append a float as its 32 bits IEEE 754 representation, little endian
+	*/
+	inline void put_float(std::string& out, float f)
+	{
+		uint32_t v;
+		std::memcpy(&v, &f, sizeof(v));
+		put_u32(out, v);
+	}
+	/*!
+	64 bits FNV-1a hash of a buffer, to tell whether an encoded component changed
+	*/
+	inline uint64_t fnv1a(const std::string& data)
+	{
+		uint64_t h = 14695981039346656037ULL;
+		for (unsigned char c : data)
+		{
+			h ^= c;
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	/*!
+	Cursor over an encoded buffer.
+	Every getter returns false, and leaves the output untouched, when the buffer is exhausted or malformed.
+	The reader does not own the buffer, which must outlive it.
+	*/
+	class ByteReader
+	{
+	public:
+		ByteReader(const char* data, std::size_t length) : m_pos(data), m_end(data + length) {}
+		ByteReader(const std::string& s) : m_pos(s.data()), m_end(s.data() + s.size()) {}
+		/*!
+		Number of bytes left to read
+		*/
+		std::size_t remaining() const { return (std::size_t)(m_end - m_pos); }
+		/*!
+		Pointer on the next byte to read
+		*/
+		const char* position() const { return m_pos; }
+		/*!
+		Skip n bytes
+		*/
+		bool skip(std::size_t n)
+		{
+			if (remaining() < n)
+				return false;
+			m_pos += n;
+			return true;
+		}
+		bool get_u8(uint8_t& v)
+		{
+			if (remaining() < 1)
+				return false;
+			v = (uint8_t)*m_pos++;
+			return true;
+		}
+		bool get_u32(uint32_t& v)
+		{
+			if (remaining() < 4)
+				return false;
+			uint32_t r = 0;
+			for (int i = 0; i < 4; ++i)
+				r |= (uint32_t)(uint8_t)m_pos[i] << (8 * i);
+			m_pos += 4;
+			v = r;
+			return true;
+		}
+		bool get_float(float& f)
+		{
+			uint32_t v;
+			if (!get_u32(v))
+				return false;
+			std::memcpy(&f, &v, sizeof(f));
+			return true;
+		}
+		bool get_varint(uint64_t& v)
+		{
+			uint64_t r = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				if (m_pos == m_end)
+					return false;
+				uint8_t byte = (uint8_t)*m_pos++;
+				r |= (uint64_t)(byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+				{
+					v = r;
+					return true;
+				}
+			}
+			return false;
+		}
+		bool get_svarint(int64_t& v)
+		{
+			uint64_t u;
+			if (!get_varint(u))
+				return false;
+			v = zigzag_decode(u);
+			return true;
+		}
+		/*!
+		Read n raw bytes into s
+		*/
+		bool get_bytes(std::string& s, std::size_t n)
+		{
+			if (remaining() < n)
+				return false;
+			s.assign(m_pos, n);
+			m_pos += n;
+			return true;
+		}
+	private:
+		const char* m_pos; /*!< Next byte to read */
+		const char* m_end; /*!< One past the last byte of the buffer */
+	};
+
+	/*!
+	Compression of a list of vertices.
+	Coordinates are quantized to a fixed grid, each vertex is stored as the difference with the previous one, and the differences are written as zigzag varints.
+	Adjacent vertices of a drawing are usually a few pixels apart, so most coordinates take one or two bytes instead of four.
+	The default grid (0.01) is the precision of the text format, so the codec loses nothing more than the text serialization already does.
+	*/
+	class GeometryCodec
+	{
+	public:
+		GeometryCodec(float grid = 0.01f) : m_grid(grid) {}
+		/*!
+		Getter for the quantization step
+		*/
+		float grid() const { return m_grid; }
+		/*!
+		Append the vertex count then the delta encoded vertices to out
+		*/
+		void encode(const std::vector<Vec2>& points, std::string& out) const
+		{
+			put_varint(out, points.size());
+			int64_t last_x = 0;
+			int64_t last_y = 0;
+			for (auto point : points)
+			{
+				int64_t x = quantize(point.x);
+				int64_t y = quantize(point.y);
+				put_svarint(out, x - last_x);
+				put_svarint(out, y - last_y);
+				last_x = x;
+				last_y = y;
+			}
+		}
+		/*!
+		Read back a list of vertices written by encode. Return false if the buffer is truncated or malformed.
+		*/
+		bool decode(ByteReader& in, std::vector<Vec2>& points) const
+		{
+			uint64_t count;
+			if (!in.get_varint(count) || count > in.remaining() / 2)
+				return false;
+			points.clear();
+			points.reserve((std::size_t)count);
+			int64_t x = 0;
+			int64_t y = 0;
+			for (uint64_t i = 0; i < count; ++i)
+			{
+				int64_t dx, dy;
+				if (!in.get_svarint(dx) || !in.get_svarint(dy))
+					return false;
+				x += dx;
+				y += dy;
+				points.push_back(Vec2((float)(x * (double)m_grid), (float)(y * (double)m_grid)));
+			}
+			return true;
+		}
+	private:
+		/*!
+		Snap a coordinate to the nearest grid point
+		*/
+		int64_t quantize(float f) const
+		{
+			return (int64_t)std::llround((double)f / m_grid);
+		}
+
+		float m_grid; /*!< Quantization step of the coordinates */
+	};
+}
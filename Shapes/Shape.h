@@ -6,7 +6,10 @@
 #include <sstream>
 #include <mutex>
 #include <algorithm>
+#include <cctype>
 #include "Maths.h"
+#include "Codec.h"
+#include "ThreadPool.h"
 #include "SDL2/SDL.h"
 
 /*! \file Shape.h
@@ -15,6 +18,9 @@
 Gives access to the classes : Circle, Polygon, Line and Ellipse, which all inherits from the Shape class.
 Also provides the Image class which is a container of shapes.
 
+Images can be serialized in two formats : a human readable text format (serialize), and a compact binary format (serialize_binary).
+Image::deserialize recognizes both.
+
 */
 
 namespace Patchwork
@@ -118,8 +124,8 @@ namespace Patchwork
 		/*!
 		Constructor initializing the Derivedtype and color
 		*/
-		Shape(Derivedtype type, Color color) : m_type(type), m_color(color){};
-		~Shape(){};
+		Shape(Derivedtype type, Color color) : m_type(type), m_color(color), m_id(0){};
+		virtual ~Shape(){};
 		/*!
 		Getter for the variable type
 		*/
@@ -129,6 +135,14 @@ namespace Patchwork
 		*/
 		const Color color() const { return(m_color); }
 		/*!
+		Getter for the id, unique in the image holding the shape and stable across its transformations. 0 until the shape is added to an image.
+		*/
+		uint32_t id() const { return(m_id); }
+		/*!
+		Setter for the id
+		*/
+		void id(uint32_t new_id) { m_id = new_id; }
+		/*!
 		Interface function, needed in inheriting classes, to compute the area of the shape.
 		*/
 		virtual float area() = 0;
@@ -179,6 +193,12 @@ namespace Patchwork
 		*/
 		virtual void serialize( std::string& serial ) = 0;
 		/*!
+		Interface function, needed in inheriting classes, to append the shape's geometry to a binary buffer.
+		The type and the color are written by the Image, so only the geometry is expected here.
+		If codec is not null, vertices lists should be compressed with it.
+		*/
+		virtual void encode(std::string& out, const GeometryCodec* codec) = 0;
+		/*!
 		Interface function, needed in inheriting classes, to compute the bounding box af the shape.
 		*/
 		virtual BoundingBox bounding_box() = 0;
@@ -189,6 +209,7 @@ namespace Patchwork
 	protected:
 		Derivedtype m_type; /*!< The Derivedtype of the children */
 		Color m_color; /*!< The color of the shape as (R,G,B) value */
+		uint32_t m_id; /*!< The id of the shape in its image */
 	};
 	//Static container definitions
 	const std::vector<std::string> Shape::transforms = { "rotate", "homothety", "translate", "axial_sym", "central_sym" };
@@ -328,6 +349,15 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the geometry as origin and radius floats
+		*/
+		void encode(std::string& out, const GeometryCodec* /*codec*/)
+		{
+			put_float(out, m_origin.x);
+			put_float(out, m_origin.y);
+			put_float(out, m_radius);
+		}
+		/*!
 		Function to compute the boudning box
 		*/
 		BoundingBox bounding_box()
@@ -559,6 +589,25 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the vertices, compressed by the codec if there is one, as raw floats otherwise
+		*/
+		void encode(std::string& out, const GeometryCodec* codec)
+		{
+			if (codec)
+			{
+				codec->encode(m_points, out);
+			}
+			else
+			{
+				put_varint(out, m_points.size());
+				for (auto point : m_points)
+				{
+					put_float(out, point.x);
+					put_float(out, point.y);
+				}
+			}
+		}
+		/*!
 		Function to compute the bounding box
 		*/
 		BoundingBox bounding_box()
@@ -766,6 +815,16 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the geometry as point and direction floats
+		*/
+		void encode(std::string& out, const GeometryCodec* /*codec*/)
+		{
+			put_float(out, m_point.x);
+			put_float(out, m_point.y);
+			put_float(out, m_direction.x);
+			put_float(out, m_direction.y);
+		}
+		/*!
 		Function to compute the bounding box
 		*/
 		BoundingBox bounding_box()
@@ -948,6 +1007,16 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the geometry as origin and radius floats
+		*/
+		void encode(std::string& out, const GeometryCodec* /*codec*/)
+		{
+			put_float(out, m_origin.x);
+			put_float(out, m_origin.y);
+			put_float(out, m_radius.x);
+			put_float(out, m_radius.y);
+		}
+		/*!
 		Function to compute the boudning box
 		*/
 		BoundingBox bounding_box()
@@ -1001,10 +1070,27 @@ namespace Patchwork
 	///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+	/*!
+	Summary of a component : what the index of the binary format stores for each component, so it can be read without decoding any geometry.
+	*/
+	struct ComponentInfo
+	{
+		Shape::Derivedtype type; /*!< Type of the component */
+		Color color; /*!< Color of the component */
+		BoundingBox bb; /*!< Bounding box of the component */
+		uint64_t offset; /*!< Offset of the geometry in the geometry section of the binary format */
+	};
+
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
 	/*!
 	Image class providing functions to make, transform and display a 2D Image composed of 2D shapes.
 	This class is thread safe but it canno't be copied !
 	The image is considered as a rectancle (AABB : Axis Aligned Bounding Box) for the transformations.
+	In lazy mode, an indexed binary buffer is only parsed up to its index by deserialize : component_infos and bounding_box are answered from the index,
+	display only decodes the visible components, and any other access decodes all the geometry first.
 	*/
 	class Image : public Shape
 	{
@@ -1013,7 +1099,7 @@ namespace Patchwork
 		Constructor with the origin sets at (0,0) by default, else define the origin of the Image (for Image inside an Image)
 		Initialize the annotation to an empty string and components as empty list
 		*/
-		Image(Vec2 o = { 0, 0 }) : Shape(Shape::IMAGE, Color(0, 0, 0)), annotation(std::string()), components_(std::vector<Shape *>()), origin_(o){}
+		Image(Vec2 o = { 0, 0 }) : Shape(Shape::IMAGE, Color(0, 0, 0)), annotation(std::string()), components_(std::vector<Shape *>()), origin_(o), lazy_(false), has_codec_(false), next_id_(0), first_id_(0){}
 		~Image()
 		{
 			components_.clear();
@@ -1049,9 +1135,15 @@ namespace Patchwork
 		void translate(const Vec2& v)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			if (!index_.empty())
+			{
+				//Apply the translation when decoding, and to the index when it is queried
+				offset_ = offset_ + v;
+			}
 			for (auto component : components_)
 			{
-				component->translate(v);
+				if (component)
+					component->translate(v);
 			}
 		}
 		/*!
@@ -1060,6 +1152,7 @@ namespace Patchwork
 		void homothety(float ratio)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
 				component->homothety(ratio);
@@ -1071,6 +1164,7 @@ namespace Patchwork
 		void homothety(const Vec2& p, float ratio)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
 				component->homothety(p, ratio);
@@ -1082,6 +1176,7 @@ namespace Patchwork
 		void rotate(float angle)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
 				component->rotate(angle);
@@ -1093,6 +1188,7 @@ namespace Patchwork
 		void rotate(const Vec2& p, double angle)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
 				component->rotate(p, angle);
@@ -1104,6 +1200,7 @@ namespace Patchwork
 		void centralSym(const Vec2& c)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
 				component->centralSym(c);
@@ -1115,6 +1212,7 @@ namespace Patchwork
 		void axialSym(const Vec2& p, const Vec2& d)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
 				component->axialSym(p, d);
@@ -1128,9 +1226,9 @@ namespace Patchwork
 			std::lock_guard<std::mutex> guard(mutex);
 			BoundingBox bb_ = {};
 			BoundingBox bb = {};
-			for (auto component : components_)
+			for (std::size_t i = 0; i < components_.size(); ++i)
 			{
-				bb = component->bounding_box();
+				bb = components_[i] ? components_[i]->bounding_box() : indexed_box(i);
 				if (bb_.x_max < bb.x_max)
 					bb_.x_max = bb.x_max;
 				if (bb_.x_min > bb.x_min)
@@ -1143,11 +1241,17 @@ namespace Patchwork
 			return bb_;
 		}
 		/*!
-		Function to add a component to the image
+		Function to add a component to the image.
+		The component gets a new id, unless it already has one (a component synchronized from another image).
 		*/
 		void add_component(Shape* s)
 		{ 
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
+			if (!s->id())
+				s->id(++next_id_);
+			else if (s->id() > next_id_)
+				next_id_ = s->id();
 			s->translate(origin_);
 			components_.push_back(s); 
 		}
@@ -1173,6 +1277,7 @@ namespace Patchwork
 		void display(SDL_Renderer* renderer, float ratio)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
 				component->display(renderer, ratio);
@@ -1181,6 +1286,7 @@ namespace Patchwork
 		/*!
 		Function to display the image. This is called on the Image we actually want to display. It compute a ratio to be able to fit every shapes in the fixed size displayable texture.
 		If the shapes need to be resized, a ratio is passed to the display function.
+		Components whose bounding box falls outside of the renderer are skipped, and in lazy mode they are not even decoded.
 		*/
 		void display(SDL_Renderer* renderer)
 		{
@@ -1226,10 +1332,15 @@ namespace Patchwork
 				}
 			}
 
-			for (auto component : components_)
+			for (std::size_t i = 0; i < components_.size(); ++i)
 			{
-
-				component->display(renderer, final_ratio);
+				BoundingBox cbb = components_[i] ? components_[i]->bounding_box() : indexed_box(i);
+				if (cbb.x_max * final_ratio + center.x < 0 || cbb.x_min * final_ratio + center.x > w ||
+					cbb.y_max * final_ratio + center.y < 0 || cbb.y_min * final_ratio + center.y > h)
+					continue;
+				if (!components_[i] && !(components_[i] = decode_at(i)))
+					continue;
+				components_[i]->display(renderer, final_ratio);
 			}
 		}
 
@@ -1250,25 +1361,314 @@ namespace Patchwork
 			annotation = msg;
 		}
 		/*!
-		Function to serialize the image into string, equivalent to serialize all of its components
+		Function to serialize the image into string, equivalent to serialize all of its components.
+		Ranges of chunk_size components are serialized in parallel then appended in order.
 		*/
 		void serialize(std::string& serial)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
+			std::vector<std::string> chunks(nb_chunks(components_.size()));
+			ThreadPool::shared().parallel_for(chunks.size(), [&](std::size_t c)
+			{
+				std::size_t end = std::min(components_.size(), (c + 1) * chunk_size);
+				for (std::size_t i = c * chunk_size; i < end; ++i)
+				{
+					//Each component appends to its own string, so the chunk grows linearly
+					std::string part;
+					components_[i]->serialize(part);
+					chunks[c] += part;
+				}
+			});
+			for (auto& chunk : chunks)
+				serial += chunk;
+			serial = serial + " annotation " + to_string((int)annotation.size()) + " " + annotation;
+		}
+		/*!
+		Function to encode the components of the image. Each one is written as its type, its color and its geometry.
+		Components of a nested image are flattened, as in the text format.
+		*/
+		void encode(std::string& out, const GeometryCodec* codec)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
 			for (auto component : components_)
 			{
-				component->serialize(serial);
+				if (component->type() == Shape::IMAGE)
+				{
+					component->encode(out, codec);
+					continue;
+				}
+				put_u8(out, (uint8_t)component->type());
+				put_svarint(out, component->color().r);
+				put_svarint(out, component->color().g);
+				put_svarint(out, component->color().b);
+				component->encode(out, codec);
 			}
-			serial = serial + " annotation " + to_string((int)annotation.size()) + " " + annotation;
 		}
 		/*!
-		Function to deserialize a string into an image.
+		Function to serialize the image into the binary format :
+		magic (4 bytes), flags (1 byte), grid (float, only if the geometry codec is used),
+		components until an END_ENUM type byte, then the annotation length as a varint and its bytes.
+		If codec is not null, polygon vertices are compressed with it.
+		If indexed is true, the components are instead written as their count, an index of (type, color, bounding box, offset),
+		then the size of the geometry section and the geometry section, so that a reader can skip the geometry.
+		The indexed layout is encoded by ranges of chunk_size components in parallel, and stitched in order :
+		the output is the same whatever the number of threads.
+		*/
+		void serialize_binary(std::string& serial, const GeometryCodec* codec = nullptr, bool indexed = false)
+		{
+			serial.append(binary_magic(), binary_magic_size);
+			put_u8(serial, (codec ? BINARY_GEOMETRY_CODEC : 0) | (indexed ? BINARY_INDEXED : 0));
+			if (codec)
+				put_float(serial, codec->grid());
+			if (indexed)
+			{
+				//The pool reads the components, the images holding them stay locked until they are encoded
+				std::vector<Shape*> leaves;
+				std::vector< std::unique_lock<std::mutex> > held;
+				held.push_back(std::unique_lock<std::mutex>(mutex));
+				flatten(leaves, held);
+				std::vector<IndexChunk> chunks(nb_chunks(leaves.size()));
+				//First pass : the geometry of each range, with offsets relative to the range
+				ThreadPool::shared().parallel_for(chunks.size(), [&](std::size_t c)
+				{
+					std::size_t end = std::min(leaves.size(), (c + 1) * chunk_size);
+					for (std::size_t i = c * chunk_size; i < end; ++i)
+					{
+						chunks[c].offsets.push_back(chunks[c].geometry.size());
+						chunks[c].boxes.push_back(leaves[i]->bounding_box());
+						leaves[i]->encode(chunks[c].geometry, codec);
+					}
+				});
+				std::size_t base = 0;
+				for (auto& chunk : chunks)
+				{
+					chunk.base = base;
+					base += chunk.geometry.size();
+				}
+				//Second pass : the index entries, now that the absolute offsets are known
+				ThreadPool::shared().parallel_for(chunks.size(), [&](std::size_t c)
+				{
+					for (std::size_t k = 0; k < chunks[c].offsets.size(); ++k)
+					{
+						Shape* leaf = leaves[c * chunk_size + k];
+						const BoundingBox& bb = chunks[c].boxes[k];
+						std::string& out = chunks[c].index;
+						put_u8(out, (uint8_t)leaf->type());
+						put_svarint(out, leaf->color().r);
+						put_svarint(out, leaf->color().g);
+						put_svarint(out, leaf->color().b);
+						put_svarint(out, bb.x_min);
+						put_svarint(out, bb.y_min);
+						put_svarint(out, bb.x_max);
+						put_svarint(out, bb.y_max);
+						put_varint(out, chunks[c].base + chunks[c].offsets[k]);
+					}
+				});
+				put_varint(serial, leaves.size());
+				for (auto& chunk : chunks)
+					serial.append(chunk.index);
+				put_varint(serial, base);
+				for (auto& chunk : chunks)
+					serial.append(chunk.geometry);
+			}
+			else
+			{
+				encode(serial, codec);
+				put_u8(serial, (uint8_t)Shape::END_ENUM);
+			}
+			std::lock_guard<std::mutex> guard(mutex);
+			put_varint(serial, annotation.size());
+			serial.append(annotation);
+		}
+		/*!
+		Return true if s starts with the magic of the binary format.
+		The magic starts with a null byte, which never appears in the text format.
+		*/
+		static bool is_binary(const std::string& s)
+		{
+			return s.size() >= binary_magic_size && std::memcmp(s.data(), binary_magic(), binary_magic_size) == 0;
+		}
+		/*!
+		Function to deserialize a string written by serialize_binary into an image.
+		Return false, keeping the components decoded so far, if the buffer is truncated or malformed.
+		In lazy mode the geometry of an indexed buffer is kept encoded, and malformed geometry is only detected when decoded.
+		/!\ this function erase all existing components /!\
+		*/
+		bool deserialize_binary(const std::string& s)
+		{
+			components_.clear();
+			index_.clear();
+			encoded_.clear();
+			if (!is_binary(s))
+				return false;
+			ByteReader in(s);
+			in.skip(binary_magic_size);
+			uint8_t flags;
+			if (!in.get_u8(flags))
+				return false;
+			GeometryCodec codec;
+			bool use_codec = (flags & BINARY_GEOMETRY_CODEC) != 0;
+			if (use_codec)
+			{
+				float grid;
+				if (!in.get_float(grid))
+					return false;
+				codec = GeometryCodec(grid);
+			}
+			bool ok = (flags & BINARY_INDEXED) ?
+				deserialize_index(in, use_codec ? &codec : nullptr) :
+				deserialize_components(in, use_codec ? &codec : nullptr);
+			if (!ok)
+				return false;
+			uint64_t size;
+			std::string text;
+			if (!in.get_varint(size) || !in.get_bytes(text, (std::size_t)size))
+				return false;
+			annotate(text);
+			return true;
+		}
+		/*!
+		Function to deserialize a string into an image, in the text or the binary format.
 		/!\ this function erase all existing components /!\
 		*/
 		void deserialize(std::string s)
 		{
+			if (is_binary(s))
+			{
+				deserialize_binary(s);
+				return;
+			}
 			components_.clear();
-			std::istringstream buf(s);
+			index_.clear();
+			encoded_.clear();
+			std::vector<TextChunk> chunks;
+			split_text(s, chunks);
+			ThreadPool::shared().parallel_for(chunks.size(), [&](std::size_t c)
+			{
+				parse_text(chunks[c]);
+			});
+			for (auto& chunk : chunks)
+			{
+				for (auto shape : chunk.shapes)
+					add_component(shape);
+				if (chunk.annotated)
+					annotate(chunk.annotation);
+			}
+		}
+
+		/*!
+		Getter for the image' components list
+		*/
+		std::vector< Shape* >& components()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			materialize();
+			return components_;
+		}
+		/*!
+		Getter for the summary (type, color, bounding box) of every component, nested images being flattened.
+		In lazy mode this is read from the index without decoding any geometry.
+		*/
+		std::vector<ComponentInfo> component_infos()
+		{
+			std::vector<ComponentInfo> infos;
+			std::vector<Image*> nested;
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				for (std::size_t i = 0; i < components_.size(); ++i)
+				{
+					if (!components_[i])
+					{
+						infos.push_back(index_[i]);
+						infos.back().bb = indexed_box(i);
+					}
+					else if (components_[i]->type() == Shape::IMAGE)
+					{
+						nested.push_back(static_cast<Image*>(components_[i]));
+					}
+					else
+					{
+						ComponentInfo info = { components_[i]->type(), components_[i]->color(), components_[i]->bounding_box(), 0 };
+						infos.push_back(info);
+					}
+				}
+			}
+			for (auto image : nested)
+			{
+				std::vector<ComponentInfo> sub = image->component_infos();
+				infos.insert(infos.end(), sub.begin(), sub.end());
+			}
+			return infos;
+		}
+		/*!
+		Setter for the lazy mode, used by the next deserialization
+		*/
+		void lazy(bool enabled)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			lazy_ = enabled;
+		}
+
+		/*!
+		Read the color and the geometry of one component of the binary format, return nullptr if malformed
+		*/
+		static Shape* decode_component(Shape::Derivedtype type, ByteReader& in, const GeometryCodec* codec)
+		{
+			int64_t r, g, b;
+			if (!in.get_svarint(r) || !in.get_svarint(g) || !in.get_svarint(b))
+				return nullptr;
+			return decode_geometry(type, Color((int)r, (int)g, (int)b), in, codec);
+		}
+
+	private:
+		enum BinaryFlags { BINARY_GEOMETRY_CODEC = 1, BINARY_INDEXED = 2 }; /*!< Flags of the binary format header */
+		enum { chunk_size = 1024 }; /*!< Number of components encoded or decoded by one task, fixed so the output does not depend on the number of threads */
+		/*!
+		A range of the text format, with the shapes and the annotation parsed from it
+		*/
+		struct TextChunk
+		{
+			TextChunk() : annotated(false) {}
+			std::string text; /*!< The text of the chunk */
+			std::vector<Shape*> shapes; /*!< Shapes parsed from the text */
+			std::string annotation; /*!< Annotation parsed from the text, if annotated */
+			bool annotated; /*!< True if the chunk holds an annotation */
+		};
+		/*!
+		A range of components of the indexed layout being encoded
+		*/
+		struct IndexChunk
+		{
+			IndexChunk() : base(0) {}
+			std::string geometry; /*!< Geometry of the components of the range */
+			std::vector<std::size_t> offsets; /*!< Offsets of the components in geometry */
+			std::vector<BoundingBox> boxes; /*!< Bounding boxes of the components */
+			std::size_t base; /*!< Offset of geometry in the whole geometry section */
+			std::string index; /*!< Index entries of the components */
+		};
+		/*!
+		Number of chunks needed for count components
+		*/
+		static std::size_t nb_chunks(std::size_t count)
+		{
+			return (count + chunk_size - 1) / chunk_size;
+		}
+		enum { binary_magic_size = 4 }; /*!< Size of the magic starting every binary serialization */
+		/*!
+		Magic starting every binary serialization
+		*/
+		static const char* binary_magic()
+		{
+			return "\0PW\1";
+		}
+		/*!
+		Parse the shapes and the annotation of a chunk of the text format
+		*/
+		static void parse_text(TextChunk& chunk)
+		{
+			std::istringstream buf(chunk.text);
 			for (std::string word; buf >> word;)
 			{
 				switch (Shape::ShapeStringToEnum(word))
@@ -1289,7 +1689,7 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Circle(Vec2(x, y), rad, Color(r, g, b)));
+							chunk.shapes.push_back(new Circle(Vec2(x, y), rad, Color(r, g, b)));
 						}
 						catch (std::exception& e)
 						{
@@ -1318,7 +1718,7 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Polygon(points, Color(r, g, b)));
+							chunk.shapes.push_back(new Polygon(points, Color(r, g, b)));
 						}
 						catch (std::exception& e)
 						{
@@ -1344,7 +1744,7 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Line(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b)));
+							chunk.shapes.push_back(new Line(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b)));
 						}
 						catch (std::exception& e)
 						{
@@ -1370,7 +1770,7 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Ellipse(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b)));
+							chunk.shapes.push_back(new Ellipse(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b)));
 						}
 						catch (std::exception& e)
 						{
@@ -1381,31 +1781,274 @@ namespace Patchwork
 					case Shape::UNKNOWN:
 					{
 						//Assume only annotation cast the unknown shape enum
-						buf >> word;
-						int string_size = std::stoi(word);
-						char buffer[1024];
-						buf.getline(buffer, string_size + 2);
-						std::string annotation = std::string(buffer);
-						annotate(annotation);
+						try
+						{
+							buf >> word;
+							int string_size = std::stoi(word);
+							//One space, then string_size characters, at most what is left of the text
+							buf.get();
+							std::string annotation((std::size_t)std::max(0, std::min(string_size, (int)chunk.text.size())), '\0');
+							buf.read(&annotation[0], annotation.size());
+							annotation.resize((std::size_t)buf.gcount());
+							chunk.annotation = annotation;
+							chunk.annotated = true;
+						}
+						catch (std::exception& e)
+						{
+							std::cout << "Bad format : " << e.what() << std::endl;
+						}
 					}break;
 				}
 			}
 		}
+		/*!
+		Split the text format into chunks of chunk_size components, so they can be parsed in parallel.
+		Chunks start on a shape keyword, and everything from the first annotation goes in the last chunk.
+		*/
+		static void split_text(const std::string& s, std::vector<TextChunk>& chunks)
+		{
+			std::size_t limit = std::min(s.find(" annotation "), s.size());
+			std::size_t begin = 0;
+			std::size_t count = 0;
+			for (std::size_t pos = s.find(' '); pos < limit; pos = s.find(' ', pos + 1))
+			{
+				if (pos + 1 >= s.size() || !std::isalpha((unsigned char)s[pos + 1]))
+					continue;
+				std::size_t end = std::min(s.find(' ', pos + 1), s.size());
+				if (Shape::ShapeStringToEnum(s.substr(pos + 1, end - pos - 1)) == Shape::END_ENUM)
+					continue;
+				if (count > 0 && count % chunk_size == 0)
+				{
+					chunks.push_back(TextChunk());
+					chunks.back().text = s.substr(begin, pos - begin);
+					begin = pos;
+				}
+				++count;
+			}
+			chunks.push_back(TextChunk());
+			chunks.back().text = s.substr(begin);
+		}
+		/*!
+		Read the geometry of one component of the binary format, return nullptr if malformed
+		*/
+		static Shape* decode_geometry(Shape::Derivedtype type, Color color, ByteReader& in, const GeometryCodec* codec)
+		{
+			switch (type)
+			{
+				case Shape::CIRCLE:
+				{
+					float x, y, rad;
+					if (in.get_float(x) && in.get_float(y) && in.get_float(rad))
+						return new Circle(Vec2(x, y), rad, color);
+				}break;
+
+				case Shape::POLYGON:
+				{
+					std::vector<Vec2> points;
+					if (codec)
+					{
+						if (codec->decode(in, points))
+							return new Polygon(points, color);
+						break;
+					}
+					uint64_t nb_pts;
+					if (!in.get_varint(nb_pts) || nb_pts > in.remaining() / 8)
+						break;
+					points.reserve((std::size_t)nb_pts);
+					for (uint64_t i = 0; i < nb_pts; ++i)
+					{
+						float x, y;
+						in.get_float(x);
+						in.get_float(y);
+						points.push_back(Vec2(x, y));
+					}
+					return new Polygon(points, color);
+				}break;
+
+				case Shape::LINE:
+				{
+					float x, y, dir_x, dir_y;
+					if (in.get_float(x) && in.get_float(y) && in.get_float(dir_x) && in.get_float(dir_y))
+						return new Line(Vec2(x, y), Vec2(dir_x, dir_y), color);
+				}break;
 
+				case Shape::ELLIPSE:
+				{
+					float x, y, rad_x, rad_y;
+					if (in.get_float(x) && in.get_float(y) && in.get_float(rad_x) && in.get_float(rad_y))
+						return new Ellipse(Vec2(x, y), Vec2(rad_x, rad_y), color);
+				}break;
+
+				default:
+					break;
+			}
+			return nullptr;
+		}
 		/*!
-		Getter for the image' components list
+		Read the components of a buffer which is not indexed, up to the END_ENUM type byte
 		*/
-		std::vector< Shape* >& components()
+		bool deserialize_components(ByteReader& in, const GeometryCodec* codec)
+		{
+			for (;;)
+			{
+				uint8_t type;
+				if (!in.get_u8(type))
+					return false;
+				if (type == Shape::END_ENUM)
+					return true;
+				Shape* shape = decode_component((Shape::Derivedtype)type, in, codec);
+				if (!shape)
+				{
+					std::cout << "Bad format : binary component" << std::endl;
+					return false;
+				}
+				add_component(shape);
+			}
+		}
+		/*!
+		Read the index and the geometry section of an indexed buffer.
+		The geometry is kept encoded, components_ holding a null pointer for every component not decoded yet, and decoded right away if the image is not lazy.
+		*/
+		bool deserialize_index(ByteReader& in, const GeometryCodec* codec)
 		{
+			uint64_t count;
+			if (!in.get_varint(count) || count > in.remaining())
+				return false;
+			std::vector<ComponentInfo> index;
+			index.reserve((std::size_t)count);
+			for (uint64_t i = 0; i < count; ++i)
+			{
+				uint8_t type;
+				int64_t r, g, b, x_min, y_min, x_max, y_max;
+				uint64_t offset;
+				if (!in.get_u8(type) || !in.get_svarint(r) || !in.get_svarint(g) || !in.get_svarint(b) ||
+					!in.get_svarint(x_min) || !in.get_svarint(y_min) || !in.get_svarint(x_max) || !in.get_svarint(y_max) ||
+					!in.get_varint(offset))
+					return false;
+				if (type >= Shape::IMAGE || (!index.empty() && offset < index.back().offset))
+					return false;
+				ComponentInfo info;
+				info.type = (Shape::Derivedtype)type;
+				info.color = Color((int)r, (int)g, (int)b);
+				//As encoded, the origin is part of the offset applied when queried
+				info.bb.x_min = (int)x_min;
+				info.bb.y_min = (int)y_min;
+				info.bb.x_max = (int)x_max;
+				info.bb.y_max = (int)y_max;
+				info.offset = offset;
+				index.push_back(info);
+			}
+			uint64_t size;
+			std::string geometry;
+			if (!in.get_varint(size) || !in.get_bytes(geometry, (std::size_t)size))
+				return false;
+			if (!index.empty() && index.back().offset > size)
+				return false;
 			std::lock_guard<std::mutex> guard(mutex);
-			return components_;
+			index_.swap(index);
+			encoded_.swap(geometry);
+			has_codec_ = codec != nullptr;
+			if (codec)
+				codec_ = *codec;
+			offset_ = origin_;
+			//Ids are reserved now, as components are decoded in any order
+			first_id_ = next_id_ + 1;
+			next_id_ += (uint32_t)index_.size();
+			components_.assign(index_.size(), nullptr);
+			if (!lazy_)
+				materialize();
+			return true;
+		}
+		/*!
+		Bounding box of the i-th component from the index, moved by the translation applied when decoding.
+		It is rounded outward, so that it still holds the component after any number of fractional translations.
+		The mutex must be held.
+		*/
+		BoundingBox indexed_box(std::size_t i) const
+		{
+			BoundingBox bb = index_[i].bb;
+			bb.x_min = (int)std::floor(bb.x_min + offset_.x);
+			bb.x_max = (int)std::ceil(bb.x_max + offset_.x);
+			bb.y_min = (int)std::floor(bb.y_min + offset_.y);
+			bb.y_max = (int)std::ceil(bb.y_max + offset_.y);
+			return bb;
+		}
+		/*!
+		Decode the geometry of the i-th component from the geometry section, return nullptr if malformed.
+		The mutex must be held.
+		*/
+		Shape* decode_at(std::size_t i)
+		{
+			std::size_t begin = (std::size_t)index_[i].offset;
+			std::size_t end = i + 1 < index_.size() ? (std::size_t)index_[i + 1].offset : encoded_.size();
+			ByteReader in(encoded_.data() + begin, end - begin);
+			Shape* shape = decode_geometry(index_[i].type, index_[i].color, in, has_codec_ ? &codec_ : nullptr);
+			if (!shape)
+			{
+				std::cout << "Bad format : binary component" << std::endl;
+				return nullptr;
+			}
+			shape->translate(offset_);
+			shape->id(first_id_ + (uint32_t)i);
+			return shape;
+		}
+		/*!
+		Decode every component not decoded yet, dropping the malformed ones, then release the encoded geometry.
+		Ranges of chunk_size components are decoded in parallel.
+		The mutex must be held.
+		*/
+		void materialize()
+		{
+			if (index_.empty())
+				return;
+			ThreadPool::shared().parallel_for(nb_chunks(components_.size()), [&](std::size_t c)
+			{
+				std::size_t end = std::min(components_.size(), (c + 1) * chunk_size);
+				for (std::size_t i = c * chunk_size; i < end; ++i)
+				{
+					if (!components_[i])
+						components_[i] = decode_at(i);
+				}
+			});
+			components_.erase(std::remove(components_.begin(), components_.end(), (Shape*)nullptr), components_.end());
+			index_.clear();
+			encoded_.clear();
+			encoded_.shrink_to_fit();
+		}
+		/*!
+		Collect the components, nested images being replaced by their own components.
+		The mutex must be held. The nested images are locked, and stay so as long as the locks added to held.
+		*/
+		void flatten(std::vector<Shape*>& leaves, std::vector< std::unique_lock<std::mutex> >& held)
+		{
+			materialize();
+			for (auto component : components_)
+			{
+				if (component->type() == Shape::IMAGE)
+				{
+					Image* nested = static_cast<Image*>(component);
+					held.push_back(std::unique_lock<std::mutex>(nested->mutex));
+					nested->flatten(leaves, held);
+				}
+				else
+				{
+					leaves.push_back(component);
+				}
+			}
 		}
 
-	private:
 		std::vector< Shape* > components_; /*!< List of componentns */
 		std::string annotation; /*!< annotation */
 		std::mutex mutex; /*!< mutex to achieve thread safety */
 		Vec2 origin_; /*!< ellipse center */
+		bool lazy_; /*!< True if the geometry of an indexed buffer is decoded on first access */
+		std::vector<ComponentInfo> index_; /*!< Index of the components, only kept while some of them are not decoded */
+		std::string encoded_; /*!< Geometry section of the components not decoded yet */
+		GeometryCodec codec_; /*!< Codec of the geometry section */
+		bool has_codec_; /*!< True if the geometry section is compressed by codec_ */
+		Vec2 offset_; /*!< Translation to apply to the components when they are decoded */
+		uint32_t next_id_; /*!< Last id given to a component */
+		uint32_t first_id_; /*!< Id of the first component of the index, the others following in order */
 	};
 
 
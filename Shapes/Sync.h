@@ -0,0 +1,505 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Codec.h"
+#include "Shape.h"
+
+/*! \file Sync.h
+\brief Header file containing the delta synchronization of an Image with its copy on the other side of a connection.
+
+Components are identified by their id, which is stable while the image lives. The sender remembers a hash of every component
+as it was last sent, and a delta only holds the components added or modified since, the ids of the removed ones,
+and the annotation if it changed. Deltas are numbered : each one applies on top of the previous version, and the receiver
+acknowledges the version it reached, or asks for a reset (a delta holding every component) when it is not at the base version.
+
+A delta is : base version (varint), version (varint), flags (1 byte), grid (float, only if the geometry codec is used),
+the number of removed ids then the ids (varints), the number of components then, for each one, its id (varint), type (1 byte),
+color (3 svarints) and geometry as in the binary format, and the annotation length and bytes if it changed.
+A nested image is written as its serialize_binary buffer, with its length.
+
+A transformation of one shape is sent as an Operation instead of a delta : base version, version, shape id, transformation
+(a Shape::Functions) and its parameters as floats, a few dozen bytes whatever the size of the shape. Operations share the
+version numbers of the deltas, so both are applied in the order they were made.
+*/
+
+namespace Patchwork
+{
+	enum SyncFlags { SYNC_RESET = 1, SYNC_GEOMETRY_CODEC = 2, SYNC_ANNOTATION = 4 }; /*!< Flags of a delta */
+
+	/*!
+	Append a component, without its id, to a delta
+	*/
+	inline void encode_sync_component(Shape* shape, const GeometryCodec* codec, std::string& out)
+	{
+		put_u8(out, (uint8_t)shape->type());
+		if (shape->type() == Shape::IMAGE)
+		{
+			std::string nested;
+			static_cast<Image*>(shape)->serialize_binary(nested, codec);
+			put_varint(out, nested.size());
+			out.append(nested);
+			return;
+		}
+		put_svarint(out, shape->color().r);
+		put_svarint(out, shape->color().g);
+		put_svarint(out, shape->color().b);
+		shape->encode(out, codec);
+	}
+	/*!
+	Read a component written by encode_sync_component, return nullptr if malformed
+	*/
+	inline Shape* decode_sync_component(ByteReader& in, const GeometryCodec* codec)
+	{
+		uint8_t type;
+		if (!in.get_u8(type) || type >= Shape::END_ENUM)
+			return nullptr;
+		if (type != Shape::IMAGE)
+			return Image::decode_component((Shape::Derivedtype)type, in, codec);
+		uint64_t size;
+		std::string nested;
+		if (!in.get_varint(size) || !in.get_bytes(nested, (std::size_t)size))
+			return nullptr;
+		Image* image = new Image();
+		if (!image->deserialize_binary(nested))
+		{
+			delete image;
+			return nullptr;
+		}
+		return image;
+	}
+
+	/*!
+	Transformation of one shape of an image : the shape id, the transformation and its parameters
+	*/
+	struct Operation
+	{
+		Operation(uint32_t id = 0, Shape::Functions function = Shape::UNKNOWN, float a = 0.f, float b = 0.f, float c = 0.f, float d = 0.f)
+			: id(id), function(function)
+		{
+			params[0] = a;
+			params[1] = b;
+			params[2] = c;
+			params[3] = d;
+		}
+		/*!
+		Number of parameters of a transformation : angle for the rotation, ratio for the homothety, vector for the translation,
+		point and direction for the axial symetry, center for the central symetry
+		*/
+		static std::size_t nb_params(Shape::Functions function)
+		{
+			switch (function)
+			{
+				case Shape::ROTATION: return 1;
+				case Shape::HOMOTHETY: return 1;
+				case Shape::TRANSLATE: return 2;
+				case Shape::AXIAL_SYMETRY: return 4;
+				case Shape::CENTRAL_SYMETRY: return 2;
+				default: return 0;
+			}
+		}
+		/*!
+		Apply the transformation to shape
+		*/
+		void apply(Shape* shape) const
+		{
+			switch (function)
+			{
+				case Shape::ROTATION: shape->rotate(params[0]); break;
+				case Shape::HOMOTHETY: shape->homothety(params[0]); break;
+				case Shape::TRANSLATE: shape->translate(Vec2(params[0], params[1])); break;
+				case Shape::AXIAL_SYMETRY: shape->axialSym(Vec2(params[0], params[1]), Vec2(params[2], params[3])); break;
+				case Shape::CENTRAL_SYMETRY: shape->centralSym(Vec2(params[0], params[1])); break;
+				default: break;
+			}
+		}
+		void encode(std::string& out) const
+		{
+			put_varint(out, id);
+			put_u8(out, (uint8_t)function);
+			for (std::size_t i = 0; i < nb_params(function); ++i)
+				put_float(out, params[i]);
+		}
+		/*!
+		Read an operation written by encode, return false if malformed
+		*/
+		bool decode(ByteReader& in)
+		{
+			uint64_t new_id;
+			uint8_t new_function;
+			if (!in.get_varint(new_id) || !in.get_u8(new_function) || new_function >= Shape::UNKNOWN)
+				return false;
+			id = (uint32_t)new_id;
+			function = (Shape::Functions)new_function;
+			for (std::size_t i = 0; i < nb_params(function); ++i)
+			{
+				if (!in.get_float(params[i]))
+					return false;
+			}
+			return true;
+		}
+
+		uint32_t id; /*!< Id of the transformed shape */
+		Shape::Functions function; /*!< The transformation */
+		float params[4]; /*!< Parameters of the transformation, see nb_params */
+	};
+
+	/*!
+	Find the component with the given id, nullptr if there is none
+	*/
+	inline Shape* find_component(std::vector<Shape*>& components, uint32_t id)
+	{
+		for (auto shape : components)
+		{
+			if (shape->id() == id)
+				return shape;
+		}
+		return nullptr;
+	}
+
+	/*!
+	Sending side of the synchronization of an image.
+	Not thread safe : the caller serializes the calls.
+	*/
+	class SyncSender
+	{
+	public:
+		/*!
+		Create a sender compressing the polygons with codec, which may be null and must outlive the sender.
+		The first delta has version + 1.
+		*/
+		SyncSender(const GeometryCodec* codec = nullptr, uint64_t version = 0) : codec_(codec), version_(version), acked_(0), reset_version_(0), reset_(true) {}
+		/*!
+		Write in out the delta between img and what was sent last, and remember img as sent.
+		Return false, writing nothing, if nothing changed.
+		*/
+		bool make_delta(Image& img, std::string& out)
+		{
+			std::vector<Shape*>& components = img.components();
+			std::unordered_map<uint32_t, uint64_t> state;
+			state.reserve(components.size());
+			std::string upserts;
+			uint64_t nb_upserts = 0;
+			std::string component;
+			for (auto shape : components)
+			{
+				component.clear();
+				encode_sync_component(shape, codec_, component);
+				uint64_t hash = fnv1a(component);
+				state[shape->id()] = hash;
+				auto it = sent_.find(shape->id());
+				if (reset_ || it == sent_.end() || it->second != hash)
+				{
+					put_varint(upserts, shape->id());
+					upserts.append(component);
+					++nb_upserts;
+				}
+			}
+			std::vector<uint32_t> removed;
+			if (!reset_)
+			{
+				for (auto& sent : sent_)
+				{
+					if (!state.count(sent.first))
+						removed.push_back(sent.first);
+				}
+				std::sort(removed.begin(), removed.end());
+			}
+			std::string annotation = img.get_annotation();
+			bool annotated = reset_ || annotation != annotation_;
+			if (!reset_ && !nb_upserts && removed.empty() && !annotated)
+				return false;
+
+			put_varint(out, version_);
+			put_varint(out, ++version_);
+			put_u8(out, (reset_ ? SYNC_RESET : 0) | (codec_ ? SYNC_GEOMETRY_CODEC : 0) | (annotated ? SYNC_ANNOTATION : 0));
+			if (codec_)
+				put_float(out, codec_->grid());
+			put_varint(out, removed.size());
+			for (auto id : removed)
+				put_varint(out, id);
+			put_varint(out, nb_upserts);
+			out.append(upserts);
+			if (annotated)
+			{
+				put_varint(out, annotation.size());
+				out.append(annotation);
+			}
+
+			sent_.swap(state);
+			annotation_ = annotation;
+			if (reset_)
+			{
+				reset_version_ = version_;
+				reset_ = false;
+			}
+			return true;
+		}
+		/*!
+		Apply op to img, and write in out the operation message telling the receiver to do the same.
+		Return false, writing nothing, if the shape has changes not sent yet : the receiver copy differs,
+		so the shape will go with the next delta instead.
+		*/
+		bool make_operation(Image& img, const Operation& op, std::string& out)
+		{
+			Shape* shape = find_component(img.components(), op.id);
+			if (!shape)
+				return false;
+			std::string component;
+			encode_sync_component(shape, codec_, component);
+			auto it = sent_.find(op.id);
+			bool in_sync = !reset_ && it != sent_.end() && it->second == fnv1a(component);
+			op.apply(shape);
+			if (!in_sync)
+				return false;
+			//The receiver will reach the same state by applying the operation
+			component.clear();
+			encode_sync_component(shape, codec_, component);
+			it->second = fnv1a(component);
+			put_varint(out, version_);
+			put_varint(out, ++version_);
+			op.encode(out);
+			return true;
+		}
+		/*!
+		Record that the receiver reached version
+		*/
+		void acknowledge(uint64_t version)
+		{
+			acked_ = std::max(acked_, version);
+		}
+		/*!
+		Record that the receiver rejected version. Return true if a reset is needed, in which case the next delta holds every component.
+		Rejections of deltas sent before the last reset are ignored, the reset already fixes them.
+		*/
+		bool rejected(uint64_t version)
+		{
+			if (version < reset_version_ || reset_)
+				return false;
+			reset();
+			return true;
+		}
+		/*!
+		Forget what was sent, the next delta holds every component
+		*/
+		void reset()
+		{
+			sent_.clear();
+			annotation_.clear();
+			reset_ = true;
+		}
+		/*!
+		Version of the last delta made
+		*/
+		uint64_t version() const
+		{
+			return version_;
+		}
+		/*!
+		Last version acknowledged by the receiver
+		*/
+		uint64_t acknowledged() const
+		{
+			return acked_;
+		}
+
+	private:
+		const GeometryCodec* codec_; /*!< Codec of the polygons, may be null */
+		std::unordered_map<uint32_t, uint64_t> sent_; /*!< Hash of every component as last sent, by id */
+		std::string annotation_; /*!< Annotation as last sent */
+		uint64_t version_; /*!< Version of the last delta made, versions keep growing across resets */
+		uint64_t acked_; /*!< Last version acknowledged by the receiver */
+		uint64_t reset_version_; /*!< Version of the last reset sent */
+		bool reset_; /*!< True if the next delta must hold every component */
+	};
+
+	/*!
+	Receiving side of the synchronization of an image
+	*/
+	class SyncReceiver
+	{
+	public:
+		enum Status { APPLIED, OUT_OF_SYNC, BAD_DELTA };
+
+		SyncReceiver() : version_(0) {}
+		/*!
+		Apply a delta to img. version is set to the version of the delta, to acknowledge or reject it.
+		Return OUT_OF_SYNC if the image is not at the base version of the delta, and BAD_DELTA if it is malformed : the image is then left untouched.
+		*/
+		Status apply(Image& img, const std::string& delta, uint64_t& version)
+		{
+			ByteReader in(delta);
+			uint64_t base;
+			uint8_t flags;
+			version = 0;
+			if (!in.get_varint(base) || !in.get_varint(version) || !in.get_u8(flags))
+				return BAD_DELTA;
+			bool reset = (flags & SYNC_RESET) != 0;
+			if (!reset && (version_ == 0 || base != version_))
+				return OUT_OF_SYNC;
+			GeometryCodec codec;
+			if (flags & SYNC_GEOMETRY_CODEC)
+			{
+				float grid;
+				if (!in.get_float(grid))
+					return BAD_DELTA;
+				codec = GeometryCodec(grid);
+			}
+
+			//Read everything first, so that a malformed delta changes nothing
+			std::vector<uint32_t> removed;
+			std::vector< std::pair<uint32_t, Shape*> > upserts;
+			std::string annotation;
+			if (!read_delta(in, flags, (flags & SYNC_GEOMETRY_CODEC) ? &codec : nullptr, removed, upserts, annotation))
+			{
+				for (auto& upsert : upserts)
+					delete upsert.second;
+				return BAD_DELTA;
+			}
+
+			std::vector<Shape*>& components = img.components();
+			if (reset)
+			{
+				for (auto shape : components)
+					delete shape;
+				components.clear();
+			}
+			if (!removed.empty())
+			{
+				std::sort(removed.begin(), removed.end());
+				auto end = std::remove_if(components.begin(), components.end(), [&](Shape* shape)
+				{
+					if (!std::binary_search(removed.begin(), removed.end(), shape->id()))
+						return false;
+					delete shape;
+					return true;
+				});
+				components.erase(end, components.end());
+			}
+			std::unordered_map<uint32_t, std::size_t> positions;
+			positions.reserve(components.size());
+			for (std::size_t i = 0; i < components.size(); ++i)
+				positions[components[i]->id()] = i;
+			std::vector<Shape*> added;
+			for (auto& upsert : upserts)
+			{
+				upsert.second->id(upsert.first);
+				auto it = positions.find(upsert.first);
+				if (it == positions.end())
+				{
+					added.push_back(upsert.second);
+					continue;
+				}
+				upsert.second->translate(img.origin());
+				delete components[it->second];
+				components[it->second] = upsert.second;
+			}
+			for (auto shape : added)
+				img.add_component(shape);
+			if (flags & SYNC_ANNOTATION)
+				img.annotate(annotation);
+			version_ = version;
+			return APPLIED;
+		}
+		/*!
+		Apply an operation message to img. version is set to the version of the operation, to acknowledge or reject it.
+		Return OUT_OF_SYNC if the image is not at the base version or has no such shape, and BAD_DELTA if the message is malformed.
+		*/
+		Status apply_operation(Image& img, const std::string& message, uint64_t& version)
+		{
+			ByteReader in(message);
+			uint64_t base;
+			Operation op;
+			version = 0;
+			if (!in.get_varint(base) || !in.get_varint(version) || !op.decode(in))
+				return BAD_DELTA;
+			if (version_ == 0 || base != version_)
+				return OUT_OF_SYNC;
+			Shape* shape = find_component(img.components(), op.id);
+			if (!shape)
+				return OUT_OF_SYNC;
+			op.apply(shape);
+			version_ = version;
+			return APPLIED;
+		}
+		/*!
+		Version the image reached, 0 if it was not synchronized yet
+		*/
+		uint64_t version() const
+		{
+			return version_;
+		}
+		/*!
+		Version of a delta or an operation message, 0 if malformed
+		*/
+		static uint64_t version_of(const std::string& message)
+		{
+			ByteReader in(message);
+			uint64_t base, version;
+			if (!in.get_varint(base) || !in.get_varint(version))
+				return 0;
+			return version;
+		}
+		/*!
+		Write in out a reset delta bringing any image to the state of img at the version of this receiver,
+		so that a replica receiving it can apply the next deltas too. Return false if the image was not synchronized yet.
+		*/
+		bool snapshot(Image& img, std::string& out) const
+		{
+			if (version_ == 0)
+				return false;
+			SyncSender sender(nullptr, version_ - 1);
+			return sender.make_delta(img, out);
+		}
+		/*!
+		Forget the version, when the image was replaced by other means : the next delta will have to be a reset
+		*/
+		void reset()
+		{
+			version_ = 0;
+		}
+
+	private:
+		/*!
+		Read the removed ids, the components and the annotation of a delta
+		*/
+		static bool read_delta(ByteReader& in, uint8_t flags, const GeometryCodec* codec,
+			std::vector<uint32_t>& removed, std::vector< std::pair<uint32_t, Shape*> >& upserts, std::string& annotation)
+		{
+			uint64_t count;
+			if (!in.get_varint(count) || count > in.remaining())
+				return false;
+			for (uint64_t i = 0; i < count; ++i)
+			{
+				uint64_t id;
+				if (!in.get_varint(id))
+					return false;
+				removed.push_back((uint32_t)id);
+			}
+			if (!in.get_varint(count) || count > in.remaining())
+				return false;
+			for (uint64_t i = 0; i < count; ++i)
+			{
+				uint64_t id;
+				if (!in.get_varint(id) || id == 0)
+					return false;
+				Shape* shape = decode_sync_component(in, codec);
+				if (!shape)
+					return false;
+				upserts.push_back(std::make_pair((uint32_t)id, shape));
+			}
+			if (flags & SYNC_ANNOTATION)
+			{
+				uint64_t size;
+				if (!in.get_varint(size) || !in.get_bytes(annotation, (std::size_t)size))
+					return false;
+			}
+			return true;
+		}
+
+		uint64_t version_; /*!< Version of the image, 0 if it was not synchronized yet */
+	};
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! \file ThreadPool.h
+\brief Header file containing a minimal thread pool, used to encode and decode large images in parallel.
+
+*/
+
+namespace Patchwork
+{
+	/*!
+	Fixed set of worker threads executing tasks from a queue.
+	parallel_for is the only entry point used by the shapes : it splits a range of chunks between the workers and the calling thread, and returns when every chunk is done.
+	When called from a worker (nested images), it runs inline so the workers never wait on themselves.
+	*/
+	class ThreadPool
+	{
+	public:
+		/*!
+		Start nb_threads workers
+		*/
+		ThreadPool(unsigned int nb_threads) : stop_(false)
+		{
+			for (unsigned int i = 0; i < nb_threads; ++i)
+				workers_.push_back(std::thread([this](){ work(); }));
+		}
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> guard(mutex_);
+				stop_ = true;
+			}
+			wake_.notify_all();
+			for (auto& worker : workers_)
+				worker.join();
+		}
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		/*!
+		Pool shared by the whole process, with one worker per core besides the calling thread
+		*/
+		static ThreadPool& shared()
+		{
+			static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+			return pool;
+		}
+		/*!
+		Number of threads taking part in a parallel_for, the calling thread included
+		*/
+		unsigned int concurrency() const
+		{
+			return (unsigned int)workers_.size() + 1;
+		}
+		/*!
+		Call fn(i) for every i in [0, count), spread over the workers and the calling thread, and wait for all of them.
+		The order of the calls is not specified : fn must only write to data owned by chunk i.
+		*/
+		void parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn)
+		{
+			if (count == 0)
+				return;
+			if (count == 1 || workers_.empty() || in_worker())
+			{
+				for (std::size_t i = 0; i < count; ++i)
+					fn(i);
+				return;
+			}
+			//The range outlives this call in the helpers still queued : they find no chunk left and return without touching fn
+			std::shared_ptr<Range> range = std::make_shared<Range>(count, fn);
+			std::size_t nb_helpers = std::min<std::size_t>(workers_.size(), count - 1);
+			{
+				std::lock_guard<std::mutex> guard(mutex_);
+				for (std::size_t i = 0; i < nb_helpers; ++i)
+					tasks_.push_back([range]() { range->run(); });
+			}
+			wake_.notify_all();
+			range->run();
+			//Only the chunks taken by the helpers are waited for, not the helpers themselves
+			std::unique_lock<std::mutex> lock(range->mutex);
+			range->finished.wait(lock, [&]() { return range->done == count; });
+		}
+
+	private:
+		/*!
+		Chunks of a parallel_for, shared by the calling thread and its helpers
+		*/
+		struct Range
+		{
+			Range(std::size_t count, const std::function<void(std::size_t)>& fn)
+				: count(count), next(0), done(0), fn(fn)
+			{
+			}
+			/*!
+			Take chunks until none is left
+			*/
+			void run()
+			{
+				for (;;)
+				{
+					std::size_t i;
+					{
+						std::lock_guard<std::mutex> guard(mutex);
+						if (next == count)
+							return;
+						i = next++;
+					}
+					fn(i);
+					std::lock_guard<std::mutex> guard(mutex);
+					if (++done == count)
+						finished.notify_all();
+				}
+			}
+
+			const std::size_t count; /*!< Number of chunks */
+			std::size_t next; /*!< Next chunk to take */
+			std::size_t done; /*!< Number of chunks done */
+			const std::function<void(std::size_t)>& fn; /*!< Function called on each chunk, only alive until done == count */
+			std::mutex mutex; /*!< Protects next and done */
+			std::condition_variable finished; /*!< Signaled when the last chunk is done */
+		};
+		/*!
+		True if the current thread is one of the workers of a pool
+		*/
+		static bool& in_worker()
+		{
+			static thread_local bool flag = false;
+			return flag;
+		}
+		/*!
+		Loop of a worker : run tasks until the pool is destroyed
+		*/
+		void work()
+		{
+			in_worker() = true;
+			for (;;)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					wake_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+					if (stop_ && tasks_.empty())
+						return;
+					task = std::move(tasks_.front());
+					tasks_.pop_front();
+				}
+				task();
+			}
+		}
+
+		std::vector<std::thread> workers_; /*!< Worker threads */
+		std::deque<std::function<void()>> tasks_; /*!< Tasks waiting for a worker */
+		std::mutex mutex_; /*!< Protects tasks_ and stop_ */
+		std::condition_variable wake_; /*!< Signaled when a task is queued or the pool stops */
+		bool stop_; /*!< True when the pool is being destroyed */
+	};
+}
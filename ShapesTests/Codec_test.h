@@ -0,0 +1,257 @@
+#pragma once
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Shape.h"
+#include "Codec.h"
+#include "ThreadPool.h"
+#include "Asserts.h"
+
+namespace Codec_test
+{
+	using namespace Patchwork;
+	static void test_varint()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for varint" << std::endl << std::endl;
+
+		passed_test += test_assert(zigzag_encode(0) == 0 && zigzag_encode(-1) == 1 && zigzag_encode(1) == 2 && zigzag_encode(-2) == 3, "Zigzag");
+
+		bool round_trip = true;
+		std::vector<int64_t> values = { 0, 1, -1, 63, -64, 64, 300, -300, 1 << 20, -(1LL << 40), INT64_MAX, INT64_MIN };
+		std::string buf;
+		for (auto v : values)
+			put_svarint(buf, v);
+		ByteReader in(buf);
+		for (auto v : values)
+		{
+			int64_t r;
+			if (!in.get_svarint(r) || r != v)
+				round_trip = false;
+		}
+		passed_test += test_assert(round_trip && in.remaining() == 0, "Round trip");
+
+		std::string small;
+		put_svarint(small, -5);
+		passed_test += test_assert(small.size() == 1, "Small values on one byte");
+
+		std::string truncated;
+		put_varint(truncated, 1 << 20);
+		truncated.pop_back();
+		ByteReader in2(truncated);
+		uint64_t r;
+		passed_test += test_assert(!in2.get_varint(r), "Truncated");
+
+		std::cout << std::endl << "Test varint : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_geometry_codec()
+	{
+		int passed_test = 0;
+		int nb_of_test = 3;
+
+		std::cout << "Begin test suit for GeometryCodec" << std::endl << std::endl;
+
+		std::vector<Vec2> points = { { 100.25f, 200.5f }, { 101.f, 201.75f }, { 99.5f, 203.f }, { -12.34f, 0.f } };
+		GeometryCodec codec;
+		std::string buf;
+		codec.encode(points, buf);
+		passed_test += test_assert(buf.size() < points.size() * 8, "Smaller than raw floats");
+
+		std::vector<Vec2> decoded;
+		ByteReader in(buf);
+		bool ok = codec.decode(in, decoded) && decoded.size() == points.size();
+		for (std::size_t i = 0; ok && i < points.size(); ++i)
+		{
+			if (std::fabs(decoded[i].x - points[i].x) > codec.grid() || std::fabs(decoded[i].y - points[i].y) > codec.grid())
+				ok = false;
+		}
+		passed_test += test_assert(ok, "Round trip within the grid");
+
+		buf.resize(buf.size() - 1);
+		ByteReader in2(buf);
+		passed_test += test_assert(!codec.decode(in2, decoded), "Truncated");
+
+		std::cout << std::endl << "Test GeometryCodec : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_image_binary()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for Image binary format" << std::endl << std::endl;
+
+		Image im;
+		im.add_component(new Circle(Vec2(1.5f, 2.f), 10.f, Color(255, 0, 0)));
+		im.add_component(new Polygon({ { 0, 1 }, { 1, 1 }, { 1, 0 }, { 0, 0 } }, Color(0, 0, 255)));
+		im.add_component(new Line(Vec2(0, 0), Vec2(3, 4), Color(1, 2, 3)));
+		im.add_component(new Ellipse(Vec2(5, 5), Vec2(10, 3), Color()));
+		im.annotate("Nice drawing");
+
+		std::string text, raw, packed;
+		im.serialize(text);
+		im.serialize_binary(raw);
+		GeometryCodec codec;
+		im.serialize_binary(packed, &codec);
+		passed_test += test_assert(Image::is_binary(raw) && Image::is_binary(packed) && !Image::is_binary(text), "Format detection");
+		passed_test += test_assert(packed.size() < text.size(), "Smaller than text");
+
+		Image im2;
+		im2.deserialize(packed);
+		std::string text2;
+		im2.serialize(text2);
+		passed_test += test_assert(text == text2, "Round trip with codec");
+
+		Image im3;
+		im3.deserialize(raw);
+		std::string text3;
+		im3.serialize(text3);
+		passed_test += test_assert(text == text3, "Round trip without codec");
+
+		Image im4;
+		passed_test += test_assert(!im4.deserialize_binary(packed.substr(0, packed.size() - 3)), "Truncated");
+
+		std::cout << std::endl << "Test Image binary format : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_image_indexed()
+	{
+		int passed_test = 0;
+		int nb_of_test = 6;
+
+		std::cout << "Begin test suit for Image indexed format" << std::endl << std::endl;
+
+		Image im;
+		im.add_component(new Circle(Vec2(1.5f, 2.f), 10.f, Color(255, 0, 0)));
+		im.add_component(new Polygon({ { 0, 1 }, { 1, 1 }, { 1, 0 }, { 0, 0 } }, Color(0, 0, 255)));
+		im.add_component(new Ellipse(Vec2(5, 5), Vec2(10, 3), Color(1, 2, 3)));
+		im.annotate("Indexed");
+
+		std::string text, indexed;
+		im.serialize(text);
+		GeometryCodec codec;
+		im.serialize_binary(indexed, &codec, true);
+
+		Image eager;
+		eager.deserialize(indexed);
+		std::string text2;
+		eager.serialize(text2);
+		passed_test += test_assert(text == text2, "Round trip");
+
+		Image lazy;
+		lazy.lazy(true);
+		lazy.deserialize(indexed);
+		std::vector<ComponentInfo> infos = lazy.component_infos();
+		passed_test += test_assert(infos.size() == 3 && infos[1].type == Shape::POLYGON && infos[2].color == Color(1, 2, 3), "Index types and colors");
+		BoundingBox a = lazy.bounding_box();
+		BoundingBox b = im.bounding_box();
+		passed_test += test_assert(a.x_min == b.x_min && a.x_max == b.x_max && a.y_min == b.y_min && a.y_max == b.y_max, "Bounding box from the index");
+
+		lazy.translate(Vec2(10, 20));
+		im.translate(Vec2(10, 20));
+		std::string text3, text4;
+		lazy.serialize(text3);
+		im.serialize(text4);
+		passed_test += test_assert(text3 == text4, "Translation before decoding");
+
+		//Fractional translations move the index too, rounded outward
+		Image drifting;
+		drifting.lazy(true);
+		drifting.deserialize(indexed);
+		Image decoded;
+		decoded.deserialize(indexed);
+		for (int i = 0; i < 10; ++i)
+		{
+			drifting.translate(Vec2(0.3f, -0.7f));
+			decoded.translate(Vec2(0.3f, -0.7f));
+		}
+		a = drifting.bounding_box();
+		b = decoded.bounding_box();
+		passed_test += test_assert(a.x_min <= b.x_min && a.x_max >= b.x_max && a.y_min <= b.y_min && a.y_max >= b.y_max
+			&& b.x_min - a.x_min <= 1 && a.x_max - b.x_max <= 1 && b.y_min - a.y_min <= 1 && a.y_max - b.y_max <= 1, "Fractional translations");
+
+		Image truncated;
+		truncated.lazy(true);
+		passed_test += test_assert(!truncated.deserialize_binary(indexed.substr(0, indexed.size() / 2)), "Truncated");
+
+		std::cout << std::endl << "Test Image indexed format : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_image_chunks()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for Image chunks" << std::endl << std::endl;
+
+		ThreadPool pool(3);
+		std::vector<int> hits(5000, 0);
+		pool.parallel_for(hits.size(), [&](std::size_t i) { hits[i]++; });
+		passed_test += test_assert(std::count(hits.begin(), hits.end(), 1) == (int)hits.size(), "Thread pool runs every chunk once");
+
+		//Enough components for several chunks, the last one partial
+		Image im;
+		for (int i = 0; i < 2500; ++i)
+		{
+			if (i % 2)
+				im.add_component(new Circle(Vec2((float)i, (float)(i % 37)), 1.f + i % 5, Color(i % 256, 0, 0)));
+			else
+				im.add_component(new Polygon({ { 0, (float)i }, { 1, (float)i }, { 1, 0 } }, Color(0, i % 256, 0)));
+		}
+		im.annotate("Chunks");
+
+		std::string text;
+		im.serialize(text);
+		Image im2;
+		im2.deserialize(text);
+		std::string text2;
+		im2.serialize(text2);
+		passed_test += test_assert(text == text2 && im2.get_annotation() == "Chunks" && im2.components().size() == 2500, "Text round trip");
+
+		//An annotation longer than any fixed buffer, with spaces and a newline
+		Image long_text;
+		std::string annotation = std::string(3000, 'a') + " b\nc";
+		long_text.annotate(annotation);
+		text.clear();
+		long_text.serialize(text);
+		Image long_text2;
+		long_text2.deserialize(text);
+		passed_test += test_assert(long_text2.get_annotation() == annotation, "Long annotation");
+
+		GeometryCodec codec;
+		std::string indexed, indexed2;
+		im.serialize_binary(indexed, &codec, true);
+		im.serialize_binary(indexed2, &codec, true);
+		passed_test += test_assert(indexed == indexed2, "Deterministic");
+
+		Image im3;
+		im3.lazy(true);
+		im3.deserialize(indexed);
+		std::string text3;
+		im3.serialize(text3);
+		Image im4;
+		im4.deserialize(indexed);
+		std::string text4;
+		im4.serialize(text4);
+		passed_test += test_assert(text3 == text4 && im3.components().size() == 2500, "Indexed round trip");
+
+		std::cout << std::endl << "Test Image chunks : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_varint();
+		std::cout << std::endl;
+		test_geometry_codec();
+		std::cout << std::endl;
+		test_image_binary();
+		std::cout << std::endl;
+		test_image_indexed();
+		std::cout << std::endl;
+		test_image_chunks();
+	}
+}
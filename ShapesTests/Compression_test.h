@@ -0,0 +1,108 @@
+#pragma once
+#include <random>
+#include <string>
+
+#include "Compression.hpp"
+#include "Shape.h"
+#include "Asserts.h"
+
+namespace Compression_test
+{
+	using namespace Patchwork;
+	static void test_lz()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for lz" << std::endl << std::endl;
+
+		Image im;
+		for (int i = 0; i < 50; ++i)
+			im.add_component(new Circle(Vec2((float)i, (float)(2 * i)), 10.f, Color(255, 0, 0)));
+		std::string text;
+		im.serialize(text);
+		std::string packed, unpacked;
+		lz::compress(text.data(), text.size(), packed);
+		passed_test += test_assert(lz::decompress(packed.data(), packed.size(), unpacked, text.size()) && unpacked == text, "Round trip text");
+		passed_test += test_assert(packed.size() * 2 < text.size(), "Text compresses");
+
+		std::mt19937 gen(1);
+		std::string noise;
+		for (int i = 0; i < 5000; ++i)
+			noise.push_back((char)(gen() & 0xFF));
+		std::string packed_noise, unpacked_noise;
+		lz::compress(noise.data(), noise.size(), packed_noise);
+		passed_test += test_assert(lz::decompress(packed_noise.data(), packed_noise.size(), unpacked_noise, noise.size()) && unpacked_noise == noise, "Round trip noise");
+
+		std::string out;
+		passed_test += test_assert(!lz::decompress(packed.data(), packed.size() / 2, out, text.size()), "Truncated");
+
+		std::cout << std::endl << "Test lz : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_payload_compression()
+	{
+		int passed_test = 0;
+		int nb_of_test = 7;
+
+		std::cout << "Begin test suit for PayloadCompression" << std::endl << std::endl;
+
+		CompressionStats stats;
+		PayloadCompression sender(&stats);
+		PayloadCompression receiver;
+		std::string payload(1000, 'a');
+		std::string body = payload;
+		sender.pack(body);
+		passed_test += test_assert(body == payload && receiver.unpack(body) && body == payload, "Untouched without the offer of the client");
+
+		std::string hello = "HELLO" + PayloadCompression::handshake(true);
+		sender.flag(hello);
+		receiver.flag(hello);
+		sender.negotiate(hello, true);
+		sender.pack(body);
+		passed_test += test_assert(body.size() < payload.size() && (uint8_t)body[0] == PayloadCompression::marker && receiver.unpack(body)
+			&& body == payload, "Round trip");
+
+		std::string small = "GET";
+		sender.pack(small);
+		passed_test += test_assert(small == std::string(1, '\0') + "GET" && receiver.unpack(small) && small == "GET"
+			&& stats.skipped == 1 && stats.messages == 1, "Threshold");
+
+		//A raw delta from base version 1 starts with the byte of the compressed payloads, the flag tells them apart
+		std::string delta;
+		put_varint(delta, 1);
+		put_varint(delta, 2);
+		put_u8(delta, 0);
+		std::string flagged = delta;
+		PayloadCompression before_answer;
+		before_answer.flag(hello);
+		before_answer.pack(flagged);
+		passed_test += test_assert(flagged.size() == delta.size() + 1 && receiver.unpack(flagged) && flagged == delta, "Raw delta from base 1");
+
+		//A compressed payload claiming more than the limit once decompressed is refused before anything is allocated
+		std::string big(4096, 'b');
+		sender.pack(big);
+		PayloadCompression limited;
+		limited.flag(hello);
+		limited.limit(1024);
+		passed_test += test_assert((uint8_t)big[0] == PayloadCompression::marker && !limited.unpack(big), "Decompressed size limited");
+
+		PayloadCompression refusing;
+		refusing.negotiate(hello, false);
+		passed_test += test_assert(!refusing.enabled(), "Refused by one side");
+
+		PayloadCompression plain;
+		plain.negotiate("HELLO" + PayloadCompression::handshake(false), true);
+		plain.flag("HELLO" + PayloadCompression::handshake(false));
+		passed_test += test_assert(!plain.enabled() && !plain.flagged(), "Not offered");
+
+		std::cout << std::endl << "Test PayloadCompression : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_lz();
+		std::cout << std::endl;
+		test_payload_compression();
+	}
+}
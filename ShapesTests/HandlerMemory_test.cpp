@@ -0,0 +1,34 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/*! \file HandlerMemory_test.cpp
+\brief Replacement of the global operator new and operator delete, counting the allocations for HandlerMemory_test.h.
+It applies to the whole test program, so it is defined once here rather than in the header.
+*/
+
+namespace HandlerMemory_test
+{
+	std::atomic<long> allocations(0);
+	std::atomic<bool> counting(false);
+}
+
+//Count the allocations of the whole test program, only while HandlerMemory_test::counting is set
+void* operator new(std::size_t size)
+{
+	if (HandlerMemory_test::counting)
+		HandlerMemory_test::allocations++;
+	void* pointer = std::malloc(size ? size : 1);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+//Kept out of line, else GCC sees operator new paired with free once inlined
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* pointer) throw()
+{
+	std::free(pointer);
+}
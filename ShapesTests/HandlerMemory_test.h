@@ -0,0 +1,166 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteQueue.hpp"
+#include "HandlerMemory.hpp"
+#include "Asserts.h"
+
+//The session tested is the one of the server, built without its entry point
+#define PATCHWORK_SERVER_NO_MAIN
+#include "../Server/Server.cpp"
+
+namespace HandlerMemory_test
+{
+	extern std::atomic<long> allocations; /*!< Number of calls to operator new while counting, see HandlerMemory_test.cpp */
+	extern std::atomic<bool> counting; /*!< True while the allocations are counted */
+
+	using boost::asio::ip::tcp;
+
+	/*!
+	Client of the server : sends its frames one at a time and waits for the answer to each, counting the allocations after the warm up frames
+	*/
+	class Pinger
+	{
+	public:
+		Pinger(boost::asio::io_service& io_service, const std::vector<Message_ptr>& frames, std::size_t warm_up)
+			: socket(io_service), io_service_(io_service), frames_(frames), next_(0), warm_up_(warm_up), replies_(0)
+		{
+			reply_.reserve(256);
+		}
+		void start()
+		{
+			if (next_ == warm_up_)
+				counting = true;
+			const Message_ptr& frame = frames_[next_++];
+			boost::asio::async_write(socket, boost::asio::buffer(frame->data(), frame->length()),
+				make_memory_handler(write_memory_, [this](boost::system::error_code ec, std::size_t)
+				{
+					if (!ec)
+						read_header();
+				}));
+		}
+		tcp::socket socket;
+		int replies() const
+		{
+			return replies_;
+		}
+
+	private:
+		void read_header()
+		{
+			boost::asio::async_read(socket, boost::asio::buffer(header_),
+				make_memory_handler(read_memory_, [this](boost::system::error_code ec, std::size_t)
+				{
+					Message::Type type;
+					std::size_t length;
+					if (ec || !Message::decode_header(header_, reply_.capacity(), type, length))
+						return;
+					reply_.resize(length);
+					boost::asio::async_read(socket, boost::asio::buffer(reply_),
+						make_memory_handler(read_memory_, [this](boost::system::error_code ec, std::size_t)
+						{
+							if (ec)
+								return;
+							replies_++;
+							if (next_ < frames_.size())
+							{
+								start();
+							}
+							else
+							{
+								counting = false;
+								io_service_.stop();
+							}
+						}));
+				}));
+		}
+
+		boost::asio::io_service& io_service_;
+		std::vector<Message_ptr> frames_;
+		std::size_t next_;
+		std::size_t warm_up_;
+		int replies_;
+		char header_[Message::header_length];
+		std::vector<char> reply_;
+		HandlerMemory read_memory_;
+		HandlerMemory write_memory_;
+	};
+
+	static void test_handler_memory()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for HandlerMemory" << std::endl << std::endl;
+
+		HandlerMemory memory;
+		void* first = memory.allocate(64);
+		void* second = memory.allocate(64);
+		memory.deallocate(second);
+		memory.deallocate(first);
+		void* third = memory.allocate(HandlerMemory::capacity);
+		memory.deallocate(third);
+		passed_test += test_assert(first != second && third == first, "Block recycled");
+		void* big = memory.allocate(HandlerMemory::capacity + 1);
+		void* again = memory.allocate(64);
+		memory.deallocate(big);
+		memory.deallocate(again);
+		passed_test += test_assert(big != first && again == first, "Heap past the capacity");
+
+		//A client of the server joins, uploads a shape, then moves it : once warmed up, the session reads, handles and answers
+		//the operations without allocating, on either side
+		const int warm_up = 100;
+		const int rounds = 1000;
+		Image drawing;
+		drawing.add_component(new Circle(Vec2(10, 10), 5, Color(255, 0, 0)));
+		SyncSender sender(nullptr);
+		std::string delta;
+		sender.make_delta(drawing, delta);
+		Handshake hello;
+		hello.push = true;
+		std::vector<Message_ptr> frames;
+		frames.push_back(std::make_shared<const Message>(Message::HELLO, hello.encode()));
+		frames.push_back(std::make_shared<const Message>(Message::SYNC, delta));
+		uint32_t circle = drawing.components().at(0)->id();
+		for (int i = 0; i < warm_up + rounds; ++i)
+		{
+			std::string operation;
+			sender.make_operation(drawing, Operation(circle, Shape::TRANSLATE, 1.f, 0.f), operation);
+			frames.push_back(std::make_shared<const Message>(Message::OPERATION, operation));
+		}
+
+		CompressionStats stats;
+		Rooms rooms;
+		boost::asio::io_service io_service;
+		tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		Pinger pinger(io_service, frames, frames.size() - rounds);
+		pinger.socket.connect(acceptor.local_endpoint());
+		tcp::socket accepted(io_service);
+		acceptor.accept(accepted);
+		auto client = std::make_shared<Client>(std::move(accepted), io_service, rooms, 1, stats, false,
+			Message::default_max_body_length, WriteQueue::DISCONNECT);
+		client->start();
+		pinger.start();
+		io_service.run();
+		bool moved;
+		{
+			std::lock_guard<std::mutex> guard(client->img_mutex);
+			moved = client->img->components().size() == 1 && client->img->components().at(0)->bounding_box().x_min == 5 + warm_up + rounds;
+		}
+		passed_test += test_assert(pinger.replies() == (int)frames.size() && moved, "Every frame answered and applied");
+		passed_test += test_assert(allocations == 0, "No allocation per operation of a client");
+
+		std::cout << std::endl << "Test HandlerMemory : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_handler_memory();
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "Handoff.hpp"
+#include "ShardedAcceptor.hpp"
+#include "Asserts.h"
+
+namespace Handoff_test
+{
+#ifdef PATCHWORK_HAS_HANDOFF
+	using boost::asio::ip::tcp;
+
+	static void test_handoff()
+	{
+		int passed_test = 0;
+		int nb_of_test = 3;
+
+		std::cout << "Begin test suit for Handoff" << std::endl << std::endl;
+
+		boost::asio::io_service io_service;
+		Handoff::protocol::socket old_end(io_service), new_end(io_service);
+		boost::asio::local::connect_pair(old_end, new_end);
+		Handoff successor(std::move(old_end));
+		Handoff predecessor(std::move(new_end));
+
+		//The old server hands its listening socket over and stops accepting, the connection is accepted by the new one
+		bool accepted_old = false, accepted_new = false;
+		ShardedAcceptor old_acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), 1,
+			[&](tcp::socket&) { accepted_old = true; });
+		std::vector<int> listeners;
+		bool sent = successor.send_descriptors(old_acceptor.handles());
+		bool received = predecessor.receive_descriptors(listeners);
+		passed_test += test_assert(sent && received && listeners.size() == 1 && listeners[0] != old_acceptor.handles()[0], "Descriptors passed");
+		unsigned short port = old_acceptor.port();
+		old_acceptor.close();
+		ShardedAcceptor new_acceptor(io_service, tcp::v4(), listeners, [&](tcp::socket&)
+		{
+			accepted_new = true;
+			io_service.stop();
+		});
+		tcp::socket client(io_service);
+		client.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+		io_service.run();
+		passed_test += test_assert(accepted_new && !accepted_old && new_acceptor.port() == port, "Listening socket taken over");
+
+		RelayRecord record(RelayRecord::SNAPSHOT, 3);
+		record.room = "blue";
+		record.identity = "c0ffee";
+		record.payload = std::string(10000, 'i');
+		RelayRecord drained(RelayRecord::SNAPSHOT, 4);
+		drained.identity = "beef";
+		RelayRecord got, got_drained;
+		successor.send(record);
+		successor.end_dump();
+		successor.send(drained);
+		successor.close();
+		bool images = predecessor.receive(got) == Handoff::RECORD && got.identity == "c0ffee" && got.room == "blue" && got.payload == record.payload;
+		bool end_of_dump = predecessor.receive(got_drained) == Handoff::END_OF_DUMP;
+		passed_test += test_assert(images && end_of_dump && predecessor.receive(got_drained) == Handoff::RECORD && got_drained.identity == "beef"
+			&& predecessor.receive(got_drained) == Handoff::CLOSED, "Images, the end of the dump, then the end");
+
+		std::cout << std::endl << "Test Handoff : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+#endif
+
+	static void run_tests()
+	{
+#ifdef PATCHWORK_HAS_HANDOFF
+		test_handoff();
+#endif
+	}
+}
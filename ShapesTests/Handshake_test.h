@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+
+#include "Handshake.hpp"
+#include "Compression.hpp"
+#include "Transport.hpp"
+#include "Asserts.h"
+
+namespace Handshake_test
+{
+	static void test_handshake()
+	{
+		int passed_test = 0;
+		int nb_of_test = 3;
+
+		std::cout << "Begin test suit for Handshake" << std::endl << std::endl;
+
+		Handshake joining;
+		joining.push = true;
+		joining.room = "atelier";
+		joining.identity = "9f3b";
+		Handshake received = Handshake::parse(joining.encode());
+		passed_test += test_assert(received.push && received.room == "atelier" && received.identity == "9f3b" && received.version == 0,
+			"Room and identity of the client");
+
+		Handshake answer;
+		answer.version = 12;
+		received = Handshake::parse(answer.encode());
+		Handshake plain = Handshake::parse(Handshake().encode());
+		passed_test += test_assert(received.version == 12 && !received.push && received.room.empty() && received.identity.empty()
+			&& Handshake().encode() == "HELLO" && !plain.push && plain.room.empty() && plain.version == 0, "Version of the server");
+
+		//The tokens of the other features follow the session fields, each side reading its own
+		std::string hello = joining.encode() + PayloadCompression::handshake(true) + SharedRing::handshake("/patchwork-9f3b");
+		received = Handshake::parse(hello);
+		PayloadCompression compression;
+		compression.negotiate(hello, true);
+		passed_test += test_assert(received.room == "atelier" && received.identity == "9f3b" && compression.enabled()
+			&& SharedRing::name_in(hello) == "/patchwork-9f3b", "Tokens of the other features");
+
+		std::cout << std::endl << "Test Handshake : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_handshake();
+	}
+}
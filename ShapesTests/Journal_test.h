@@ -0,0 +1,153 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#if _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Journal.hpp"
+#include "Shape.h"
+#include "Sync.h"
+#include "Asserts.h"
+
+namespace Journal_test
+{
+	using namespace Patchwork;
+	static const std::string directory = "journal_test";
+
+	/*!
+	Delete the files a test left in directory, then the directory
+	*/
+	static void clean()
+	{
+		std::remove((directory + "/snapshot").c_str());
+		std::remove((directory + "/snapshot.tmp").c_str());
+		for (int generation = 0; generation < 8; ++generation)
+			std::remove((directory + "/journal." + std::to_string(generation)).c_str());
+#if _WIN32
+		_rmdir(directory.c_str());
+#else
+		rmdir(directory.c_str());
+#endif
+	}
+
+	static bool exists(const std::string& path)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "rb");
+		if (file)
+			std::fclose(file);
+		return file != nullptr;
+	}
+
+	static RelayRecord change(RelayRecord::Kind kind, const std::string& identity, const std::string& payload)
+	{
+		RelayRecord record(kind, 1);
+		record.room = "blue";
+		record.identity = identity;
+		record.payload = payload;
+		return record;
+	}
+
+	static void test_journal()
+	{
+		int passed_test = 0;
+		int nb_of_test = 6;
+
+		std::cout << "Begin test suit for Journal" << std::endl << std::endl;
+		clean();
+
+		//A client joins then sends two deltas, and the server stops without a word
+		Image client;
+		for (int i = 0; i < 20; ++i)
+			client.add_component(new Circle(Vec2((float)i, (float)i), 5.f, Color(0, 0, 255)));
+		SyncSender sender;
+		std::string first, second;
+		sender.make_delta(client, first);
+		client.components().at(3)->translate(Vec2(1, 1));
+		sender.make_delta(client, second);
+		std::string expected;
+		client.serialize(expected);
+		{
+			Journal journal(directory);
+			journal.open();
+			journal.append(change(RelayRecord::JOIN, "c0ffee", std::string()));
+			journal.append(change(RelayRecord::SYNC, "c0ffee", first));
+			journal.append(change(RelayRecord::SYNC, "c0ffee", second));
+			journal.append(change(RelayRecord::SYNC, std::string(), first));
+		}
+
+		Image img;
+		SyncReceiver sync;
+		std::string got;
+		{
+			Journal journal(directory);
+			journal.open();
+			passed_test += test_assert(journal.stats().restored == 1 && journal.resume("c0ffee", img, sync) && sync.version() == 2
+				&& (img.serialize(got), got == expected), "Resumed after a restart");
+			Image other;
+			SyncReceiver other_sync;
+			passed_test += test_assert(!journal.resume("c0ffee", other, other_sync) && !journal.resume("cafe", other, other_sync),
+				"Resumed once");
+			RelayRecord parked = change(RelayRecord::SNAPSHOT, "c0ffee", std::string());
+			sync.snapshot(img, parked.payload);
+			journal.park(parked);
+		}
+
+		//The journal holds the image parked, the snapshot the images of the connected clients
+		{
+			Journal journal(directory, 1);
+			journal.open();
+			journal.append(change(RelayRecord::LEAVE, "c0ffee", std::string()));
+			std::vector<Journal::Snapshotter> live;
+			live.push_back([&](RelayRecord& record)
+			{
+				record = change(RelayRecord::SNAPSHOT, "beef", std::string());
+				return sync.snapshot(img, record.payload);
+			});
+			passed_test += test_assert(journal.compaction_due(), "Compaction due");
+			journal.compact(live);
+			journal.wait();
+			passed_test += test_assert(journal.stats().compactions == 1 && !exists(directory + "/journal.0"),
+				"Old journals deleted");
+			journal.append(change(RelayRecord::SYNC, "beef", first));
+		}
+
+		//A crash in the middle of a frame
+		std::FILE* file = std::fopen((directory + "/journal.3").c_str(), "ab");
+		std::fwrite("\x40partial", 1, 8, file);
+		std::fclose(file);
+		//And a length of 32 GB in the next journal, which is not allocated
+		file = std::fopen((directory + "/journal.4").c_str(), "wb");
+		std::fwrite("PWJ1\x80\x80\x80\x80\x80\x01", 1, 10, file);
+		std::fclose(file);
+		{
+			Journal journal(directory);
+			journal.open();
+			Image beef;
+			SyncReceiver beef_sync;
+			got.clear();
+			passed_test += test_assert(journal.stats().restored == 2 && journal.resume("beef", beef, beef_sync) && beef_sync.version() == 2
+				&& (beef.serialize(got), got == expected), "Truncated tail and bad length");
+		}
+
+		//A snapshot which cannot be read leaves the journals after it as they are
+		file = std::fopen((directory + "/snapshot").c_str(), "wb");
+		std::fwrite("JUNK", 1, 4, file);
+		std::fclose(file);
+		{
+			Journal journal(directory);
+			bool opened = journal.open();
+			passed_test += test_assert(!opened && journal.stats().restored == 0 && exists(directory + "/journal.3"), "Unreadable snapshot");
+		}
+		clean();
+
+		std::cout << std::endl << "Test Journal : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_journal();
+	}
+}
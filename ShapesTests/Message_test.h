@@ -0,0 +1,331 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteQueue.hpp"
+#include "Coalescer.hpp"
+#include "Handshake.hpp"
+#include "Requests.hpp"
+#include "Asserts.h"
+
+namespace Message_test
+{
+	static void test_framing()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for Message" << std::endl << std::endl;
+
+		//Far above the old 512 bytes limit
+		std::string big(3 * 1024 * 1024, 'x');
+		for (std::size_t i = 0; i < big.size(); i += 4096)
+			big[i] = (char)(i >> 12);
+		Message sent(Message::IMAGE, big);
+		passed_test += test_assert(sent.length() == Message::header_length + big.size(), "Length");
+
+		Message received;
+		std::memcpy(received.data(), sent.data(), Message::header_length);
+		bool decoded = received.decode_header();
+		std::memcpy(received.body(), sent.body(), received.body_length());
+		passed_test += test_assert(decoded && received.type() == Message::IMAGE
+			&& std::string(received.body(), received.body_length()) == big, "Round trip");
+
+		Message limited;
+		std::memcpy(limited.data(), sent.data(), Message::header_length);
+		passed_test += test_assert(!limited.decode_header(1024) && limited.body_length() == 0, "Maximum frame size");
+
+		Message unknown(Message::GET, std::string());
+		unknown.data()[4] = (char)Message::END_TYPE;
+		passed_test += test_assert(!unknown.decode_header(), "Unknown type");
+
+		std::size_t pooled = BufferPool::shared().size();
+		{
+			Message a(Message::HELLO, "HELLO");
+			Message b(a);
+		}
+		passed_test += test_assert(BufferPool::shared().size() == pooled + 2, "Buffers back to the pool");
+
+		std::cout << std::endl << "Test Message : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_buffer_pool()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for BufferPool" << std::endl << std::endl;
+
+		passed_test += test_assert(BufferPool::class_of(1) == 0 && BufferPool::class_of(BufferPool::min_capacity) == 0
+			&& BufferPool::class_of(BufferPool::min_capacity + 1) == 1 && BufferPool::class_of(BufferPool::max_capacity) == BufferPool::nb_classes - 1
+			&& BufferPool::class_of(BufferPool::max_capacity + 1) == BufferPool::nb_classes, "Size classes");
+
+		BufferPool pool;
+		std::vector<char> a = pool.acquire(1000);
+		pool.release(a);
+		std::vector<char> b = pool.acquire(900);
+		std::vector<char> c = pool.acquire(2000);
+		passed_test += test_assert(pool.stats().hits == 1 && pool.stats().misses == 2 && b.capacity() >= 1024, "Hits and misses by class");
+		bool held = pool.stats().in_use == 2;
+		pool.release(b);
+		pool.release(c);
+		passed_test += test_assert(held && pool.stats().in_use == 0 && pool.size() == 2, "Buffers in use");
+
+		//A message encoded and freed on the same thread takes back the buffer of the previous one, without locking
+		const char* first;
+		{
+			Message m(Message::SYNC, std::string(1000, 'x'));
+			first = m.data();
+		}
+		uint64_t thread_hits = BufferPool::shared().stats().thread_hits;
+		Message n(Message::SYNC, std::string(900, 'y'));
+		passed_test += test_assert(n.data() == first && BufferPool::shared().stats().thread_hits == thread_hits + 1, "Reused by the thread");
+
+		//The buffers a thread keeps go to the shared lists when it ends
+		const char* other = nullptr;
+		std::thread thread([&]() {
+			Message m(Message::IMAGE, std::string(600 * 1024, 'z'));
+			other = m.data();
+		});
+		thread.join();
+		Message o(Message::IMAGE, std::string(600 * 1024, 'w'));
+		passed_test += test_assert(o.data() == other, "Given back at thread exit");
+
+		std::cout << std::endl << "Test BufferPool : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	/*!
+	Copy up to n bytes of stream from pos into the reader, as a read of the socket would
+	*/
+	static void feed(FrameReader& reader, const std::string& stream, std::size_t& pos, std::size_t n)
+	{
+		std::size_t space;
+		char* data = reader.prepare(space);
+		n = std::min(std::min(n, space), stream.size() - pos);
+		std::memcpy(data, stream.data() + pos, n);
+		reader.commit(n);
+		pos += n;
+	}
+
+	static void test_frame_reader()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for FrameReader" << std::endl << std::endl;
+
+		std::string stream;
+		std::vector<std::string> bodies;
+		for (int i = 0; i < 100; ++i)
+		{
+			bodies.push_back(std::string(i * 7, (char)('a' + i % 26)));
+			Message msg(Message::IMAGE, bodies.back());
+			stream.append(msg.data(), msg.length());
+		}
+
+		Message::Type type;
+		const char* body;
+		std::size_t length;
+		FrameReader whole;
+		std::size_t pos = 0;
+		feed(whole, stream, pos, stream.size());
+		int nb_frames = 0;
+		bool same = true;
+		while (whole.next(type, body, length) == FrameReader::FRAME)
+			same = same && std::string(body, length) == bodies[nb_frames++];
+		passed_test += test_assert(nb_frames == 100 && same && whole.pending() == 0, "Every frame of one read");
+
+		//Reads cutting frames anywhere, in a buffer smaller than the stream
+		FrameReader split(Message::default_max_body_length, 256);
+		pos = 0;
+		nb_frames = 0;
+		same = true;
+		while (pos < stream.size())
+		{
+			feed(split, stream, pos, 13);
+			while (split.next(type, body, length) == FrameReader::FRAME)
+				same = same && std::string(body, length) == bodies[nb_frames++];
+		}
+		passed_test += test_assert(nb_frames == 100 && same, "Frames across reads");
+
+		//A frame bigger than the buffer
+		std::string big(100000, 'z');
+		Message big_msg(Message::IMAGE, big);
+		std::string big_stream(big_msg.data(), big_msg.length());
+		FrameReader small(Message::default_max_body_length, 1024);
+		pos = 0;
+		while (pos < big_stream.size())
+			feed(small, big_stream, pos, big_stream.size());
+		passed_test += test_assert(small.next(type, body, length) == FrameReader::FRAME && std::string(body, length) == big, "Frame bigger than the buffer");
+
+		FrameReader limited(1000);
+		pos = 0;
+		feed(limited, big_stream, pos, 1024);
+		passed_test += test_assert(limited.next(type, body, length) == FrameReader::BAD_FRAME, "Maximum frame size");
+
+		std::cout << std::endl << "Test FrameReader : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_write_queue()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for WriteQueue" << std::endl << std::endl;
+
+		WriteQueue queue(4, 1000);
+		Message_ptr small = std::make_shared<const Message>(Message::IMAGE, std::string(95, 's'));
+		bool first_idle = queue.push(small);
+		bool second_idle = queue.push(small);
+		passed_test += test_assert(first_idle && !second_idle, "Idle only when empty");
+
+		for (int i = 0; i < 8; ++i)
+			queue.push(small);
+		std::size_t batch = queue.next_batch().size();
+		queue.pop_batch();
+		passed_test += test_assert(batch == 4 && queue.size() == 6, "Capped by count");
+
+		WriteQueue by_bytes(64, 250);
+		for (int i = 0; i < 5; ++i)
+			by_bytes.push(small);
+		passed_test += test_assert(by_bytes.next_batch().size() == 2, "Capped by bytes");
+
+		WriteQueue big(64, 10);
+		big.push(small);
+		big.push(small);
+		WriteQueue::Batch buffers = big.next_batch();
+		passed_test += test_assert(buffers.size() == 1 && boost::asio::buffer_size(buffers[0]) == small->length(), "Message bigger than the cap");
+
+		//A broadcast message is shared by the queues, not copied
+		WriteQueue other;
+		other.push(small);
+		passed_test += test_assert(boost::asio::buffer_cast<const char*>(other.next_batch()[0]) == small->data()
+			&& boost::asio::buffer_cast<const char*>(buffers[0]) == small->data(), "Shared between queues");
+
+		std::cout << std::endl << "Test WriteQueue : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_queue_limits()
+	{
+		int passed_test = 0;
+		int nb_of_test = 7;
+
+		std::cout << "Begin test suit for WriteQueue limits" << std::endl << std::endl;
+
+		Message_ptr image = std::make_shared<const Message>(Message::IMAGE, std::string(95, 'i'));
+		Message_ptr ack = std::make_shared<const Message>(Message::SYNC_ACK, std::string(2, 'a'));
+
+		//The first image is being written, the next ones are dropped oldest first
+		QueueStats stats;
+		WriteQueue drop;
+		drop.limit(4, 0, WriteQueue::DROP_OLDEST, &stats);
+		drop.push(image);
+		drop.next_batch();
+		drop.push(ack);
+		for (int i = 0; i < 5; ++i)
+			drop.push(image);
+		passed_test += test_assert(drop.size() == 4 && stats.dropped == 3 && !drop.overflowed(), "Drop the oldest");
+		drop.pop_batch();
+		passed_test += test_assert(drop.next_batch().size() == 3 && drop.bytes() == ack->length() + 2 * image->length()
+			&& stats.queued_bytes == drop.bytes() && stats.peak_bytes == ack->length() + 3 * image->length(), "Bytes accounted");
+
+		//Only the latest image stays queued
+		QueueStats stats2;
+		WriteQueue coalesce;
+		coalesce.limit(0, 1000, WriteQueue::COALESCE, &stats2);
+		for (int i = 0; i < 5; ++i)
+		{
+			coalesce.push(ack);
+			coalesce.push(image);
+		}
+		passed_test += test_assert(coalesce.size() == 6 && stats2.coalesced == 4 && stats2.dropped == 0, "Coalesce superseded images");
+
+		//Two pipelined requests are both awaited, only the GET without ID may be lost
+		QueueStats stats_get;
+		WriteQueue gets;
+		gets.limit(2, 0, WriteQueue::COALESCE, &stats_get);
+		gets.push(std::make_shared<const Message>(Message::GET, std::string()));
+		gets.push(std::make_shared<const Message>(Message::GET, Requests::request(1)));
+		gets.push(std::make_shared<const Message>(Message::GET, Requests::request(2)));
+		passed_test += test_assert(gets.size() == 2 && stats_get.coalesced == 0 && stats_get.dropped == 1 && !gets.overflowed()
+			&& gets.next_batch().size() == 2, "Pipelined requests kept");
+
+		//Acknowledgments are never dropped, the queue overflows instead
+		QueueStats stats3;
+		WriteQueue critical;
+		critical.limit(3, 0, WriteQueue::COALESCE, &stats3);
+		for (int i = 0; i < 4; ++i)
+			critical.push(ack);
+		passed_test += test_assert(critical.overflowed() && stats3.overflows == 1 && critical.size() == 4, "Critical messages kept");
+		critical.next_batch();
+		critical.clear();
+		passed_test += test_assert(!critical.overflowed() && critical.empty() && stats3.queued_bytes == 0 && critical.push(ack), "Cleared for a new connection");
+
+		WriteQueue disconnect;
+		disconnect.limit(0, 250, WriteQueue::DISCONNECT);
+		disconnect.push(image);
+		disconnect.push(image);
+		bool fits = !disconnect.overflowed();
+		disconnect.push(image);
+		passed_test += test_assert(fits && disconnect.overflowed() && disconnect.size() == 3, "Disconnect");
+
+		std::cout << std::endl << "Test WriteQueue limits : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_coalescer()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for Coalescer" << std::endl << std::endl;
+
+		boost::asio::io_service io_service;
+		int pushes = 0;
+		Coalescer push(io_service, std::chrono::milliseconds(20), [&]() { pushes++; });
+
+		//A burst of changes, run() returns once the window is over
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < 100; ++i)
+			push.notify();
+		io_service.run();
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		passed_test += test_assert(pushes == 1 && push.notifications() == 100 && push.flushes() == 1, "Burst coalesced");
+		passed_test += test_assert(elapsed >= std::chrono::milliseconds(20), "Pushed after the window");
+
+		io_service.reset();
+		push.notify();
+		io_service.run();
+		passed_test += test_assert(pushes == 2, "New window after a push");
+
+		io_service.reset();
+		push.notify();
+		push.cancel();
+		io_service.run();
+		Handshake subscribing;
+		subscribing.push = true;
+		passed_test += test_assert(pushes == 2 && Handshake::parse(subscribing.encode()).push
+			&& !Handshake::parse(Handshake().encode()).push, "Cancel and subscription");
+
+		std::cout << std::endl << "Test Coalescer : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_framing();
+		std::cout << std::endl;
+		test_buffer_pool();
+		std::cout << std::endl;
+		test_frame_reader();
+		std::cout << std::endl;
+		test_write_queue();
+		std::cout << std::endl;
+		test_queue_limits();
+		std::cout << std::endl;
+		test_coalescer();
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Registry.hpp"
+#include "Asserts.h"
+
+namespace Registry_test
+{
+	struct Participant
+	{
+		Participant(int ID) : ID(ID) {}
+		int ID;
+	};
+
+	static void test_registry()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for Registry" << std::endl << std::endl;
+
+		Registry<Participant> room;
+		auto a = std::make_shared<Participant>(3);
+		auto b = std::make_shared<Participant>(1);
+		auto c = std::make_shared<Participant>(2);
+		room.join(a);
+		room.join(b);
+		room.join(c);
+		Registry<Participant>::Snapshot_ptr before = room.snapshot();
+		std::vector<int> ids;
+		for (auto participant : *before)
+			ids.push_back(participant->ID);
+		passed_test += test_assert(ids == std::vector<int>({ 1, 2, 3 }) && before->epoch() == 3, "Ordered by ID");
+		passed_test += test_assert(room.find(2) == c && !room.find(4), "Lookup by ID");
+
+		bool left = room.leave(c);
+		bool left_twice = room.leave(c);
+		passed_test += test_assert(left && !left_twice && room.snapshot()->size() == 2 && !room.find(2), "Leave");
+		passed_test += test_assert(before->size() == 3 && before->find(2) == c, "Snapshot unchanged by later writes");
+
+		//Readers iterate while writers join and leave, every snapshot must stay sorted and indexed
+		std::atomic<bool> stop(false);
+		std::atomic<bool> consistent(true);
+		std::thread reader([&]()
+		{
+			while (!stop)
+			{
+				Registry<Participant>::Snapshot_ptr snapshot = room.snapshot();
+				int last = -1;
+				for (auto participant : *snapshot)
+				{
+					if (participant->ID <= last || snapshot->find(participant->ID) != participant)
+						consistent = false;
+					last = participant->ID;
+				}
+			}
+		});
+		std::vector<std::thread> writers;
+		for (int w = 0; w < 2; ++w)
+		{
+			writers.push_back(std::thread([&room, w]()
+			{
+				for (int i = 0; i < 500; ++i)
+				{
+					auto participant = std::make_shared<Participant>(100 + w * 1000 + i);
+					room.join(participant);
+					if (i % 2)
+						room.leave(participant);
+				}
+			}));
+		}
+		for (auto& writer : writers)
+			writer.join();
+		stop = true;
+		reader.join();
+		passed_test += test_assert(consistent && room.snapshot()->size() == 2 + 500, "Concurrent readers and writers");
+
+		std::cout << std::endl << "Test Registry : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_registry();
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+
+#include "Relay.hpp"
+#include "Shape.h"
+#include "Sync.h"
+#include "Asserts.h"
+
+namespace Relay_test
+{
+	using namespace Patchwork;
+	static void test_relay()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for Relay" << std::endl << std::endl;
+
+		RelayRecord record(RelayRecord::JOIN, 42);
+		record.node = 1234567890123ull;
+		record.sequence = 7;
+		record.sent_at = RelayRecord::now();
+		record.room = "blue";
+		record.identity = "c0ffee";
+		record.payload = std::string("\0delta\xff", 7);
+		std::string encoded;
+		record.encode(encoded);
+		RelayRecord decoded;
+		passed_test += test_assert(decoded.decode(encoded.data(), encoded.size()) && decoded.kind == RelayRecord::JOIN
+			&& decoded.node == record.node && decoded.sequence == 7 && decoded.sent_at == record.sent_at && decoded.client == 42
+			&& decoded.room == "blue" && decoded.identity == "c0ffee" && decoded.payload == record.payload, "Round trip");
+		passed_test += test_assert(!decoded.decode(encoded.data(), 3), "Truncated");
+
+		uint64_t node = 0;
+		passed_test += test_assert(RelayRecord::peer(RelayRecord::handshake(99), node) && node == 99
+			&& !RelayRecord::peer("HELLO lz push room=relay", node), "Peer handshake");
+
+		ReplicationLag lag;
+		RelayRecord numbered(RelayRecord::SYNC, 1);
+		for (uint64_t sequence : { 1, 2, 5, 6 })
+		{
+			numbered.sequence = sequence;
+			numbered.sent_at = 1000;
+			lag.account(numbered, 1000 + sequence * 10);
+		}
+		passed_test += test_assert(lag.records == 4 && lag.gaps == 2 && lag.sequence == 6 && lag.last_us == 60 && lag.max_us == 60
+			&& lag.total_us == 140, "Lag accounting");
+
+		//A replica starting from the snapshot of the server follows the next deltas of the client
+		Image client;
+		for (int i = 0; i < 20; ++i)
+			client.add_component(new Circle(Vec2((float)i, (float)i), 5.f, Color(0, 0, 255)));
+		SyncSender sender;
+		SyncReceiver receiver;
+		Image server;
+		std::string delta;
+		uint64_t version;
+		sender.make_delta(client, delta);
+		receiver.apply(server, delta, version);
+		client.components().at(3)->translate(Vec2(1, 1));
+		delta.clear();
+		sender.make_delta(client, delta);
+		receiver.apply(server, delta, version);
+		std::string snapshot;
+		SyncReceiver replica;
+		Image mirror;
+		bool made = receiver.snapshot(server, snapshot);
+		client.components().at(4)->translate(Vec2(2, 2));
+		delta.clear();
+		sender.make_delta(client, delta);
+		std::string expected, got;
+		client.serialize(expected);
+		passed_test += test_assert(made && replica.apply(mirror, snapshot, version) == SyncReceiver::APPLIED && version == 2
+			&& replica.apply(mirror, delta, version) == SyncReceiver::APPLIED && (mirror.serialize(got), got == expected), "Snapshot then delta");
+
+		std::cout << std::endl << "Test Relay : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_relay();
+	}
+}
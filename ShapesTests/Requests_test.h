@@ -0,0 +1,67 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Requests.hpp"
+#include "Asserts.h"
+
+namespace Requests_test
+{
+	static void test_requests()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for Requests" << std::endl << std::endl;
+
+		RequestStats stats;
+		Requests requests(&stats);
+		std::vector<std::string> completed;
+		std::vector<Requests::Status> statuses;
+		auto record = [&](const std::string& name)
+		{
+			return [&, name](Requests::Status status, const std::string& result)
+			{
+				completed.push_back(name + result);
+				statuses.push_back(status);
+			};
+		};
+
+		//Three requests in flight, replied in another order
+		uint64_t first = requests.start(record("first"), std::chrono::seconds(10));
+		uint64_t second = requests.start(record("second"), std::chrono::seconds(10));
+		uint64_t third = requests.start(record("third"), std::chrono::milliseconds(1));
+		requests.complete(second, Requests::DONE, ":2");
+		requests.complete(first, Requests::DONE, ":1");
+		passed_test += test_assert(first && first != second && completed.size() == 2 && completed[0] == "second:2" && completed[1] == "first:1"
+			&& requests.pending() == 1, "Out of order completion");
+
+		//The third one is not replied in time, its reply comes too late
+		passed_test += test_assert(requests.expire(Requests::Clock::now() + std::chrono::milliseconds(2)) == 1 && statuses.back() == Requests::TIMED_OUT
+			&& !requests.complete(third, Requests::DONE, std::string()) && completed.size() == 3, "Timed out");
+
+		//The connection closes with a request in flight
+		requests.start(record("fourth"), std::chrono::seconds(10));
+		requests.cancel();
+		passed_test += test_assert(statuses.back() == Requests::FAILED && !requests.pending(), "Cancelled");
+		passed_test += test_assert(stats.started == 4 && stats.completed == 2 && stats.timed_out == 1 && stats.failed == 1 && stats.late == 1,
+			"Counted");
+
+		//Wire format, a request without ID is the former GET
+		uint64_t id;
+		Requests::Status status;
+		std::string arguments, result;
+		passed_test += test_assert(Requests::parse_request(Requests::request(300, "args"), id, arguments) && id == 300 && arguments == "args"
+			&& !Requests::parse_request(std::string(), id, arguments)
+			&& Requests::parse_reply(Requests::reply(300, Requests::FAILED, "why"), id, status, result) && id == 300
+			&& status == Requests::FAILED && result == "why" && !Requests::parse_reply(Requests::request(300), id, status, result), "Wire format");
+
+		std::cout << std::endl << "Test Requests : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_requests();
+	}
+}
@@ -5,6 +5,18 @@
 #include <tchar.h>
 #endif
 #include "Shape_test.h"
+#include "Codec_test.h"
+#include "Compression_test.h"
+#include "Handshake_test.h"
+#include "Message_test.h"
+#include "Sync_test.h"
+#include "Registry_test.h"
+#include "Relay_test.h"
+#include "Requests_test.h"
+#include "Journal_test.h"
+#include "Handoff_test.h"
+#include "Transport_test.h"
+#include "HandlerMemory_test.h"
 #include "SDL2/SDL.h"
 
 using namespace Patchwork;
@@ -16,6 +28,30 @@ int main()
 {
 	
 	Shape_test::run_tests();
+	std::cout << std::endl;
+	Codec_test::run_tests();
+	std::cout << std::endl;
+	Compression_test::run_tests();
+	std::cout << std::endl;
+	Handshake_test::run_tests();
+	std::cout << std::endl;
+	Message_test::run_tests();
+	std::cout << std::endl;
+	Sync_test::run_tests();
+	std::cout << std::endl;
+	Registry_test::run_tests();
+	std::cout << std::endl;
+	Relay_test::run_tests();
+	std::cout << std::endl;
+	Requests_test::run_tests();
+	std::cout << std::endl;
+	Journal_test::run_tests();
+	std::cout << std::endl;
+	Handoff_test::run_tests();
+	std::cout << std::endl;
+	Transport_test::run_tests();
+	std::cout << std::endl;
+	HandlerMemory_test::run_tests();
 	SDL_Init(SDL_INIT_VIDEO);
 	SDL_Event event;
 	SDL_Window *window;
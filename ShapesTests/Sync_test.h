@@ -0,0 +1,151 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "Shape.h"
+#include "Sync.h"
+#include "Asserts.h"
+
+namespace Sync_test
+{
+	using namespace Patchwork;
+	/*!
+	True if both images serialize to the same text
+	*/
+	static bool same_image(Image& a, Image& b)
+	{
+		std::string sa, sb;
+		a.serialize(sa);
+		b.serialize(sb);
+		return sa == sb;
+	}
+
+	static void test_sync()
+	{
+		int passed_test = 0;
+		int nb_of_test = 7;
+
+		std::cout << "Begin test suit for Sync" << std::endl << std::endl;
+
+		Image client;
+		for (int i = 0; i < 200; ++i)
+			client.add_component(new Polygon({ { 0, (float)i }, { 10, (float)i }, { 10, (float)(i + 5) }, { 0, (float)(i + 5) } }, Color(i % 256, 0, 0)));
+		client.add_component(new Circle(Vec2(1.5f, 2.f), 10.f, Color(255, 0, 0)));
+		client.annotate("Synchronized");
+
+		GeometryCodec codec;
+		SyncSender sender(&codec);
+		SyncReceiver receiver;
+		Image server;
+		std::string first;
+		uint64_t version;
+		bool made = sender.make_delta(client, first);
+		passed_test += test_assert(made && receiver.apply(server, first, version) == SyncReceiver::APPLIED
+			&& version == 1 && same_image(client, server) && server.get_annotation() == "Synchronized", "Reset");
+
+		std::string nothing;
+		passed_test += test_assert(!sender.make_delta(client, nothing) && nothing.empty(), "Nothing changed");
+
+		client.components().at(42)->translate(Vec2(3, 4));
+		std::string moved;
+		sender.make_delta(client, moved);
+		passed_test += test_assert(moved.size() * 50 < first.size() && receiver.apply(server, moved, version) == SyncReceiver::APPLIED
+			&& same_image(client, server), "One shape moved");
+
+		Shape* removed = client.components().at(7);
+		client.components().erase(client.components().begin() + 7);
+		delete removed;
+		client.add_component(new Ellipse(Vec2(5, 5), Vec2(10, 3), Color(1, 2, 3)));
+		std::string edited;
+		sender.make_delta(client, edited);
+		passed_test += test_assert(receiver.apply(server, edited, version) == SyncReceiver::APPLIED && same_image(client, server)
+			&& server.components().back()->id() == client.components().back()->id(), "Removed and added");
+
+		std::string truncated;
+		client.components().at(0)->translate(Vec2(1, 1));
+		sender.make_delta(client, truncated);
+		truncated.resize(truncated.size() - 2);
+		std::string before;
+		server.serialize(before);
+		std::string after;
+		SyncReceiver::Status status = receiver.apply(server, truncated, version);
+		server.serialize(after);
+		passed_test += test_assert(status == SyncReceiver::BAD_DELTA && before == after, "Malformed delta ignored");
+
+		//The truncated delta was lost, the next one does not apply
+		client.components().at(1)->translate(Vec2(1, 1));
+		std::string next;
+		sender.make_delta(client, next);
+		passed_test += test_assert(receiver.apply(server, next, version) == SyncReceiver::OUT_OF_SYNC, "Out of sync");
+
+		bool reset = sender.rejected(version);
+		std::string whole;
+		sender.make_delta(client, whole);
+		passed_test += test_assert(reset && receiver.apply(server, whole, version) == SyncReceiver::APPLIED && same_image(client, server), "Reset after rejection");
+
+		std::cout << std::endl << "Test Sync : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_operations()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for Operation" << std::endl << std::endl;
+
+		Image client;
+		std::vector<Vec2> stroke;
+		for (int i = 0; i < 2000; ++i)
+			stroke.push_back(Vec2((float)i, (float)(i % 17)));
+		client.add_component(new Polygon(stroke, Color(0, 0, 255)));
+		client.add_component(new Circle(Vec2(1.5f, 2.f), 10.f, Color(255, 0, 0)));
+
+		GeometryCodec codec;
+		SyncSender sender(&codec);
+		SyncReceiver receiver;
+		Image server;
+		std::string first;
+		uint64_t version;
+		sender.make_delta(client, first);
+		receiver.apply(server, first, version);
+
+		uint32_t stroke_id = client.components().at(0)->id();
+		std::string rotation;
+		bool made = sender.make_operation(client, Operation(stroke_id, Shape::ROTATION, 0.5f), rotation);
+		passed_test += test_assert(made && rotation.size() < 16 && receiver.apply_operation(server, rotation, version) == SyncReceiver::APPLIED
+			&& same_image(client, server), "Rotation");
+
+		std::string symetry;
+		sender.make_operation(client, Operation(stroke_id, Shape::AXIAL_SYMETRY, 0.f, 0.f, 1.f, 1.f), symetry);
+		std::string translation;
+		sender.make_operation(client, Operation(client.components().at(1)->id(), Shape::TRANSLATE, 3.f, 4.f), translation);
+		passed_test += test_assert(receiver.apply_operation(server, symetry, version) == SyncReceiver::APPLIED
+			&& receiver.apply_operation(server, translation, version) == SyncReceiver::APPLIED && same_image(client, server), "In sequence");
+
+		std::string nothing;
+		passed_test += test_assert(!sender.make_delta(client, nothing), "Nothing left for the delta");
+
+		//A change not sent yet : the operation goes with the next delta
+		client.components().at(1)->translate(Vec2(1, 1));
+		std::string skipped;
+		bool sent = sender.make_operation(client, Operation(client.components().at(1)->id(), Shape::HOMOTHETY, 2.f), skipped);
+		std::string delta;
+		sender.make_delta(client, delta);
+		passed_test += test_assert(!sent && skipped.empty() && receiver.apply(server, delta, version) == SyncReceiver::APPLIED
+			&& same_image(client, server), "Unsent changes go with the delta");
+
+		std::string first_op, second_op;
+		sender.make_operation(client, Operation(stroke_id, Shape::TRANSLATE, 1.f, 0.f), first_op);
+		sender.make_operation(client, Operation(stroke_id, Shape::TRANSLATE, 1.f, 0.f), second_op);
+		passed_test += test_assert(receiver.apply_operation(server, second_op, version) == SyncReceiver::OUT_OF_SYNC, "Out of sequence");
+
+		std::cout << std::endl << "Test Operation : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_sync();
+		std::cout << std::endl;
+		test_operations();
+	}
+}
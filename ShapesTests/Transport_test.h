@@ -0,0 +1,74 @@
+#pragma once
+#include <memory>
+#include <string>
+
+#include "Transport.hpp"
+#include "Asserts.h"
+
+namespace Transport_test
+{
+	static void test_endpoint()
+	{
+		int passed_test = 0;
+		int nb_of_test = 3;
+
+		std::cout << "Begin test suit for Endpoint" << std::endl << std::endl;
+
+		Endpoint endpoint;
+		passed_test += test_assert(Endpoint::parse("8081", endpoint) && endpoint.scheme == Endpoint::TCP && endpoint.host == "127.0.0.1"
+			&& endpoint.port == "8081" && Endpoint::parse("tcp://example.org:9000", endpoint) && endpoint.host == "example.org"
+			&& endpoint.port == "9000", "TCP endpoints");
+		passed_test += test_assert(Endpoint::parse("unix:///tmp/patchwork.sock", endpoint) && endpoint.scheme == Endpoint::UNIX
+			&& endpoint.path == "/tmp/patchwork.sock" && endpoint.local() && Endpoint::parse("shm:///tmp/patchwork.sock", endpoint)
+			&& endpoint.scheme == Endpoint::SHM, "Local endpoints");
+		passed_test += test_assert(!Endpoint::parse("", endpoint) && !Endpoint::parse("80a", endpoint) && !Endpoint::parse("tcp://host", endpoint)
+			&& !Endpoint::parse("udp://host:80", endpoint) && !Endpoint::parse("unix://", endpoint), "Malformed endpoints");
+
+		std::cout << std::endl << "Test Endpoint : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_ring()
+	{
+		std::unique_ptr<SharedRing> writer = SharedRing::create("/patchwork-transport-test", 1000);
+		std::unique_ptr<SharedRing> reader = writer ? SharedRing::attach(writer->name()) : nullptr;
+		if (!reader)
+			return;
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for SharedRing" << std::endl << std::endl;
+
+		//The client writes a body and references it, the server reads it through its own mapping
+		std::string body(600, 'a');
+		uint64_t position, size;
+		Message::Type type;
+		bool written = writer->write(body.data(), body.size(), position);
+		std::string reference = SharedRing::reference(Message::IMAGE, position, body.size());
+		passed_test += test_assert(written && SharedRing::dereference(reference.data(), reference.size(), type, position, size)
+			&& type == Message::IMAGE && std::string(reader->read(position, size), (std::size_t)size) == body, "Body read in place");
+
+		//No room before the first body is released, then the second starts over at the beginning
+		std::string second(500, 'b');
+		uint64_t second_position;
+		bool full = !writer->write(second.data(), second.size(), second_position);
+		reader->release(position + size);
+		written = writer->write(second.data(), second.size(), second_position);
+		passed_test += test_assert(full && written && second_position == 1000
+			&& std::string(reader->read(second_position, second.size()), second.size()) == second, "Full then wrapped");
+
+		passed_test += test_assert(!reader->read(900, 200) && !reader->read(0, 1001)
+			&& !SharedRing::dereference(reference.data(), 2, type, position, size), "Bad references");
+
+		passed_test += test_assert(SharedRing::name_in("HELLO lz id=5" + SharedRing::handshake(writer->name())) == writer->name()
+			&& SharedRing::name_in("HELLO lz").empty(), "Named in the handshake");
+
+		std::cout << std::endl << "Test SharedRing : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void run_tests()
+	{
+		test_endpoint();
+		std::cout << std::endl;
+		test_ring();
+	}
+}